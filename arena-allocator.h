@@ -0,0 +1,301 @@
+#ifndef ARENA_ALLOCATOR_H
+#define ARENA_ALLOCATOR_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+/**
+ * A slab pool that hands out fixed-size blocks carved from contiguous chunks.
+ * Freed blocks go on an intrusive free list and are reused before the current
+ * chunk is advanced. release() returns every chunk at once, so a whole tree
+ * can be torn down in O(chunks) instead of one delete per node.
+ */
+class NodeArena
+{
+public:
+    NodeArena(std::size_t blockSize, std::size_t blockAlign);
+    ~NodeArena();
+
+    void* allocate();
+    void deallocate(void* block);
+    void release();
+
+    std::size_t blockSize() const;
+    std::size_t chunkCount() const;
+
+    static std::size_t roundBlockSize(std::size_t size, std::size_t align);
+
+private:
+    NodeArena(const NodeArena&) = delete;
+    NodeArena& operator=(const NodeArena&) = delete;
+
+    void grow();
+
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    // chunks start small so tiny trees stay tiny, then double up to this cap
+    static const std::size_t MIN_CHUNK_BLOCKS = 64;
+    static const std::size_t MAX_CHUNK_BLOCKS = 65536;
+
+    std::size_t blockSize_;
+    std::size_t nextChunkBlocks_;
+    std::vector<char*> chunks_;
+    char* cursor_;
+    char* chunkEnd_;
+    FreeBlock* freeList_;
+};
+
+/*
+  ---------------------------------------------
+  Begin implementations for the NodeArena class.
+  ---------------------------------------------
+*/
+
+/**
+* Rounds the block size up so consecutive blocks keep the node's alignment
+* and each block is large enough to hold a free list link.
+*/
+inline NodeArena::NodeArena(std::size_t blockSize, std::size_t blockAlign) :
+    blockSize_(roundBlockSize(blockSize, blockAlign)),
+    nextChunkBlocks_(MIN_CHUNK_BLOCKS),
+    cursor_(nullptr),
+    chunkEnd_(nullptr),
+    freeList_(nullptr)
+{
+
+}
+
+inline NodeArena::~NodeArena()
+{
+    release();
+}
+
+/**
+* Pops a block off the free list, or bumps the cursor in the current chunk.
+*/
+inline void* NodeArena::allocate()
+{
+    if(freeList_ != nullptr) {
+        FreeBlock* block = freeList_;
+        freeList_ = block->next;
+        return block;
+    }
+    if(cursor_ == chunkEnd_) {
+        grow();
+    }
+    void* block = cursor_;
+    cursor_ += blockSize_;
+    return block;
+}
+
+/**
+* Pushes a block back on the free list. The memory stays owned by the arena.
+*/
+inline void NodeArena::deallocate(void* block)
+{
+    FreeBlock* freed = static_cast<FreeBlock*>(block);
+    freed->next = freeList_;
+    freeList_ = freed;
+}
+
+/**
+* Frees every chunk. Any block handed out before this call is invalid after it.
+*/
+inline void NodeArena::release()
+{
+    for(std::size_t i = 0; i < chunks_.size(); ++i) {
+        ::operator delete(chunks_[i]);
+    }
+    chunks_.clear();
+    nextChunkBlocks_ = MIN_CHUNK_BLOCKS;
+    cursor_ = nullptr;
+    chunkEnd_ = nullptr;
+    freeList_ = nullptr;
+}
+
+inline std::size_t NodeArena::blockSize() const
+{
+    return blockSize_;
+}
+
+inline std::size_t NodeArena::chunkCount() const
+{
+    return chunks_.size();
+}
+
+inline std::size_t NodeArena::roundBlockSize(std::size_t size, std::size_t align)
+{
+    if(align < alignof(FreeBlock)) {
+        align = alignof(FreeBlock);
+    }
+    if(size < sizeof(FreeBlock)) {
+        size = sizeof(FreeBlock);
+    }
+    return (size + align - 1) / align * align;
+}
+
+inline void NodeArena::grow()
+{
+    std::size_t bytes = blockSize_ * nextChunkBlocks_;
+    char* chunk = static_cast<char*>(::operator new(bytes));
+    chunks_.push_back(chunk);
+    cursor_ = chunk;
+    chunkEnd_ = chunk + bytes;
+    if(nextChunkBlocks_ < MAX_CHUNK_BLOCKS) {
+        nextChunkBlocks_ *= 2;
+    }
+}
+
+/*
+  -------------------------------------------
+  End implementations for the NodeArena class.
+  -------------------------------------------
+*/
+
+/**
+ * A standard allocator backed by a NodeArena. A default constructed allocator
+ * owns a fresh arena; copies and rebound copies share it, so a tree and the
+ * node allocator it rebinds to draw from the same chunks.
+ *
+ * Only single-object allocations of the first size requested go through the
+ * arena (that is the node type); anything else falls back to operator new.
+ * Each tree should be given its own ArenaAllocator, since clearing the tree
+ * releases the whole arena.
+ */
+template <typename T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+
+    ArenaAllocator();
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other);
+
+    T* allocate(std::size_t n);
+    void deallocate(T* p, std::size_t n);
+    void release();
+    std::size_t chunkCount() const;
+    ArenaAllocator select_on_container_copy_construction() const;
+
+    template<typename U>
+    bool operator==(const ArenaAllocator<U>& rhs) const;
+    template<typename U>
+    bool operator!=(const ArenaAllocator<U>& rhs) const;
+
+private:
+    template<typename U> friend class ArenaAllocator;
+
+    // The arena is created lazily so rebinding never creates one of the wrong size
+    std::shared_ptr<std::unique_ptr<NodeArena> > arena_;
+};
+
+/*
+  --------------------------------------------------
+  Begin implementations for the ArenaAllocator class.
+  --------------------------------------------------
+*/
+
+template<typename T>
+ArenaAllocator<T>::ArenaAllocator() :
+    arena_(std::make_shared<std::unique_ptr<NodeArena> >())
+{
+
+}
+
+template<typename T>
+template<typename U>
+ArenaAllocator<T>::ArenaAllocator(const ArenaAllocator<U>& other) :
+    arena_(other.arena_)
+{
+
+}
+
+template<typename T>
+T* ArenaAllocator<T>::allocate(std::size_t n)
+{
+    if(n == 1) {
+        if(!*arena_) {
+            arena_->reset(new NodeArena(sizeof(T), alignof(T)));
+        }
+        if((*arena_)->blockSize() == NodeArena::roundBlockSize(sizeof(T), alignof(T))) {
+            return static_cast<T*>((*arena_)->allocate());
+        }
+    }
+    return static_cast<T*>(::operator new(n * sizeof(T)));
+}
+
+template<typename T>
+void ArenaAllocator<T>::deallocate(T* p, std::size_t n)
+{
+    if(n == 1 && *arena_ &&
+       (*arena_)->blockSize() == NodeArena::roundBlockSize(sizeof(T), alignof(T))) {
+        (*arena_)->deallocate(p);
+        return;
+    }
+    ::operator delete(p);
+}
+
+/**
+* Drops every chunk of the shared arena without visiting individual blocks.
+*/
+template<typename T>
+void ArenaAllocator<T>::release()
+{
+    if(*arena_) {
+        (*arena_)->release();
+    }
+}
+
+/**
+* Copying a container gives the copy an arena of its own; see the class comment.
+*/
+template<typename T>
+ArenaAllocator<T> ArenaAllocator<T>::select_on_container_copy_construction() const
+{
+    return ArenaAllocator();
+}
+
+template<typename T>
+std::size_t ArenaAllocator<T>::chunkCount() const
+{
+    return *arena_ ? (*arena_)->chunkCount() : 0;
+}
+
+template<typename T>
+template<typename U>
+bool ArenaAllocator<T>::operator==(const ArenaAllocator<U>& rhs) const
+{
+    return arena_ == rhs.arena_;
+}
+
+template<typename T>
+template<typename U>
+bool ArenaAllocator<T>::operator!=(const ArenaAllocator<U>& rhs) const
+{
+    return arena_ != rhs.arena_;
+}
+
+/*
+  ------------------------------------------------
+  End implementations for the ArenaAllocator class.
+  ------------------------------------------------
+*/
+
+/**
+ * Trait the trees use to decide whether clear() may hand the whole arena back
+ * instead of deallocating node by node.
+ */
+template <typename Alloc>
+struct is_arena_allocator : std::false_type { };
+
+template <typename T>
+struct is_arena_allocator<ArenaAllocator<T> > : std::true_type { };
+
+#endif
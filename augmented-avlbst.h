@@ -0,0 +1,452 @@
+#ifndef AUGMENTED_AVLBST_H
+#define AUGMENTED_AVLBST_H
+
+#include <limits>
+#include <utility>
+#include "avlbst.h"
+
+/**
+* Monoids for AugmentedAVLTree. A monoid tells the tree how to summarize its
+* items and must provide:
+*
+*   typedef ... value_type;
+*   value_type identity() const;        // combine(identity(), x) == x
+*   value_type lift(const std::pair<const Key, Value>& item) const;
+*   value_type combine(const value_type& a, const value_type& b) const;
+*
+* combine must be associative. It need not be commutative: summaries are always
+* combined in key order.
+*/
+template <typename T>
+struct ValueSum
+{
+    typedef T value_type;
+
+    value_type identity() const { return T(); }
+    template<typename Item>
+    value_type lift(const Item& item) const { return item.second; }
+    value_type combine(const value_type& a, const value_type& b) const { return a + b; }
+};
+
+template <typename T>
+struct ValueMin
+{
+    typedef T value_type;
+
+    value_type identity() const { return std::numeric_limits<T>::max(); }
+    template<typename Item>
+    value_type lift(const Item& item) const { return item.second; }
+    value_type combine(const value_type& a, const value_type& b) const { return b < a ? b : a; }
+};
+
+template <typename T>
+struct ValueMax
+{
+    typedef T value_type;
+
+    value_type identity() const { return std::numeric_limits<T>::lowest(); }
+    template<typename Item>
+    value_type lift(const Item& item) const { return item.second; }
+    value_type combine(const value_type& a, const value_type& b) const { return a < b ? b : a; }
+};
+
+/**
+* An AVLNode that also holds the monoid summary of its subtree.
+*/
+template <typename Key, typename Value, typename Summary>
+class AugmentedAVLNode : public AVLNode<Key, Value>
+{
+public:
+    AugmentedAVLNode(const Key& key, const Value& value, AugmentedAVLNode<Key, Value, Summary>* parent);
+    template<typename KeyArg, typename... ValueArgs>
+    AugmentedAVLNode(std::piecewise_construct_t, AugmentedAVLNode<Key, Value, Summary>* parent,
+                     KeyArg&& key, ValueArgs&&... valueArgs);
+
+    const Summary& getSummary() const;
+    void setSummary(const Summary& summary);
+
+    // Redeclared so AugmentedAVLTree code gets AugmentedAVLNodes back; see AVLNode.
+    AugmentedAVLNode<Key, Value, Summary>* getParent() const;
+    AugmentedAVLNode<Key, Value, Summary>* getLeft() const;
+    AugmentedAVLNode<Key, Value, Summary>* getRight() const;
+
+protected:
+    Summary summary_;
+};
+
+/*
+  ----------------------------------------------------
+  Begin implementations for the AugmentedAVLNode class.
+  ----------------------------------------------------
+*/
+
+template<class Key, class Value, class Summary>
+AugmentedAVLNode<Key, Value, Summary>::AugmentedAVLNode(const Key& key, const Value& value,
+                                                        AugmentedAVLNode<Key, Value, Summary>* parent) :
+    AVLNode<Key, Value>(key, value, parent), summary_()
+{
+
+}
+
+template<class Key, class Value, class Summary>
+template<typename KeyArg, typename... ValueArgs>
+AugmentedAVLNode<Key, Value, Summary>::AugmentedAVLNode(std::piecewise_construct_t,
+                                                        AugmentedAVLNode<Key, Value, Summary>* parent,
+                                                        KeyArg&& key, ValueArgs&&... valueArgs) :
+    AVLNode<Key, Value>(std::piecewise_construct, parent,
+                        std::forward<KeyArg>(key), std::forward<ValueArgs>(valueArgs)...),
+    summary_()
+{
+
+}
+
+template<class Key, class Value, class Summary>
+const Summary& AugmentedAVLNode<Key, Value, Summary>::getSummary() const
+{
+    return summary_;
+}
+
+template<class Key, class Value, class Summary>
+void AugmentedAVLNode<Key, Value, Summary>::setSummary(const Summary& summary)
+{
+    summary_ = summary;
+}
+
+template<class Key, class Value, class Summary>
+AugmentedAVLNode<Key, Value, Summary>* AugmentedAVLNode<Key, Value, Summary>::getParent() const
+{
+    return static_cast<AugmentedAVLNode<Key, Value, Summary>*>(Node<Key, Value>::getParent());
+}
+
+template<class Key, class Value, class Summary>
+AugmentedAVLNode<Key, Value, Summary>* AugmentedAVLNode<Key, Value, Summary>::getLeft() const
+{
+    return static_cast<AugmentedAVLNode<Key, Value, Summary>*>(this->left_);
+}
+
+template<class Key, class Value, class Summary>
+AugmentedAVLNode<Key, Value, Summary>* AugmentedAVLNode<Key, Value, Summary>::getRight() const
+{
+    return static_cast<AugmentedAVLNode<Key, Value, Summary>*>(this->right_);
+}
+
+/*
+  --------------------------------------------------
+  End implementations for the AugmentedAVLNode class.
+  --------------------------------------------------
+*/
+
+/**
+* An AVL tree where every node caches the Monoid summary of its subtree, so
+* aggregate(lo, hi) combines the values of any key range in O(log n) no matter
+* how many items the range holds. Summaries are recomputed along the changed
+* path on every insert, overwrite and remove.
+*
+* Values must only be changed through insert/insert_or_assign: writing through
+* an iterator or operator[] bypasses the tree and leaves the summaries stale.
+*/
+template <class Key, class Value, class Monoid,
+          class Compare = std::less<Key>,
+          class Alloc = std::allocator<std::pair<const Key, Value> > >
+class AugmentedAVLTree : public AVLTree<Key, Value, Compare, Alloc>
+{
+public:
+    typedef typename Monoid::value_type summary_type;
+
+    AugmentedAVLTree();
+    explicit AugmentedAVLTree(const Monoid& monoid, const Compare& comp = Compare(),
+                              const Alloc& alloc = Alloc());
+    explicit AugmentedAVLTree(const Alloc& alloc);
+    template<typename ForwardIt>
+    AugmentedAVLTree(ForwardIt first, ForwardIt last, const Monoid& monoid = Monoid(),
+                     const Compare& comp = Compare(), const Alloc& alloc = Alloc());
+    AugmentedAVLTree(const AugmentedAVLTree& other);
+    AugmentedAVLTree(AugmentedAVLTree&& other);
+    AugmentedAVLTree& operator=(const AugmentedAVLTree& other);
+    AugmentedAVLTree& operator=(AugmentedAVLTree&& other);
+    void swap(AugmentedAVLTree& other);
+    virtual ~AugmentedAVLTree();
+
+    typedef typename AVLTree<Key, Value, Compare, Alloc>::iterator iterator;
+
+    // Range aggregates
+    summary_type aggregate() const;
+    summary_type aggregate(const Key& lo, const Key& hi) const;
+
+protected:
+    typedef AugmentedAVLNode<Key, Value, summary_type> AugNode;
+
+    AugNode* root() const;
+    summary_type summaryOf(const AugNode* node) const;
+    void refreshPath(Node<Key, Value>* node);
+
+    virtual Node<Key, Value>* createBuildNode(const std::pair<const Key, Value>& item,
+                                              int leftHeight, int rightHeight);
+    virtual Node<Key, Value>* createInsertNode(Node<Key, Value>* parent, Key&& key, Value&& value);
+    virtual void valueAssigned(Node<Key, Value>* node);
+    virtual void destroyNode(Node<Key, Value>* node);
+    virtual void linkNewNode(Node<Key, Value>* node, Node<Key, Value>* parent, bool asLeft);
+    virtual void pullUp(Node<Key, Value>* node);
+    virtual void unlinkNode(AVLNode<Key, Value>* node);
+
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<AugNode> AugNodeAlloc;
+    typedef std::allocator_traits<AugNodeAlloc> AugNodeAllocTraits;
+    AugNodeAlloc augNodeAlloc_;
+    Monoid monoid_;
+};
+
+template<class Key, class Value, class Monoid, class Compare, class Alloc>
+AugmentedAVLTree<Key, Value, Monoid, Compare, Alloc>::AugmentedAVLTree() :
+    AVLTree<Key, Value, Compare, Alloc>(), augNodeAlloc_(this->nodeAlloc_), monoid_()
+{
+
+}
+
+template<class Key, class Value, class Monoid, class Compare, class Alloc>
+AugmentedAVLTree<Key, Value, Monoid, Compare, Alloc>::AugmentedAVLTree(const Monoid& monoid,
+                                                                       const Compare& comp,
+                                                                       const Alloc& alloc) :
+    AVLTree<Key, Value, Compare, Alloc>(comp, alloc), augNodeAlloc_(this->nodeAlloc_), monoid_(monoid)
+{
+
+}
+
+template<class Key, class Value, class Monoid, class Compare, class Alloc>
+AugmentedAVLTree<Key, Value, Monoid, Compare, Alloc>::AugmentedAVLTree(const Alloc& alloc) :
+    AVLTree<Key, Value, Compare, Alloc>(alloc), augNodeAlloc_(this->nodeAlloc_), monoid_()
+{
+
+}
+
+/**
+* Builds the tree from a range sorted by key in O(n); see RankedAVLTree for why
+* the base is filled here rather than by the AVLTree range constructor.
+*/
+template<class Key, class Value, class Monoid, class Compare, class Alloc>
+template<typename ForwardIt>
+AugmentedAVLTree<Key, Value, Monoid, Compare, Alloc>::AugmentedAVLTree(ForwardIt first, ForwardIt last,
+                                                                       const Monoid& monoid,
+                                                                       const Compare& comp,
+                                                                       const Alloc& alloc) :
+    AVLTree<Key, Value, Compare, Alloc>(comp, alloc), augNodeAlloc_(this->nodeAlloc_), monoid_(monoid)
+{
+    this->assign(first, last);
+}
+
+/**
+* Copies other in O(n); the summaries are recomputed by pullUp() as the copy
+* is built. See AVLTree for why this cannot be left to the base.
+*/
+template<class Key, class Value, class Monoid, class Compare, class Alloc>
+AugmentedAVLTree<Key, Value, Monoid, Compare, Alloc>::AugmentedAVLTree(const AugmentedAVLTree& other) :
+    AVLTree<Key, Value, Compare, Alloc>(other.key_comp(), other.copyAllocator()),
+    augNodeAlloc_(this->nodeAlloc_), monoid_(other.monoid_)
+{
+    this->cloneFrom(other);
+}
+
+template<class Key, class Value, class Monoid, class Compare, class Alloc>
+AugmentedAVLTree<Key, Value, Monoid, Compare, Alloc>::AugmentedAVLTree(AugmentedAVLTree&& other) :
+    AVLTree<Key, Value, Compare, Alloc>(std::move(other)),
+    augNodeAlloc_(this->nodeAlloc_), monoid_(other.monoid_)
+{
+    other.augNodeAlloc_ = AugNodeAlloc(other.nodeAlloc_);
+}
+
+template<class Key, class Value, class Monoid, class Compare, class Alloc>
+AugmentedAVLTree<Key, Value, Monoid, Compare, Alloc>&
+AugmentedAVLTree<Key, Value, Monoid, Compare, Alloc>::operator=(const AugmentedAVLTree& other)
+{
+    if(this != &other) {
+        AugmentedAVLTree copy(other);
+        swap(copy);
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Monoid, class Compare, class Alloc>
+AugmentedAVLTree<Key, Value, Monoid, Compare, Alloc>&
+AugmentedAVLTree<Key, Value, Monoid, Compare, Alloc>::operator=(AugmentedAVLTree&& other)
+{
+    if(this != &other) {
+        AugmentedAVLTree moved(std::move(other));
+        swap(moved);
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Monoid, class Compare, class Alloc>
+void AugmentedAVLTree<Key, Value, Monoid, Compare, Alloc>::swap(AugmentedAVLTree& other)
+{
+    AVLTree<Key, Value, Compare, Alloc>::swap(other);
+    std::swap(augNodeAlloc_, other.augNodeAlloc_);
+    std::swap(monoid_, other.monoid_);
+}
+
+template<class Key, class Value, class Monoid, class Compare, class Alloc>
+AugmentedAVLTree<Key, Value, Monoid, Compare, Alloc>::~AugmentedAVLTree()
+{
+    this->clear();
+}
+
+/**
+* Returns the summary of every item in O(1).
+*/
+template<class Key, class Value, class Monoid, class Compare, class Alloc>
+typename AugmentedAVLTree<Key, Value, Monoid, Compare, Alloc>::summary_type
+AugmentedAVLTree<Key, Value, Monoid, Compare, Alloc>::aggregate() const
+{
+    return summaryOf(root());
+}
+
+/**
+* Returns the summary of the items with keys in [lo, hi), combined in key order.
+* Below the node where the searches for lo and hi part ways, each step either
+* takes a whole cached subtree or skips one, so the cost is O(log n).
+*/
+template<class Key, class Value, class Monoid, class Compare, class Alloc>
+typename AugmentedAVLTree<Key, Value, Monoid, Compare, Alloc>::summary_type
+AugmentedAVLTree<Key, Value, Monoid, Compare, Alloc>::aggregate(const Key& lo, const Key& hi) const
+{
+    //find the highest node inside the range, where the two bounds split
+    AugNode* split = root();
+    while(split != nullptr) {
+        if(this->comp_(split->getKey(), lo)) {
+            split = split->getRight();
+        }
+        else if(!this->comp_(split->getKey(), hi)) {
+            split = split->getLeft();
+        }
+        else {
+            break;
+        }
+    }
+    if(split == nullptr) {
+        return monoid_.identity();
+    }
+
+    //left of the split: every node >= lo brings its right subtree along, and
+    //each one found lies before everything collected so far
+    summary_type below = monoid_.identity();
+    for(AugNode* cur = split->getLeft(); cur != nullptr; ) {
+        if(this->comp_(cur->getKey(), lo)) {
+            cur = cur->getRight();
+        }
+        else {
+            below = monoid_.combine(monoid_.combine(monoid_.lift(cur->getItem()), summaryOf(cur->getRight())),
+                                    below);
+            cur = cur->getLeft();
+        }
+    }
+
+    //right of the split: the mirror image, for nodes < hi
+    summary_type above = monoid_.identity();
+    for(AugNode* cur = split->getRight(); cur != nullptr; ) {
+        if(this->comp_(cur->getKey(), hi)) {
+            above = monoid_.combine(above,
+                                    monoid_.combine(summaryOf(cur->getLeft()), monoid_.lift(cur->getItem())));
+            cur = cur->getRight();
+        }
+        else {
+            cur = cur->getLeft();
+        }
+    }
+    return monoid_.combine(monoid_.combine(below, monoid_.lift(split->getItem())), above);
+}
+
+template<class Key, class Value, class Monoid, class Compare, class Alloc>
+typename AugmentedAVLTree<Key, Value, Monoid, Compare, Alloc>::AugNode*
+AugmentedAVLTree<Key, Value, Monoid, Compare, Alloc>::root() const
+{
+    return static_cast<AugNode*>(this->root_);
+}
+
+template<class Key, class Value, class Monoid, class Compare, class Alloc>
+typename AugmentedAVLTree<Key, Value, Monoid, Compare, Alloc>::summary_type
+AugmentedAVLTree<Key, Value, Monoid, Compare, Alloc>::summaryOf(const AugNode* node) const
+{
+    return node == nullptr ? monoid_.identity() : node->getSummary();
+}
+
+/**
+* Recomputes the summaries of node and all of its ancestors, bottom up.
+*/
+template<class Key, class Value, class Monoid, class Compare, class Alloc>
+void AugmentedAVLTree<Key, Value, Monoid, Compare, Alloc>::refreshPath(Node<Key, Value>* node)
+{
+    for(; node != nullptr; node = node->getParent()) {
+        pullUp(node);
+    }
+}
+
+template<class Key, class Value, class Monoid, class Compare, class Alloc>
+Node<Key, Value>*
+AugmentedAVLTree<Key, Value, Monoid, Compare, Alloc>::createBuildNode(const std::pair<const Key, Value>& item,
+                                                                      int leftHeight, int rightHeight)
+{
+    AugNode* node = this->template constructNode<AugNode>(augNodeAlloc_, item.first, item.second, nullptr);
+    node->setBalance(static_cast<int8_t>(rightHeight - leftHeight));
+    return node;
+}
+
+template<class Key, class Value, class Monoid, class Compare, class Alloc>
+Node<Key, Value>*
+AugmentedAVLTree<Key, Value, Monoid, Compare, Alloc>::createInsertNode(Node<Key, Value>* parent, Key&& key, Value&& value)
+{
+    return this->template constructNode<AugNode>(augNodeAlloc_, std::piecewise_construct,
+        static_cast<AugNode*>(parent), std::move(key), std::move(value));
+}
+
+/**
+* An overwritten value changes the summary of every subtree holding it.
+*/
+template<class Key, class Value, class Monoid, class Compare, class Alloc>
+void AugmentedAVLTree<Key, Value, Monoid, Compare, Alloc>::valueAssigned(Node<Key, Value>* node)
+{
+    refreshPath(node);
+}
+
+template<class Key, class Value, class Monoid, class Compare, class Alloc>
+void AugmentedAVLTree<Key, Value, Monoid, Compare, Alloc>::destroyNode(Node<Key, Value>* node)
+{
+    AugNode* augNode = static_cast<AugNode*>(node);
+    AugNodeAllocTraits::destroy(augNodeAlloc_, augNode);
+    AugNodeAllocTraits::deallocate(augNodeAlloc_, augNode, 1);
+}
+
+/**
+* Lets AVLTree link and rebalance the new node, then refreshes its ancestors.
+* Rotations while retracing only ever pull up stale summaries on nodes that
+* still lie above the new node, so one pass afterwards fixes them all.
+*/
+template<class Key, class Value, class Monoid, class Compare, class Alloc>
+void AugmentedAVLTree<Key, Value, Monoid, Compare, Alloc>::linkNewNode(Node<Key, Value>* node, Node<Key, Value>* parent, bool asLeft)
+{
+    pullUp(node);
+    AVLTree<Key, Value, Compare, Alloc>::linkNewNode(node, parent, asLeft);
+    refreshPath(node->getParent());
+}
+
+/**
+* Summaries cannot be "subtracted", so they are recomputed after the removal
+* instead. Every node whose summary went stale, including a predecessor
+* swapped into the removed item's place and any node rotated while
+* retracing, is an ancestor of the spot the node was unlinked from.
+*/
+template<class Key, class Value, class Monoid, class Compare, class Alloc>
+void AugmentedAVLTree<Key, Value, Monoid, Compare, Alloc>::unlinkNode(AVLNode<Key, Value>* node)
+{
+    Node<Key, Value>* above = node->getParent();
+    AVLTree<Key, Value, Compare, Alloc>::unlinkNode(node);
+    refreshPath(above);
+}
+
+template<class Key, class Value, class Monoid, class Compare, class Alloc>
+void AugmentedAVLTree<Key, Value, Monoid, Compare, Alloc>::pullUp(Node<Key, Value>* node)
+{
+    AugNode* n = static_cast<AugNode*>(node);
+    n->setSummary(monoid_.combine(monoid_.combine(summaryOf(n->getLeft()), monoid_.lift(n->getItem())),
+                                  summaryOf(n->getRight())));
+}
+
+#endif
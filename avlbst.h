@@ -6,10 +6,22 @@
 #include <cstdlib>
 #include <cstdint>
 #include <algorithm>
+#include <stdexcept>
+#include <typeinfo>
+#include <vector>
 #include "bst.h"
+#include "thread-pool.h"
 
 struct KeyError { };
 
+// By default an AVLNode keeps its balance in the spare low bits of its parent
+// link, so it is no bigger than a plain Node. Define AVL_UNPACKED_BALANCE to get
+// a separate balance_ member instead; 32-bit targets always use the member since
+// their pointers only guarantee two spare bits.
+#if !defined(AVL_UNPACKED_BALANCE) && UINTPTR_MAX > 0xFFFFFFFFu
+#define AVL_PACKED_BALANCE
+#endif
+
 /**
 * A special kind of node for an AVL tree, which adds the balance as a data member, plus
 * other additional helper functions. You do NOT need to implement any functionality or
@@ -21,22 +33,29 @@ class AVLNode : public Node<Key, Value>
 public:
     // Constructor/destructor.
     AVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
-    virtual ~AVLNode();
+    template<typename KeyArg, typename... ValueArgs>
+    AVLNode(std::piecewise_construct_t, AVLNode<Key, Value>* parent, KeyArg&& key, ValueArgs&&... valueArgs);
+    ~AVLNode();
 
     // Getter/setter for the node's height.
     int8_t getBalance () const;
     void setBalance (int8_t balance);
     void updateBalance(int8_t diff);
 
-    // Getters for parent, left, and right. These need to be redefined since they
-    // return pointers to AVLNodes - not plain Nodes. See the Node class in bst.h
-    // for more information.
-    virtual AVLNode<Key, Value>* getParent() const override;
-    virtual AVLNode<Key, Value>* getLeft() const override;
-    virtual AVLNode<Key, Value>* getRight() const override;
+    // Getters for parent, left, and right. These hide the Node versions so that
+    // code holding an AVLNode gets AVLNodes back without a virtual call. See the
+    // Node class in bst.h for more information.
+    AVLNode<Key, Value>* getParent() const;
+    AVLNode<Key, Value>* getLeft() const;
+    AVLNode<Key, Value>* getRight() const;
 
 protected:
+#ifdef AVL_PACKED_BALANCE
+    // The balance (-2..2) is stored biased by 2 in the parent link's tag bits
+    static const int8_t BALANCE_BIAS = 2;
+#else
     int8_t balance_;    // effectively a signed char
+#endif
 };
 
 /*
@@ -50,9 +69,28 @@ protected:
 */
 template<class Key, class Value>
 AVLNode<Key, Value>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Value> *parent) :
-    Node<Key, Value>(key, value, parent), balance_(0)
+    Node<Key, Value>(key, value, parent)
+#ifndef AVL_PACKED_BALANCE
+    , balance_(0)
+#endif
 {
+    setBalance(0);
+}
 
+/**
+* An in-place constructor that forwards the key and value arguments to the base class.
+*/
+template<class Key, class Value>
+template<typename KeyArg, typename... ValueArgs>
+AVLNode<Key, Value>::AVLNode(std::piecewise_construct_t, AVLNode<Key, Value>* parent,
+                             KeyArg&& key, ValueArgs&&... valueArgs) :
+    Node<Key, Value>(std::piecewise_construct, parent,
+                     std::forward<KeyArg>(key), std::forward<ValueArgs>(valueArgs)...)
+#ifndef AVL_PACKED_BALANCE
+    , balance_(0)
+#endif
+{
+    setBalance(0);
 }
 
 /**
@@ -70,7 +108,11 @@ AVLNode<Key, Value>::~AVLNode()
 template<class Key, class Value>
 int8_t AVLNode<Key, Value>::getBalance() const
 {
+#ifdef AVL_PACKED_BALANCE
+    return static_cast<int8_t>(this->getParentTag()) - BALANCE_BIAS;
+#else
     return balance_;
+#endif
 }
 
 /**
@@ -79,7 +121,11 @@ int8_t AVLNode<Key, Value>::getBalance() const
 template<class Key, class Value>
 void AVLNode<Key, Value>::setBalance(int8_t balance)
 {
+#ifdef AVL_PACKED_BALANCE
+    this->setParentTag(static_cast<uintptr_t>(balance + BALANCE_BIAS));
+#else
     balance_ = balance;
+#endif
 }
 
 /**
@@ -88,21 +134,21 @@ void AVLNode<Key, Value>::setBalance(int8_t balance)
 template<class Key, class Value>
 void AVLNode<Key, Value>::updateBalance(int8_t diff)
 {
-    balance_ += diff;
+    setBalance(getBalance() + diff);
 }
 
 /**
-* An overridden function for getting the parent since a static_cast is necessary to make sure
-* that our node is a AVLNode.
+* Redeclared getter for the parent. Every node in an AVLTree is an AVLNode, so the
+* static_cast is always valid.
 */
 template<class Key, class Value>
 AVLNode<Key, Value> *AVLNode<Key, Value>::getParent() const
 {
-    return static_cast<AVLNode<Key, Value>*>(this->parent_);
+    return static_cast<AVLNode<Key, Value>*>(Node<Key, Value>::getParent());
 }
 
 /**
-* Overridden for the same reasons as above.
+* Redeclared for the same reasons as above.
 */
 template<class Key, class Value>
 AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
@@ -111,7 +157,7 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
 }
 
 /**
-* Overridden for the same reasons as above.
+* Redeclared for the same reasons as above.
 */
 template<class Key, class Value>
 AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
@@ -127,14 +173,72 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
 */
 
 
-template <class Key, class Value>
-class AVLTree : public BinarySearchTree<Key, Value>
+template <class Key, class Value,
+          class Compare = std::less<Key>,
+          class Alloc = std::allocator<std::pair<const Key, Value> > >
+class AVLTree : public BinarySearchTree<Key, Value, Compare, Alloc>
 {
 public:
+    AVLTree();
+    explicit AVLTree(const Compare& comp, const Alloc& alloc = Alloc());
+    explicit AVLTree(const Alloc& alloc);
+    template<typename ForwardIt>
+    AVLTree(ForwardIt first, ForwardIt last,
+            const Compare& comp = Compare(), const Alloc& alloc = Alloc());
+    // See BinarySearchTree; copies keep every balance as it was
+    AVLTree(const AVLTree& other);
+    AVLTree(AVLTree&& other);
+    AVLTree& operator=(const AVLTree& other);
+    AVLTree& operator=(AVLTree&& other);
+    void swap(AVLTree& other);
+    virtual ~AVLTree();
     virtual void insert (const std::pair<const Key, Value> &new_item); // TODO
     virtual void remove(const Key& key);  // TODO
+
+    typedef typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator iterator;
+
+    // The hinted insert; see BinarySearchTree
+    using BinarySearchTree<Key, Value, Compare, Alloc>::insert;
+    // Removes the item at pos and returns an iterator to the one after it
+    iterator erase(iterator pos);
+
+    // Split and join. Nodes move between the trees without being copied, so the
+    // other tree must be of the same type and use an equal allocator.
+    void split(const Key& key, AVLTree& greater);
+    void join(AVLTree& greater);
+    void erase(const Key& lo, const Key& hi);
+    void extract_range(const Key& lo, const Key& hi, AVLTree& out);
+
+    // Set operations built on split and join, in O(m log(n/m + 1)) for trees
+    // of sizes m <= n. Given a pool, the two halves of each level run in
+    // parallel. unionWith moves other's nodes in (other's value wins for
+    // shared keys) and leaves other empty; the others only read other.
+    void unionWith(AVLTree& other, ThreadPool* pool = nullptr);
+    void intersectWith(const AVLTree& other, ThreadPool* pool = nullptr);
+    void differenceWith(const AVLTree& other, ThreadPool* pool = nullptr);
+
+    // Inserts an unsorted batch: sorts it (in parallel given a pool), builds it
+    // into a balanced subtree and unions that in. Later duplicates in the batch
+    // and batch items over existing keys win, as with repeated insert().
+    template<typename InputIt>
+    void insertBatch(InputIt first, InputIt last, ThreadPool* pool = nullptr);
 protected:
     virtual void nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2);
+    virtual void nodeSwap(Node<Key, Value>* n1, Node<Key, Value>* n2);
+    void eraseNode(AVLNode<Key, Value>* node);
+    virtual void unlinkNode(AVLNode<Key, Value>* node);
+
+    AVLNode<Key, Value>* createAVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
+    virtual Node<Key, Value>* createBuildNode(const std::pair<const Key, Value>& item,
+                                              int leftHeight, int rightHeight);
+    virtual Node<Key, Value>* createInsertNode(Node<Key, Value>* parent, Key&& key, Value&& value);
+    virtual Node<Key, Value>* cloneNode(const Node<Key, Value>* source);
+    virtual void destroyNode(Node<Key, Value>* node);
+    virtual void linkNewNode(Node<Key, Value>* node, Node<Key, Value>* parent, bool asLeft);
+
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<AVLNode<Key, Value> > AVLNodeAlloc;
+    typedef std::allocator_traits<AVLNodeAlloc> AVLNodeAllocTraits;
+    AVLNodeAlloc avlNodeAlloc_;
 
     // Add helper functions here
     void rotateLeft(AVLNode<Key,Value>* node);
@@ -142,46 +246,224 @@ protected:
     void rebalance(AVLNode<Key,Value>* node);
     void updateBalance(AVLNode<Key,Value>* node);
 
+    // Split/join helpers. They work on detached subtrees whose heights are
+    // passed alongside, and return the root of the subtree they build.
+    static int subtreeHeight(const AVLNode<Key, Value>* node);
+    static int leftHeight(const AVLNode<Key, Value>* node, int height);
+    static int rightHeight(const AVLNode<Key, Value>* node, int height);
+    static void detachChildren(AVLNode<Key, Value>* node);
+    AVLNode<Key, Value>* joinNodes(AVLNode<Key, Value>* left, int lHeight, AVLNode<Key, Value>* mid,
+                                   AVLNode<Key, Value>* right, int rHeight, int& height);
+    AVLNode<Key, Value>* joinNodes(AVLNode<Key, Value>* left, int lHeight,
+                                   AVLNode<Key, Value>* right, int rHeight, int& height);
+    AVLNode<Key, Value>* detachLargest(AVLNode<Key, Value>* node, int height,
+                                       int& restHeight, AVLNode<Key, Value>*& largest);
+    void splitNodes(AVLNode<Key, Value>* node, int height, const Key& key,
+                    AVLNode<Key, Value>*& less, int& lessHeight,
+                    AVLNode<Key, Value>*& notLess, int& notLessHeight);
+    void splitNodes(AVLNode<Key, Value>* node, int height, const Key& key,
+                    AVLNode<Key, Value>*& less, int& lessHeight, AVLNode<Key, Value>*& found,
+                    AVLNode<Key, Value>*& greater, int& greaterHeight);
+    AVLNode<Key, Value>* unionNodes(AVLNode<Key, Value>* mine, int myHeight,
+                                    AVLNode<Key, Value>* theirs, int theirHeight,
+                                    ThreadPool* pool, int& height);
+    AVLNode<Key, Value>* intersectNodes(AVLNode<Key, Value>* mine, int myHeight,
+                                        const AVLNode<Key, Value>* theirs, int theirHeight,
+                                        ThreadPool* pool, int& height);
+    AVLNode<Key, Value>* differenceNodes(AVLNode<Key, Value>* mine, int myHeight,
+                                         const AVLNode<Key, Value>* theirs, int theirHeight,
+                                         ThreadPool* pool, int& height);
+    ThreadPool* forkPool(ThreadPool* pool, int myHeight, int theirHeight) const;
+
+    // Orders batch items by key alone, for sorting with a stable sort
+    struct BatchKeyLess
+    {
+        const Compare* comp;
+        bool operator()(const std::pair<Key, Value>& a, const std::pair<Key, Value>& b) const
+        {
+            return (*comp)(a.first, b.first);
+        }
+    };
+    bool retraceGrowth(AVLNode<Key, Value>* node);
+    AVLNode<Key, Value>* refreshToRoot(AVLNode<Key, Value>* node);
+    AVLNode<Key, Value>* detachRoot();
+    void adopt(AVLNode<Key, Value>* root);
+    void checkCompatible(const AVLTree& other) const;
+
 };
 
+template<class Key, class Value, class Compare, class Alloc>
+AVLTree<Key, Value, Compare, Alloc>::AVLTree() :
+    BinarySearchTree<Key, Value, Compare, Alloc>(), avlNodeAlloc_(this->nodeAlloc_)
+{
+
+}
+
+/**
+* Constructs an empty tree ordered by comp.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+AVLTree<Key, Value, Compare, Alloc>::AVLTree(const Compare& comp, const Alloc& alloc) :
+    BinarySearchTree<Key, Value, Compare, Alloc>(comp, alloc), avlNodeAlloc_(this->nodeAlloc_)
+{
+
+}
+
+/**
+* Constructs an empty tree whose AVLNodes come from the given allocator.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+AVLTree<Key, Value, Compare, Alloc>::AVLTree(const Alloc& alloc) :
+    BinarySearchTree<Key, Value, Compare, Alloc>(alloc), avlNodeAlloc_(this->nodeAlloc_)
+{
+
+}
+
+/**
+* Builds a balanced AVL tree from a range sorted by key in O(n).
+* See BinarySearchTree::assign().
+*/
+template<class Key, class Value, class Compare, class Alloc>
+template<typename ForwardIt>
+AVLTree<Key, Value, Compare, Alloc>::AVLTree(ForwardIt first, ForwardIt last,
+                                             const Compare& comp, const Alloc& alloc) :
+    BinarySearchTree<Key, Value, Compare, Alloc>(comp, alloc), avlNodeAlloc_(this->nodeAlloc_)
+{
+    this->assign(first, last);
+}
+
+/**
+* The base copy constructor would clone plain Nodes, so the copy is made
+* here, where cloneNode() resolves to this class. The derived trees copy in
+* their own constructors for the same reason.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+AVLTree<Key, Value, Compare, Alloc>::AVLTree(const AVLTree& other) :
+    BinarySearchTree<Key, Value, Compare, Alloc>(other.key_comp(), other.copyAllocator()),
+    avlNodeAlloc_(this->nodeAlloc_)
+{
+    this->cloneFrom(other);
+}
+
+/**
+* Moving touches no nodes, so the base constructor does it; other's AVLNode
+* allocator is then reset to match its fresh base one.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+AVLTree<Key, Value, Compare, Alloc>::AVLTree(AVLTree&& other) :
+    BinarySearchTree<Key, Value, Compare, Alloc>(std::move(other)),
+    avlNodeAlloc_(this->nodeAlloc_)
+{
+    other.avlNodeAlloc_ = AVLNodeAlloc(other.nodeAlloc_);
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+AVLTree<Key, Value, Compare, Alloc>&
+AVLTree<Key, Value, Compare, Alloc>::operator=(const AVLTree& other)
+{
+    if(this != &other) {
+        AVLTree copy(other);
+        swap(copy);
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+AVLTree<Key, Value, Compare, Alloc>&
+AVLTree<Key, Value, Compare, Alloc>::operator=(AVLTree&& other)
+{
+    if(this != &other) {
+        AVLTree moved(std::move(other));
+        swap(moved);
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::swap(AVLTree& other)
+{
+    BinarySearchTree<Key, Value, Compare, Alloc>::swap(other);
+    std::swap(avlNodeAlloc_, other.avlNodeAlloc_);
+}
+
+/**
+* The base destructor cannot reach destroyNode() for AVLNodes, so the
+* nodes are released here while the tree is still an AVLTree.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+AVLTree<Key, Value, Compare, Alloc>::~AVLTree()
+{
+    this->clear();
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+AVLNode<Key, Value>*
+AVLTree<Key, Value, Compare, Alloc>::createAVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent)
+{
+    return this->template constructNode<AVLNode<Key, Value> >(avlNodeAlloc_, key, value, parent);
+}
+
+/**
+* Bulk-built nodes are AVLNodes whose balance is known from their subtree heights.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+Node<Key, Value>*
+AVLTree<Key, Value, Compare, Alloc>::createBuildNode(const std::pair<const Key, Value>& item,
+                                            int leftHeight, int rightHeight)
+{
+    AVLNode<Key, Value>* node = createAVLNode(item.first, item.second, nullptr);
+    node->setBalance(static_cast<int8_t>(rightHeight - leftHeight));
+    return node;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+Node<Key, Value>*
+AVLTree<Key, Value, Compare, Alloc>::createInsertNode(Node<Key, Value>* parent, Key&& key, Value&& value)
+{
+    return this->template constructNode<AVLNode<Key, Value> >(avlNodeAlloc_, std::piecewise_construct,
+        static_cast<AVLNode<Key, Value>*>(parent), std::move(key), std::move(value));
+}
+
+/**
+* Copies source's balance along with its item. createBuildNode() takes the
+* balance as a difference of heights and makes the derived trees' nodes.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+Node<Key, Value>*
+AVLTree<Key, Value, Compare, Alloc>::cloneNode(const Node<Key, Value>* source)
+{
+    const AVLNode<Key, Value>* avlSource = static_cast<const AVLNode<Key, Value>*>(source);
+    return this->createBuildNode(avlSource->getItem(), 0, avlSource->getBalance());
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::destroyNode(Node<Key, Value>* node)
+{
+    AVLNode<Key, Value>* avlNode = static_cast<AVLNode<Key, Value>*>(node);
+    AVLNodeAllocTraits::destroy(avlNodeAlloc_, avlNode);
+    AVLNodeAllocTraits::deallocate(avlNodeAlloc_, avlNode, 1);
+}
+
 /*
  * Recall: If key is already in the tree, you should 
  * overwrite the current value with the updated value.
  */
-template<class Key, class Value>
-void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::insert (const std::pair<const Key, Value> &new_item)
 {
-    // TODO
-    AVLNode<Key,Value>* newNode= new AVLNode<Key,Value>(new_item.first, new_item.second, nullptr);
-    if(this->root_ == nullptr){
-        this->root_= newNode;
-        return;
-    }
-    AVLNode<Key,Value>* parent = nullptr;
-    AVLNode<Key,Value>* cur= static_cast<AVLNode<Key,Value>*>(this->root_);
+    this->insert_or_assign(new_item.first, new_item.second);
+}
 
-    while(cur != nullptr){
-        parent = cur;
-        if(new_item.first < cur->getKey()){
-            cur = cur->getLeft();
-        }
-        else if(new_item.first > cur->getKey()){
-            cur = cur -> getRight();
-        }
-        else{
-            cur->setValue(new_item.second);
-            delete newNode;
-            return;
-        }
-    }
-    newNode->setParent(parent);
-    if(new_item.first < parent->getKey()){
-        parent->setLeft(newNode);
-    }
-    else{
-        parent->setRight(newNode);
-    }
-    AVLNode<Key, Value>* n= newNode;
+/**
+* Attaches the new node, then walks back up adjusting balances until a subtree's
+* height stops changing or a single rebalance restores it.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::linkNewNode(Node<Key, Value>* node, Node<Key, Value>* parentNode, bool asLeft)
+{
+    BinarySearchTree<Key, Value, Compare, Alloc>::linkNewNode(node, parentNode, asLeft);
+    AVLNode<Key, Value>* n = static_cast<AVLNode<Key, Value>*>(node);
+    AVLNode<Key, Value>* parent = static_cast<AVLNode<Key, Value>*>(parentNode);
     while(parent != nullptr){
         if(n == parent->getLeft()){
             parent->updateBalance(-1);
@@ -205,48 +487,133 @@ void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
  * Recall: The writeup specifies that if a node has 2 children you
  * should swap with the predecessor and then remove.
  */
-template<class Key, class Value>
-void AVLTree<Key, Value>:: remove(const Key& key)
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>:: remove(const Key& key)
 {
     // TODO
     AVLNode<Key,Value>* node = static_cast<AVLNode<Key,Value>*>(this->internalFind(key));
     if(node == nullptr){
         return;
     }
-    
+    eraseNode(node);
+}
 
-    AVLNode<Key,Value>* parent = node->getParent();
-    BinarySearchTree<Key,Value>::remove(key);
-    while(parent != nullptr){
-        if(key < parent->getKey()){
-            parent->updateBalance(1);
-        }
-        else{
-            parent->updateBalance(-1);
+/**
+* Removes the item at pos, which must be a valid, dereferenceable iterator,
+* and returns an iterator to the next item. Finding the next item takes
+* amortized O(1) (O(1) with BST_THREADED), so erasing while iterating costs
+* no searches, only the rebalancing.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename AVLTree<Key, Value, Compare, Alloc>::iterator
+AVLTree<Key, Value, Compare, Alloc>::erase(iterator pos)
+{
+    AVLNode<Key, Value>* node = static_cast<AVLNode<Key, Value>*>(this->iteratorNode(pos));
+    //nodes move rather than their items, so the successor stays where it is
+    Node<Key, Value>* next = this->successor(node);
+    eraseNode(node);
+    return this->makeIterator(next);
+}
+
+/**
+* Moves a node with two children to its predecessor's place, where it has at
+* most one child, and unlinks it from there.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::eraseNode(AVLNode<Key, Value>* node)
+{
+    if(node->getLeft() != nullptr && node->getRight() != nullptr){
+        AVLNode<Key, Value>* pred = node->getLeft();
+        while(pred->getRight() != nullptr){
+            pred = pred->getRight();
         }
-        if(std::abs(parent->getBalance())==2){
-            rebalance(parent);
+        nodeSwap(node, pred);
+    }
+    unlinkNode(node);
+}
+
+/**
+* Unlinks and destroys a node with at most one child, then retraces. The
+* side the node hung from is known at each step, so no keys are compared:
+* a subtree that shrank tips its parent the other way, and the walk stops
+* at the first parent whose height did not change.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::unlinkNode(AVLNode<Key, Value>* node)
+{
+    if(node == this->rightmost_){
+        this->rightmost_ = this->predecessor(node);
+    }
+    AVLNode<Key, Value>* child = node->getLeft() != nullptr ? node->getLeft() : node->getRight();
+    AVLNode<Key, Value>* parent = node->getParent();
+    bool fromLeft = parent != nullptr && parent->getLeft() == node;
+    if(child != nullptr){
+        child->setParent(parent);
+    }
+    if(parent == nullptr){
+        this->root_ = child;
+    }
+    else if(fromLeft){
+        parent->setLeft(child);
+    }
+    else{
+        parent->setRight(child);
+    }
+#ifdef BST_THREADED
+    this->threadLink(node->getPrev(), node->getNext());
+#endif
+    destroyNode(node);
 
+    while(parent != nullptr){
+        parent->updateBalance(fromLeft ? 1 : -1);
+        AVLNode<Key, Value>* top = parent;
+        if(std::abs(parent->getBalance()) == 2){
+            rebalance(parent);
+            top = parent->getParent();
         }
-        if(parent->getBalance() != 0){
+        //a nonzero balance means the subtree kept its height
+        if(top->getBalance() != 0){
             break;
         }
-
-        parent = parent ->getParent();
+        parent = top->getParent();
+        fromLeft = parent != nullptr && parent->getLeft() == top;
     }
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
+/**
+* Kept for the AVLNode signature; forwards to the Node version below.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
 {
-    BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
-    int8_t tempB = n1->getBalance();
-    n1->setBalance(n2->getBalance());
-    n2->setBalance(tempB);
+    nodeSwap(static_cast<Node<Key, Value>*>(n1), static_cast<Node<Key, Value>*>(n2));
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::rotateLeft(AVLNode<Key,Value>* node){
+/**
+* Balances describe positions in the tree, so they trade places along with
+* the nodes. This overrides the base version so that every swap, including
+* the ones derived trees make, carries the balances along.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::nodeSwap(Node<Key, Value>* n1, Node<Key, Value>* n2)
+{
+    BinarySearchTree<Key, Value, Compare, Alloc>::nodeSwap(n1, n2);
+    if(n1 == nullptr || n2 == nullptr){
+        return;
+    }
+    AVLNode<Key, Value>* a1 = static_cast<AVLNode<Key, Value>*>(n1);
+    AVLNode<Key, Value>* a2 = static_cast<AVLNode<Key, Value>*>(n2);
+    int8_t tempB = a1->getBalance();
+    a1->setBalance(a2->getBalance());
+    a2->setBalance(tempB);
+}
+
+/**
+* Rotates node's right child up into node's place. Only the links change;
+* rebalance() is responsible for the balances.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::rotateLeft(AVLNode<Key,Value>* node){
     AVLNode<Key, Value>* rightChild = node->getRight();
     AVLNode<Key,Value>* grandChild= rightChild->getLeft();
 
@@ -256,7 +623,10 @@ void AVLTree<Key, Value>::rotateLeft(AVLNode<Key,Value>* node){
     }
     rightChild->setParent(node->getParent());
     if(node->getParent() == nullptr){
-        this->root_ = rightChild;
+        //a detached subtree's root (see detachRoot) is not the tree's root
+        if(this->root_ == node){
+            this->root_ = rightChild;
+        }
     }
     else if(node == node->getParent()->getLeft()){
         node->getParent()->setLeft(rightChild);
@@ -267,36 +637,15 @@ void AVLTree<Key, Value>::rotateLeft(AVLNode<Key,Value>* node){
 
     rightChild->setLeft(node);
     node->setParent(rightChild);
-
-    if(rightChild->getBalance()==1){
-        node->setBalance(0);
-        rightChild->setBalance(0);
-    }
-    else if(rightChild->getBalance()==0){
-        node->setBalance(1);
-        rightChild->setBalance(-1);
-    }
-    else{
-        if(grandChild != nullptr){
-            if(grandChild->getBalance() ==1){
-                node->setBalance(0);
-                rightChild->setBalance(-1);
-            }
-            else if(grandChild->getBalance() == -1){
-                node->setBalance(1);
-                rightChild->setBalance(0);
-            }
-            else{
-                node->setBalance(0);
-                rightChild->setBalance(0);
-            }
-            grandChild->setBalance(0);
-        }
-    }
+    this->pullUp(node);
+    this->pullUp(rightChild);
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::rotateRight(AVLNode<Key,Value>* node){
+/**
+* Mirror image of rotateLeft().
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::rotateRight(AVLNode<Key,Value>* node){
     AVLNode<Key,Value>* leftChild = node->getLeft();
     AVLNode<Key,Value>* grandChild = leftChild->getRight();
 
@@ -306,9 +655,11 @@ void AVLTree<Key, Value>::rotateRight(AVLNode<Key,Value>* node){
     }
 
     leftChild->setParent(node->getParent());
-    if(node->getParent()==nullptr){
-        this->root_ = leftChild;
-
+    if(node->getParent() == nullptr){
+        //a detached subtree's root (see detachRoot) is not the tree's root
+        if(this->root_ == node){
+            this->root_ = leftChild;
+        }
     }
     else if(node==node->getParent()->getLeft()){
         node->getParent()->setLeft(leftChild);
@@ -319,58 +670,712 @@ void AVLTree<Key, Value>::rotateRight(AVLNode<Key,Value>* node){
 
     leftChild->setRight(node);
     node->setParent(leftChild);
-
-    if(leftChild->getBalance()==-1){
-        node->setBalance(0);
-        leftChild->setBalance(0);
-    }
-    else if(leftChild->getBalance()==0){
-        node->setBalance(-1);
-        leftChild->setBalance(1);
-    }
-    else{
-        if(grandChild!=nullptr){
-            if(grandChild->getBalance()==-1){
-                node->setBalance(0);
-                leftChild->setBalance(1);
-            }
-            else if(grandChild ->getBalance()==1){
-                node->setBalance(-1);
-                leftChild->setBalance(0);
-            }
-            else{
-                node->setBalance(0);
-                leftChild->setBalance(0);
-            }
-            grandChild->setBalance(0);
-        }
-    }
-
+    this->pullUp(node);
+    this->pullUp(leftChild);
 }
-template<class Key, class Value>
-void AVLTree<Key, Value>::rebalance(AVLNode<Key, Value>* node){
+
+/**
+* Restores a node whose balance is +/-2 with a single or double rotation and
+* sets the balances of the nodes involved.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::rebalance(AVLNode<Key, Value>* node){
     if(node->getBalance() == -2){
         //left heavy
-        if(node->getLeft()->getBalance() <= 0){
+        AVLNode<Key, Value>* child = node->getLeft();
+        if(child->getBalance() <= 0){
+            //a zero child balance only happens on removal; the height is then unchanged
+            int8_t childBalance = child->getBalance();
             rotateRight(node);
+            node->setBalance(childBalance == 0 ? -1 : 0);
+            child->setBalance(childBalance == 0 ? 1 : 0);
         }
         else{
-            rotateLeft(node->getLeft());
+            AVLNode<Key, Value>* grandChild = child->getRight();
+            int8_t grandBalance = grandChild->getBalance();
+            rotateLeft(child);
             rotateRight(node);
+            node->setBalance(grandBalance == -1 ? 1 : 0);
+            child->setBalance(grandBalance == 1 ? -1 : 0);
+            grandChild->setBalance(0);
         }
     }
     else if(node->getBalance()==2){
-        if(node->getRight()->getBalance() >=0){
+        //right heavy
+        AVLNode<Key, Value>* child = node->getRight();
+        if(child->getBalance() >= 0){
+            int8_t childBalance = child->getBalance();
             rotateLeft(node);
+            node->setBalance(childBalance == 0 ? 1 : 0);
+            child->setBalance(childBalance == 0 ? -1 : 0);
         }
         else{
-            rotateRight(node->getRight());
+            AVLNode<Key, Value>* grandChild = child->getLeft();
+            int8_t grandBalance = grandChild->getBalance();
+            rotateRight(child);
             rotateLeft(node);
+            node->setBalance(grandBalance == 1 ? -1 : 0);
+            child->setBalance(grandBalance == -1 ? 1 : 0);
+            grandChild->setBalance(0);
         }
     }
 }
-template<class Key, class Value>
-void AVLTree<Key, Value>::updateBalance(AVLNode<Key, Value>* node){
+/**
+* Moves every item with a key not less than key into greater, replacing what
+* greater held; this tree keeps the smaller keys. O(log n).
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::split(const Key& key, AVLTree& greater)
+{
+    checkCompatible(greater);
+    greater.clear();
+    AVLNode<Key, Value>* node = detachRoot();
+    AVLNode<Key, Value>* less;
+    AVLNode<Key, Value>* notLess;
+    int lessHeight, notLessHeight;
+    splitNodes(node, subtreeHeight(node), key, less, lessHeight, notLess, notLessHeight);
+    adopt(less);
+    greater.adopt(notLess);
+}
+
+/**
+* Appends every item of greater, whose keys must all be greater than this
+* tree's, and leaves greater empty. O(log n).
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::join(AVLTree& greater)
+{
+    checkCompatible(greater);
+    if(greater.empty()) {
+        return;
+    }
+    if(!this->empty() &&
+       !this->comp_(this->rightmost_->getKey(), greater.getSmallestNode()->getKey())) {
+        throw std::invalid_argument("join: keys must be greater than every key in the tree");
+    }
+    AVLNode<Key, Value>* right = greater.detachRoot();
+    greater.adopt(nullptr);
+    AVLNode<Key, Value>* left = detachRoot();
+    int height;
+    this->threadJoin(left, nullptr, right);
+    adopt(joinNodes(left, subtreeHeight(left), right, subtreeHeight(right), height));
+}
+
+/**
+* Removes every item with a key in [lo, hi) by splitting the range out and
+* joining what is left, in O(log n + k) for k removed items.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::erase(const Key& lo, const Key& hi)
+{
+    if(!this->comp_(lo, hi)) {
+        return;
+    }
+    AVLNode<Key, Value>* node = detachRoot();
+    AVLNode<Key, Value>* below;
+    AVLNode<Key, Value>* rest;
+    AVLNode<Key, Value>* range;
+    AVLNode<Key, Value>* above;
+    int belowHeight, restHeight, rangeHeight, aboveHeight, height;
+    splitNodes(node, subtreeHeight(node), lo, below, belowHeight, rest, restHeight);
+    splitNodes(rest, restHeight, hi, range, rangeHeight, above, aboveHeight);
+    this->threadJoin(below, nullptr, above);
+    adopt(joinNodes(below, belowHeight, above, aboveHeight, height));
+    this->clearHelper(range);
+}
+
+/**
+* Moves the items with keys in [lo, hi) into out, replacing what out held.
+* No node is copied, so this is O(log n) however large the range.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::extract_range(const Key& lo, const Key& hi, AVLTree& out)
+{
+    checkCompatible(out);
+    out.clear();
+    if(!this->comp_(lo, hi)) {
+        return;
+    }
+    AVLNode<Key, Value>* node = detachRoot();
+    AVLNode<Key, Value>* below;
+    AVLNode<Key, Value>* rest;
+    AVLNode<Key, Value>* range;
+    AVLNode<Key, Value>* above;
+    int belowHeight, restHeight, rangeHeight, aboveHeight, height;
+    splitNodes(node, subtreeHeight(node), lo, below, belowHeight, rest, restHeight);
+    splitNodes(rest, restHeight, hi, range, rangeHeight, above, aboveHeight);
+    this->threadJoin(below, nullptr, above);
+    adopt(joinNodes(below, belowHeight, above, aboveHeight, height));
+    out.adopt(range);
+}
+
+/**
+* The height of a subtree, found by following the taller side down.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+int AVLTree<Key, Value, Compare, Alloc>::subtreeHeight(const AVLNode<Key, Value>* node)
+{
+    int height = 0;
+    while(node != nullptr){
+        ++height;
+        node = node->getBalance() < 0 ? node->getLeft() : node->getRight();
+    }
+    return height;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+int AVLTree<Key, Value, Compare, Alloc>::leftHeight(const AVLNode<Key, Value>* node, int height)
+{
+    return node->getBalance() > 0 ? height - 2 : height - 1;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+int AVLTree<Key, Value, Compare, Alloc>::rightHeight(const AVLNode<Key, Value>* node, int height)
+{
+    return node->getBalance() < 0 ? height - 2 : height - 1;
+}
+
+/**
+* Cuts node off from its children, leaving all three as separate subtrees.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::detachChildren(AVLNode<Key, Value>* node)
+{
+    if(node->getLeft() != nullptr){
+        node->getLeft()->setParent(nullptr);
+    }
+    if(node->getRight() != nullptr){
+        node->getRight()->setParent(nullptr);
+    }
+    node->setLeft(nullptr);
+    node->setRight(nullptr);
+}
+
+/**
+* Joins left < mid < right into one AVL subtree. The shorter side is hung off
+* the taller one's spine at the first node no more than one level taller than
+* it, and the growth is retraced like an insertion, so the cost is
+* O(|lHeight - rHeight| + 1).
+* The in-order threads are not touched. Within splitNodes and detachLargest
+* the pieces being joined were neighbours before they were cut apart, so their
+* threads are still right; callers joining pieces from anywhere else call
+* threadJoin first.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+AVLNode<Key, Value>*
+AVLTree<Key, Value, Compare, Alloc>::joinNodes(AVLNode<Key, Value>* left, int lHeight, AVLNode<Key, Value>* mid,
+                                              AVLNode<Key, Value>* right, int rHeight, int& height)
+{
+    mid->setParent(nullptr);
+    if(lHeight > rHeight + 1){
+        //walk down the right spine of left
+        AVLNode<Key, Value>* parent = nullptr;
+        AVLNode<Key, Value>* cur = left;
+        int curHeight = lHeight;
+        while(curHeight > rHeight + 1){
+            curHeight = rightHeight(cur, curHeight);
+            parent = cur;
+            cur = cur->getRight();
+        }
+        mid->setLeft(cur);
+        if(cur != nullptr){
+            cur->setParent(mid);
+        }
+        mid->setRight(right);
+        if(right != nullptr){
+            right->setParent(mid);
+        }
+        mid->setBalance(static_cast<int8_t>(rHeight - curHeight));
+        parent->setRight(mid);
+        mid->setParent(parent);
+        height = retraceGrowth(mid) ? lHeight + 1 : lHeight;
+        return refreshToRoot(mid);
+    }
+    if(rHeight > lHeight + 1){
+        //mirror image: walk down the left spine of right
+        AVLNode<Key, Value>* parent = nullptr;
+        AVLNode<Key, Value>* cur = right;
+        int curHeight = rHeight;
+        while(curHeight > lHeight + 1){
+            curHeight = leftHeight(cur, curHeight);
+            parent = cur;
+            cur = cur->getLeft();
+        }
+        mid->setRight(cur);
+        if(cur != nullptr){
+            cur->setParent(mid);
+        }
+        mid->setLeft(left);
+        if(left != nullptr){
+            left->setParent(mid);
+        }
+        mid->setBalance(static_cast<int8_t>(curHeight - lHeight));
+        parent->setLeft(mid);
+        mid->setParent(parent);
+        height = retraceGrowth(mid) ? rHeight + 1 : rHeight;
+        return refreshToRoot(mid);
+    }
+    //close enough in height to sit side by side under mid
+    mid->setLeft(left);
+    if(left != nullptr){
+        left->setParent(mid);
+    }
+    mid->setRight(right);
+    if(right != nullptr){
+        right->setParent(mid);
+    }
+    mid->setBalance(static_cast<int8_t>(rHeight - lHeight));
+    this->pullUp(mid);
+    height = std::max(lHeight, rHeight) + 1;
+    return mid;
+}
+
+/**
+* Joins left < right with no node in between by borrowing left's largest node.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+AVLNode<Key, Value>*
+AVLTree<Key, Value, Compare, Alloc>::joinNodes(AVLNode<Key, Value>* left, int lHeight,
+                                              AVLNode<Key, Value>* right, int rHeight, int& height)
+{
+    if(left == nullptr){
+        height = rHeight;
+        return right;
+    }
+    if(right == nullptr){
+        height = lHeight;
+        return left;
+    }
+    AVLNode<Key, Value>* largest;
+    int restHeight;
+    AVLNode<Key, Value>* rest = detachLargest(left, lHeight, restHeight, largest);
+    return joinNodes(rest, restHeight, largest, right, rHeight, height);
+}
+
+/**
+* Takes the largest node out of a detached subtree and returns the rest,
+* rejoined on the way back up the right spine.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+AVLNode<Key, Value>*
+AVLTree<Key, Value, Compare, Alloc>::detachLargest(AVLNode<Key, Value>* node, int height,
+                                                  int& restHeight, AVLNode<Key, Value>*& largest)
+{
+    AVLNode<Key, Value>* left = node->getLeft();
+    AVLNode<Key, Value>* right = node->getRight();
+    int lHeight = leftHeight(node, height);
+    int rHeight = rightHeight(node, height);
+    detachChildren(node);
+    if(right == nullptr){
+        largest = node;
+        restHeight = lHeight;
+        return left;
+    }
+    int rest;
+    AVLNode<Key, Value>* remaining = detachLargest(right, rHeight, rest, largest);
+    return joinNodes(left, lHeight, node, remaining, rest, restHeight);
+}
+
+/**
+* Splits a detached subtree into the keys less than key and the rest.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::splitNodes(AVLNode<Key, Value>* node, int height, const Key& key,
+                                                    AVLNode<Key, Value>*& less, int& lessHeight,
+                                                    AVLNode<Key, Value>*& notLess, int& notLessHeight)
+{
+    AVLNode<Key, Value>* found;
+    AVLNode<Key, Value>* greater;
+    int greaterHeight;
+    splitNodes(node, height, key, less, lessHeight, found, greater, greaterHeight);
+    if(found != nullptr){
+        notLess = joinNodes(nullptr, 0, found, greater, greaterHeight, notLessHeight);
+    }
+    else{
+        notLess = greater;
+        notLessHeight = greaterHeight;
+    }
+}
+
+/**
+* Splits a detached subtree into the keys less than key, the node holding key
+* (detached, or NULL) and the keys greater than key. Each level joins the
+* piece split off below with the untouched sibling subtree, and those join
+* costs telescope to O(log n) overall.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::splitNodes(AVLNode<Key, Value>* node, int height, const Key& key,
+                                                    AVLNode<Key, Value>*& less, int& lessHeight,
+                                                    AVLNode<Key, Value>*& found,
+                                                    AVLNode<Key, Value>*& greater, int& greaterHeight)
+{
+    if(node == nullptr){
+        less = found = greater = nullptr;
+        lessHeight = greaterHeight = 0;
+        return;
+    }
+    AVLNode<Key, Value>* left = node->getLeft();
+    AVLNode<Key, Value>* right = node->getRight();
+    int lHeight = leftHeight(node, height);
+    int rHeight = rightHeight(node, height);
+    detachChildren(node);
+    AVLNode<Key, Value>* lower;
+    AVLNode<Key, Value>* upper;
+    int lowerHeight, upperHeight;
+    if(this->comp_(node->getKey(), key)){
+        splitNodes(right, rHeight, key, lower, lowerHeight, found, upper, upperHeight);
+        less = joinNodes(left, lHeight, node, lower, lowerHeight, lessHeight);
+        greater = upper;
+        greaterHeight = upperHeight;
+    }
+    else if(this->comp_(key, node->getKey())){
+        splitNodes(left, lHeight, key, lower, lowerHeight, found, upper, upperHeight);
+        less = lower;
+        lessHeight = lowerHeight;
+        greater = joinNodes(upper, upperHeight, node, right, rHeight, greaterHeight);
+    }
+    else{
+        less = left;
+        lessHeight = lHeight;
+        found = node;
+        greater = right;
+        greaterHeight = rHeight;
+    }
+}
+
+/**
+* node's subtree has just grown one level taller. Walks up adjusting balances
+* like an insertion, except that a rotation around a child with balance 0
+* leaves the height grown and the walk goes on. Returns whether the growth
+* reached the top.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+bool AVLTree<Key, Value, Compare, Alloc>::retraceGrowth(AVLNode<Key, Value>* node)
+{
+    AVLNode<Key, Value>* parent = node->getParent();
+    while(parent != nullptr){
+        parent->updateBalance(node == parent->getLeft() ? -1 : 1);
+        int8_t balance = parent->getBalance();
+        if(balance == 0){
+            return false;
+        }
+        if(balance == 2 || balance == -2){
+            AVLNode<Key, Value>* heavy = balance < 0 ? parent->getLeft() : parent->getRight();
+            bool stillGrown = heavy->getBalance() == 0;
+            rebalance(parent);
+            if(!stillGrown){
+                return false;
+            }
+            //parent was rotated down, its old position is now held by its parent
+            node = parent->getParent();
+        }
+        else{
+            node = parent;
+        }
+        parent = node->getParent();
+    }
+    return true;
+}
+
+/**
+* Pulls up node and every ancestor, returning the topmost one.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+AVLNode<Key, Value>* AVLTree<Key, Value, Compare, Alloc>::refreshToRoot(AVLNode<Key, Value>* node)
+{
+    AVLNode<Key, Value>* top = node;
+    for(; node != nullptr; node = node->getParent()){
+        this->pullUp(node);
+        top = node;
+    }
+    return top;
+}
+
+/**
+* Empties the tree without freeing anything and returns the old root, which
+* adopt() replaces once the detached subtrees have been reassembled. With
+* root_ NULL meanwhile, rotations never write it, so disjoint subtrees can be
+* worked on from several threads.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+AVLNode<Key, Value>* AVLTree<Key, Value, Compare, Alloc>::detachRoot()
+{
+    AVLNode<Key, Value>* root = static_cast<AVLNode<Key, Value>*>(this->root_);
+    this->root_ = nullptr;
+    this->rightmost_ = nullptr;
+    return root;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::adopt(AVLNode<Key, Value>* root)
+{
+    this->root_ = root;
+    this->rightmost_ = this->getLargestNode();
+    this->threadEnds();
+}
+
+/**
+* Nodes may only move to a distinct tree of the same type that can free them.
+* Trees on an arena allocator are excluded: equal arena allocators share one
+* arena, and clear() on either tree would release the other's nodes too.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::checkCompatible(const AVLTree& other) const
+{
+    if(&other == this || typeid(*this) != typeid(other) ||
+       is_arena_allocator<AVLNodeAlloc>::value || !(avlNodeAlloc_ == other.avlNodeAlloc_)) {
+        throw std::invalid_argument("split/join: trees cannot exchange nodes");
+    }
+}
+
+/**
+* Adds every item of other to this tree, moving other's nodes rather than
+* copying them. other is left empty.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::unionWith(AVLTree& other, ThreadPool* pool)
+{
+    checkCompatible(other);
+    AVLNode<Key, Value>* theirs = other.detachRoot();
+    AVLNode<Key, Value>* mine = detachRoot();
+    int height;
+    adopt(unionNodes(mine, subtreeHeight(mine), theirs, subtreeHeight(theirs), pool, height));
+}
+
+/**
+* Keeps only the items whose keys are also in other.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::intersectWith(const AVLTree& other, ThreadPool* pool)
+{
+    if(&other == this) {
+        return;
+    }
+    const AVLNode<Key, Value>* theirs = static_cast<const AVLNode<Key, Value>*>(other.root_);
+    AVLNode<Key, Value>* mine = detachRoot();
+    int height;
+    adopt(intersectNodes(mine, subtreeHeight(mine), theirs, subtreeHeight(theirs), pool, height));
+}
+
+/**
+* Removes every item whose key is in other.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::differenceWith(const AVLTree& other, ThreadPool* pool)
+{
+    if(&other == this) {
+        this->clear();
+        return;
+    }
+    const AVLNode<Key, Value>* theirs = static_cast<const AVLNode<Key, Value>*>(other.root_);
+    AVLNode<Key, Value>* mine = detachRoot();
+    int height;
+    adopt(differenceNodes(mine, subtreeHeight(mine), theirs, subtreeHeight(theirs), pool, height));
+}
+
+/**
+* The batch is sorted stably by key and each run of equal keys collapsed to
+* its last item, so the result matches inserting the items one by one.
+* Building the batch takes O(k) after the sort, and the union O(k log(n/k + 1)).
+*/
+template<class Key, class Value, class Compare, class Alloc>
+template<typename InputIt>
+void AVLTree<Key, Value, Compare, Alloc>::insertBatch(InputIt first, InputIt last, ThreadPool* pool)
+{
+    std::vector<std::pair<Key, Value> > items(first, last);
+    if(items.empty()) {
+        return;
+    }
+    BatchKeyLess less = { &this->comp_ };
+    parallelStableSort(items.begin(), items.end(), less, pool);
+    std::size_t kept = 0;
+    for(std::size_t i = 0; i < items.size(); ++i) {
+        if(i + 1 < items.size() && !less(items[i], items[i + 1])) {
+            continue;
+        }
+        if(kept != i) {
+            items[kept] = std::move(items[i]);
+        }
+        ++kept;
+    }
+    items.erase(items.begin() + kept, items.end());
+
+    int batchHeight, height;
+    typename std::vector<std::pair<Key, Value> >::iterator it = items.begin();
+    AVLNode<Key, Value>* batch = static_cast<AVLNode<Key, Value>*>(this->buildSubtree(it, kept, batchHeight));
+    AVLNode<Key, Value>* mine = detachRoot();
+    adopt(unionNodes(mine, subtreeHeight(mine), batch, batchHeight, pool, height));
+}
+
+/**
+* Splits mine around the root of theirs, unions the two sides separately and
+* joins them back with that root in the middle.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+AVLNode<Key, Value>*
+AVLTree<Key, Value, Compare, Alloc>::unionNodes(AVLNode<Key, Value>* mine, int myHeight,
+                                               AVLNode<Key, Value>* theirs, int theirHeight,
+                                               ThreadPool* pool, int& height)
+{
+    if(mine == nullptr){
+        height = theirHeight;
+        return theirs;
+    }
+    if(theirs == nullptr){
+        height = myHeight;
+        return mine;
+    }
+    AVLNode<Key, Value>* theirLeft = theirs->getLeft();
+    AVLNode<Key, Value>* theirRight = theirs->getRight();
+    int theirLeftHeight = leftHeight(theirs, theirHeight);
+    int theirRightHeight = rightHeight(theirs, theirHeight);
+    detachChildren(theirs);
+    AVLNode<Key, Value>* less;
+    AVLNode<Key, Value>* found;
+    AVLNode<Key, Value>* greater;
+    int lessHeight, greaterHeight;
+    splitNodes(mine, myHeight, theirs->getKey(), less, lessHeight, found, greater, greaterHeight);
+    if(found != nullptr){
+        //theirs holds the same key and takes its place
+        this->destroyNode(found);
+    }
+
+    ThreadPool* fork = forkPool(pool, myHeight, theirHeight);
+    AVLNode<Key, Value>* left;
+    AVLNode<Key, Value>* right;
+    int lHeight, rHeight;
+    auto doLeft = [&]() {
+        left = unionNodes(less, lessHeight, theirLeft, theirLeftHeight, pool, lHeight);
+    };
+    auto doRight = [&]() {
+        right = unionNodes(greater, greaterHeight, theirRight, theirRightHeight, pool, rHeight);
+    };
+    if(fork != nullptr){
+        fork->invoke(doLeft, doRight);
+    }
+    else{
+        doLeft();
+        doRight();
+    }
+    this->threadJoin(left, theirs, right);
+    return joinNodes(left, lHeight, theirs, right, rHeight, height);
+}
+
+/**
+* Splits mine around each key of theirs, keeping the node that matched.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+AVLNode<Key, Value>*
+AVLTree<Key, Value, Compare, Alloc>::intersectNodes(AVLNode<Key, Value>* mine, int myHeight,
+                                                   const AVLNode<Key, Value>* theirs, int theirHeight,
+                                                   ThreadPool* pool, int& height)
+{
+    if(mine == nullptr){
+        height = 0;
+        return nullptr;
+    }
+    if(theirs == nullptr){
+        this->clearHelper(mine);
+        height = 0;
+        return nullptr;
+    }
+    AVLNode<Key, Value>* less;
+    AVLNode<Key, Value>* found;
+    AVLNode<Key, Value>* greater;
+    int lessHeight, greaterHeight;
+    splitNodes(mine, myHeight, theirs->getKey(), less, lessHeight, found, greater, greaterHeight);
+
+    ThreadPool* fork = forkPool(pool, myHeight, theirHeight);
+    int theirLeftHeight = leftHeight(theirs, theirHeight);
+    int theirRightHeight = rightHeight(theirs, theirHeight);
+    AVLNode<Key, Value>* left;
+    AVLNode<Key, Value>* right;
+    int lHeight, rHeight;
+    auto doLeft = [&]() {
+        left = intersectNodes(less, lessHeight, theirs->getLeft(), theirLeftHeight, pool, lHeight);
+    };
+    auto doRight = [&]() {
+        right = intersectNodes(greater, greaterHeight, theirs->getRight(), theirRightHeight, pool, rHeight);
+    };
+    if(fork != nullptr){
+        fork->invoke(doLeft, doRight);
+    }
+    else{
+        doLeft();
+        doRight();
+    }
+    if(found != nullptr){
+        this->threadJoin(left, found, right);
+        return joinNodes(left, lHeight, found, right, rHeight, height);
+    }
+    this->threadJoin(left, nullptr, right);
+    return joinNodes(left, lHeight, right, rHeight, height);
+}
+
+/**
+* Splits mine around each key of theirs, dropping the node that matched.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+AVLNode<Key, Value>*
+AVLTree<Key, Value, Compare, Alloc>::differenceNodes(AVLNode<Key, Value>* mine, int myHeight,
+                                                    const AVLNode<Key, Value>* theirs, int theirHeight,
+                                                    ThreadPool* pool, int& height)
+{
+    if(mine == nullptr || theirs == nullptr){
+        height = myHeight;
+        return mine;
+    }
+    AVLNode<Key, Value>* less;
+    AVLNode<Key, Value>* found;
+    AVLNode<Key, Value>* greater;
+    int lessHeight, greaterHeight;
+    splitNodes(mine, myHeight, theirs->getKey(), less, lessHeight, found, greater, greaterHeight);
+    if(found != nullptr){
+        this->destroyNode(found);
+    }
+
+    ThreadPool* fork = forkPool(pool, myHeight, theirHeight);
+    int theirLeftHeight = leftHeight(theirs, theirHeight);
+    int theirRightHeight = rightHeight(theirs, theirHeight);
+    AVLNode<Key, Value>* left;
+    AVLNode<Key, Value>* right;
+    int lHeight, rHeight;
+    auto doLeft = [&]() {
+        left = differenceNodes(less, lessHeight, theirs->getLeft(), theirLeftHeight, pool, lHeight);
+    };
+    auto doRight = [&]() {
+        right = differenceNodes(greater, greaterHeight, theirs->getRight(), theirRightHeight, pool, rHeight);
+    };
+    if(fork != nullptr){
+        fork->invoke(doLeft, doRight);
+    }
+    else{
+        doLeft();
+        doRight();
+    }
+    this->threadJoin(left, nullptr, right);
+    return joinNodes(left, lHeight, right, rHeight, height);
+}
+
+/**
+* Returns the pool to fork on, or NULL when the work left is too small to be
+* worth a task. Arena allocators are not thread-safe, so trees using one
+* always run sequentially.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+ThreadPool* AVLTree<Key, Value, Compare, Alloc>::forkPool(ThreadPool* pool, int myHeight, int theirHeight) const
+{
+    //AVL subtrees this tall hold at least a few hundred nodes each
+    const int MIN_FORK_HEIGHT = 12;
+    if(pool == nullptr || pool->size() < 2 || is_arena_allocator<AVLNodeAlloc>::value ||
+       std::min(myHeight, theirHeight) < MIN_FORK_HEIGHT) {
+        return nullptr;
+    }
+    return pool;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::updateBalance(AVLNode<Key, Value>* node){
     if(node->getBalance() < -1 || node->getBalance() >1){
         rebalance(node);
     }
@@ -0,0 +1,1271 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+#include <cstdint>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <sstream>
+#include <cstring>
+#include <cstdio>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include "bst.h"
+#include "avlbst.h"
+#include "ranked-avlbst.h"
+#include "augmented-avlbst.h"
+#include "concurrent-avlbst.h"
+#include "persistent-avlbst.h"
+#include "frozen-map.h"
+#include "btree.h"
+#include "arena-allocator.h"
+#include "thread-pool.h"
+#include "durable-avlbst.h"
+#include "mapped-avlbst.h"
+
+using namespace std;
+
+typedef std::pair<const uint64_t, uint64_t> U64Pair;
+
+// Wall clock seconds since some fixed point
+static double now()
+{
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void report(const char* name, size_t ops, double seconds)
+{
+    cout << "  " << left << setw(36) << name << right
+         << setw(10) << fixed << setprecision(3) << seconds * 1000.0 << " ms"
+         << setw(12) << setprecision(2) << (ops / seconds) / 1e6 << " Mops/s" << endl;
+}
+
+static vector<uint64_t> randomKeys(size_t n, uint64_t seed)
+{
+    mt19937_64 gen(seed);
+    vector<uint64_t> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = gen();
+    }
+    return keys;
+}
+
+// Inserts every key, then times destroying the tree
+template<typename Tree>
+static void benchInsertTeardown(const char* name, const vector<uint64_t>& keys)
+{
+    Tree* tree = new Tree();
+    double start = now();
+    for(size_t i = 0; i < keys.size(); ++i) {
+        tree->insert(std::make_pair(keys[i], keys[i]));
+    }
+    double mid = now();
+    delete tree;
+    double end = now();
+
+    string label(name);
+    report((label + " insert").c_str(), keys.size(), mid - start);
+    report((label + " teardown").c_str(), keys.size(), end - mid);
+}
+
+static void benchAllocators(size_t n)
+{
+    cout << "Node allocation (" << n << " random keys):" << endl;
+    vector<uint64_t> keys = randomKeys(n, 1);
+    benchInsertTeardown<BinarySearchTree<uint64_t, uint64_t> >("BST new/delete", keys);
+    benchInsertTeardown<BinarySearchTree<uint64_t, uint64_t, std::less<uint64_t>, ArenaAllocator<U64Pair> > >("BST arena", keys);
+    benchInsertTeardown<AVLTree<uint64_t, uint64_t> >("AVL new/delete", keys);
+    benchInsertTeardown<AVLTree<uint64_t, uint64_t, std::less<uint64_t>, ArenaAllocator<U64Pair> > >("AVL arena", keys);
+}
+
+// Times a successful find() for every key, in a shuffled order
+template<typename Tree>
+static void benchLookup(const char* name, const vector<uint64_t>& keys)
+{
+    Tree tree;
+    for(size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(std::make_pair(keys[i], keys[i]));
+    }
+    vector<uint64_t> probes(keys);
+    shuffle(probes.begin(), probes.end(), mt19937_64(2));
+
+    uint64_t sum = 0;
+    double start = now();
+    for(size_t i = 0; i < probes.size(); ++i) {
+        sum += tree.find(probes[i])->second;
+    }
+    double end = now();
+    report(name, probes.size(), end - start);
+    if(sum == 0) {
+        cout << "  (checksum " << sum << ")" << endl;
+    }
+}
+
+static void benchNodeAccess(size_t n)
+{
+    cout << "Node size: Node<uint64_t,uint64_t> " << sizeof(Node<uint64_t, uint64_t>)
+         << " bytes, AVLNode<uint64_t,uint64_t> " << sizeof(AVLNode<uint64_t, uint64_t>)
+         << " bytes" << endl;
+    cout << "Lookup (" << n << " random keys):" << endl;
+    vector<uint64_t> keys = randomKeys(n, 1);
+    benchLookup<BinarySearchTree<uint64_t, uint64_t> >("BST find", keys);
+    benchLookup<AVLTree<uint64_t, uint64_t> >("AVL find", keys);
+}
+
+static void benchBulkLoad(size_t n)
+{
+    cout << "Sorted load (" << n << " keys):" << endl;
+    vector<std::pair<uint64_t, uint64_t> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = std::make_pair(i, i);
+    }
+
+    double start = now();
+    {
+        AVLTree<uint64_t, uint64_t> tree;
+        for(size_t i = 0; i < n; ++i) {
+            tree.insert(items[i]);
+        }
+        start = now() - start;
+    }
+    report("AVL insert loop", n, start);
+
+    start = now();
+    {
+        AVLTree<uint64_t, uint64_t> tree(items.begin(), items.end());
+        start = now() - start;
+    }
+    report("AVL sorted-range constructor", n, start);
+}
+
+// Runs f a few times and returns the fastest wall time, so variants measured
+// back to back are not skewed by heap state left behind by the previous one
+template<typename F>
+static double bestOf(int runs, F f)
+{
+    double best = 0;
+    for(int i = 0; i < runs; ++i) {
+        double start = now();
+        f();
+        double elapsed = now() - start;
+        if(i == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+struct FindThenInsert
+{
+    const vector<uint64_t>* updates;
+    void operator()() const
+    {
+        AVLTree<uint64_t, uint64_t> tree;
+        for(size_t i = 0; i < updates->size(); ++i) {
+            AVLTree<uint64_t, uint64_t>::iterator it = tree.find((*updates)[i]);
+            if(it != tree.end()) {
+                it->second += 1;
+            }
+            else {
+                tree.insert(std::make_pair((*updates)[i], 1));
+            }
+        }
+    }
+};
+
+struct TryEmplace
+{
+    const vector<uint64_t>* updates;
+    void operator()() const
+    {
+        AVLTree<uint64_t, uint64_t> tree;
+        for(size_t i = 0; i < updates->size(); ++i) {
+            std::pair<AVLTree<uint64_t, uint64_t>::iterator, bool> result = tree.try_emplace((*updates)[i], 1);
+            if(!result.second) {
+                result.first->second += 1;
+            }
+        }
+    }
+};
+
+// Half the updates hit existing keys: the old find-then-insert pattern
+// against a single try_emplace traversal
+static void benchUpsert(size_t n)
+{
+    cout << "Upsert (" << n << " updates over " << n / 2 << " keys, best of 3):" << endl;
+    vector<uint64_t> keys = randomKeys(n / 2, 3);
+    vector<uint64_t> updates(keys);
+    updates.insert(updates.end(), keys.begin(), keys.end());
+    shuffle(updates.begin(), updates.end(), mt19937_64(4));
+
+    FindThenInsert findThenInsert = { &updates };
+    TryEmplace tryEmplace = { &updates };
+    report("AVL find + insert", updates.size(), bestOf(3, findThenInsert));
+    report("AVL try_emplace", updates.size(), bestOf(3, tryEmplace));
+}
+
+// Long keys with a shared prefix make every comparison expensive
+static vector<string> stringKeys(size_t n, uint64_t seed)
+{
+    vector<uint64_t> ids = randomKeys(n, seed);
+    vector<string> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = string(48, 'k') + to_string(ids[i]);
+    }
+    return keys;
+}
+
+// Orders std::string keys and also compares them directly against C strings,
+// so a lookup by const char* needs no temporary std::string. The compare()
+// members let the tree do one three-way comparison per level.
+struct TransparentStringLess
+{
+    typedef void is_transparent;
+
+    bool operator()(const string& a, const string& b) const
+    {
+        return a.compare(b) < 0;
+    }
+    bool operator()(const string& a, const char* b) const
+    {
+        return a.compare(b) < 0;
+    }
+    bool operator()(const char* a, const string& b) const
+    {
+        return b.compare(a) > 0;
+    }
+    int compare(const string& a, const string& b) const
+    {
+        return a.compare(b);
+    }
+    int compare(const char* a, const string& b) const
+    {
+        return -b.compare(a);
+    }
+};
+
+// Counts comparator calls to show how many comparisons a lookup makes
+struct CountingLess
+{
+    static size_t calls;
+    bool operator()(const string& a, const string& b) const
+    {
+        ++calls;
+        return a.compare(b) < 0;
+    }
+};
+size_t CountingLess::calls = 0;
+
+struct CountingThreeWay : CountingLess
+{
+    int compare(const string& a, const string& b) const
+    {
+        ++calls;
+        return a.compare(b);
+    }
+};
+
+template<typename Tree>
+static double comparisonsPerFind(const vector<string>& keys, const vector<string>& probes)
+{
+    Tree tree;
+    for(size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(std::make_pair(keys[i], i));
+    }
+    CountingLess::calls = 0;
+    for(size_t i = 0; i < probes.size(); ++i) {
+        tree.find(probes[i]);
+    }
+    return double(CountingLess::calls) / probes.size();
+}
+
+static void benchStringKeys(size_t n)
+{
+    cout << "String keys (" << n << " keys of ~64 chars):" << endl;
+    vector<string> keys = stringKeys(n, 5);
+    vector<string> probes(keys);
+    shuffle(probes.begin(), probes.end(), mt19937_64(6));
+
+    AVLTree<string, uint64_t, TransparentStringLess> tree;
+    double start = now();
+    for(size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(std::make_pair(keys[i], i));
+    }
+    report("AVL<string> insert", keys.size(), now() - start);
+
+    uint64_t sum = 0;
+    start = now();
+    for(size_t i = 0; i < probes.size(); ++i) {
+        sum += tree.find(probes[i])->second;
+    }
+    report("AVL<string> find", probes.size(), now() - start);
+
+    start = now();
+    for(size_t i = 0; i < probes.size(); ++i) {
+        sum += tree.find(string(probes[i].c_str()))->second;
+    }
+    report("AVL<string> find(string(char*))", probes.size(), now() - start);
+
+    start = now();
+    for(size_t i = 0; i < probes.size(); ++i) {
+        sum += tree.find(probes[i].c_str())->second;
+    }
+    report("AVL<string> find(char*) transparent", probes.size(), now() - start);
+    if(sum == 0) {
+        cout << "  (checksum " << sum << ")" << endl;
+    }
+
+    cout << "  comparisons per find: predicate only "
+         << comparisonsPerFind<AVLTree<string, uint64_t, CountingLess> >(keys, probes)
+         << ", three-way " << comparisonsPerFind<AVLTree<string, uint64_t, CountingThreeWay> >(keys, probes)
+         << endl;
+}
+
+struct AppendPlain
+{
+    size_t n;
+    void operator()() const
+    {
+        AVLTree<uint64_t, uint64_t> tree;
+        for(size_t i = 0; i < n; ++i) {
+            tree.insert(std::make_pair(i, i));
+        }
+    }
+};
+
+struct AppendHinted
+{
+    size_t n;
+    void operator()() const
+    {
+        AVLTree<uint64_t, uint64_t> tree;
+        for(size_t i = 0; i < n; ++i) {
+            tree.insert(tree.end(), std::make_pair(i, i));
+        }
+    }
+};
+
+// Monotonic ingest (timestamps, log ids) and lookups clustered near a
+// previous result, with and without a hint
+static void benchHinted(size_t n)
+{
+    cout << "Hinted access (" << n << " ascending keys, best of 3):" << endl;
+    AppendPlain plain = { n };
+    AppendHinted hinted = { n };
+    report("AVL insert ascending", n, bestOf(3, plain));
+    report("AVL insert(end(), v) ascending", n, bestOf(3, hinted));
+
+    AVLTree<uint64_t, uint64_t> tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(tree.end(), std::make_pair(2 * i, i));
+    }
+    // each probe lands a few keys after the previous one
+    vector<uint64_t> probes(n);
+    mt19937_64 gen(7);
+    uint64_t key = 0;
+    for(size_t i = 0; i < n; ++i) {
+        key = (key + 2 * (gen() % 8)) % (2 * n);
+        probes[i] = key;
+    }
+
+    uint64_t sum = 0;
+    double start = now();
+    for(size_t i = 0; i < n; ++i) {
+        sum += tree.find(probes[i])->second;
+    }
+    report("AVL find nearby", n, now() - start);
+
+    AVLTree<uint64_t, uint64_t>::iterator last = tree.begin();
+    start = now();
+    for(size_t i = 0; i < n; ++i) {
+        last = tree.find(last, probes[i]);
+        sum += last->second;
+    }
+    report("AVL find(hint) nearby", n, now() - start);
+    if(sum == 0) {
+        cout << "  (checksum " << sum << ")" << endl;
+    }
+}
+
+// Counts the keys in a narrow window by scanning from begin() versus
+// starting at lower_bound through range()
+static void benchRangeScan(size_t n)
+{
+    const size_t queries = 50;
+    const uint64_t width = 64;
+    cout << "Range scan (" << n << " keys, " << queries << " windows of " << width << "):" << endl;
+    AVLTree<uint64_t, uint64_t> tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(tree.end(), std::make_pair(i, i));
+    }
+    vector<uint64_t> starts = randomKeys(queries, 8);
+    for(size_t i = 0; i < queries; ++i) {
+        starts[i] %= n;
+    }
+
+    size_t found = 0;
+    double start = now();
+    for(size_t i = 0; i < queries; ++i) {
+        for(AVLTree<uint64_t, uint64_t>::iterator it = tree.begin(); it != tree.end(); ++it) {
+            if(it->first >= starts[i] + width) {
+                break;
+            }
+            if(it->first >= starts[i]) {
+                ++found;
+            }
+        }
+    }
+    report("AVL scan from begin()", queries, now() - start);
+
+    start = now();
+    for(size_t i = 0; i < queries; ++i) {
+        AVLTree<uint64_t, uint64_t>::range_view window = tree.range(starts[i], starts[i] + width);
+        for(AVLTree<uint64_t, uint64_t>::iterator it = window.begin(); it != window.end(); ++it) {
+            ++found;
+        }
+    }
+    report("AVL range(lo, hi)", queries, now() - start);
+    if(found == 0) {
+        cout << "  (checksum " << found << ")" << endl;
+    }
+}
+
+template<typename Tree>
+struct InsertAll
+{
+    const vector<uint64_t>* keys;
+    void operator()() const
+    {
+        Tree tree;
+        for(size_t i = 0; i < keys->size(); ++i) {
+            tree.insert(std::make_pair((*keys)[i], (*keys)[i]));
+        }
+    }
+};
+
+// What keeping subtree sizes costs on insert, and what it buys for percentiles
+static void benchOrderStatistics(size_t n)
+{
+    cout << "Order statistics (" << n << " random keys, best of 3):" << endl;
+    vector<uint64_t> keys = randomKeys(n, 9);
+    InsertAll<AVLTree<uint64_t, uint64_t> > plain = { &keys };
+    InsertAll<RankedAVLTree<uint64_t, uint64_t> > ranked = { &keys };
+    report("AVL insert", n, bestOf(3, plain));
+    report("RankedAVL insert", n, bestOf(3, ranked));
+
+    RankedAVLTree<uint64_t, uint64_t> tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(std::make_pair(keys[i], keys[i]));
+    }
+    // p10, p20, ..., p90 of the keys
+    const size_t percentiles = 9;
+    uint64_t sum = 0;
+    double start = now();
+    for(size_t p = 1; p <= percentiles; ++p) {
+        RankedAVLTree<uint64_t, uint64_t>::iterator it = tree.begin();
+        for(size_t i = 0; i < n * p / 10; ++i) {
+            ++it;
+        }
+        sum += it->first;
+    }
+    report("percentiles by iterator walk", percentiles, now() - start);
+
+    start = now();
+    for(size_t p = 1; p <= percentiles; ++p) {
+        sum += tree.select(n * p / 10)->first;
+    }
+    report("percentiles by select(k)", percentiles, now() - start);
+
+    start = now();
+    for(size_t i = 0; i < n; ++i) {
+        sum += tree.rank(keys[i]);
+    }
+    report("rank(key)", n, now() - start);
+    if(sum == 0) {
+        cout << "  (checksum " << sum << ")" << endl;
+    }
+}
+
+// Sums the values over wide key ranges by iterating them versus from the
+// cached per-subtree sums
+static void benchRangeAggregate(size_t n)
+{
+    const size_t queries = 10;
+    cout << "Range sums (" << n << " keys, " << queries << " ranges of ~n/2 keys, best of 3):" << endl;
+    vector<uint64_t> keys = randomKeys(n, 10);
+    InsertAll<AVLTree<uint64_t, uint64_t> > plain = { &keys };
+    InsertAll<AugmentedAVLTree<uint64_t, uint64_t, ValueSum<uint64_t> > > augmented = { &keys };
+    report("AVL insert", n, bestOf(3, plain));
+    report("AugmentedAVL<sum> insert", n, bestOf(3, augmented));
+
+    AugmentedAVLTree<uint64_t, uint64_t, ValueSum<uint64_t> > tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(std::make_pair(keys[i], keys[i] & 0xffff));
+    }
+    vector<uint64_t> starts = randomKeys(queries, 11);
+    for(size_t i = 0; i < queries; ++i) {
+        starts[i] /= 2;
+    }
+    const uint64_t width = UINT64_MAX / 2;
+
+    uint64_t iterated = 0;
+    double start = now();
+    for(size_t i = 0; i < queries; ++i) {
+        AVLTree<uint64_t, uint64_t>::range_view window = tree.range(starts[i], starts[i] + width);
+        for(AVLTree<uint64_t, uint64_t>::iterator it = window.begin(); it != window.end(); ++it) {
+            iterated += it->second;
+        }
+    }
+    report("sum by iterating range(lo, hi)", queries, now() - start);
+
+    uint64_t aggregated = 0;
+    start = now();
+    for(size_t i = 0; i < queries; ++i) {
+        aggregated += tree.aggregate(starts[i], starts[i] + width);
+    }
+    report("aggregate(lo, hi)", queries, now() - start);
+    if(iterated != aggregated) {
+        cout << "  (mismatch " << iterated << " != " << aggregated << ")" << endl;
+    }
+}
+
+// Retention sweep: drop the oldest quarter of a time-ordered tree one key at
+// a time versus with a single erase(lo, hi)
+static void benchRangeErase(size_t n)
+{
+    cout << "Range erase (" << n << " ascending keys, oldest " << n / 4 << " dropped):" << endl;
+    AVLTree<uint64_t, uint64_t> perKey;
+    AVLTree<uint64_t, uint64_t> ranged;
+    for(size_t i = 0; i < n; ++i) {
+        perKey.insert(perKey.end(), std::make_pair(i, i));
+        ranged.insert(ranged.end(), std::make_pair(i, i));
+    }
+
+    double start = now();
+    for(size_t i = 0; i < n / 4; ++i) {
+        perKey.remove(i);
+    }
+    report("AVL remove per key", n / 4, now() - start);
+
+    start = now();
+    ranged.erase(0, n / 4);
+    report("AVL erase(lo, hi)", n / 4, now() - start);
+
+    AVLTree<uint64_t, uint64_t> moved;
+    start = now();
+    ranged.extract_range(n / 4, n / 2, moved);
+    report("AVL extract_range(lo, hi)", n / 4, now() - start);
+}
+
+static vector<std::pair<uint64_t, uint64_t> > sortedItems(size_t n, uint64_t seed)
+{
+    vector<uint64_t> keys = randomKeys(n, seed);
+    // a narrow key space makes the two shards overlap
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] %= 4 * n;
+    }
+    sort(keys.begin(), keys.end());
+    keys.erase(unique(keys.begin(), keys.end()), keys.end());
+    vector<std::pair<uint64_t, uint64_t> > items(keys.size());
+    for(size_t i = 0; i < keys.size(); ++i) {
+        items[i] = std::make_pair(keys[i], i);
+    }
+    return items;
+}
+
+// Union, intersection and difference of two shards of ~n keys, timed with
+// pools of 1 to N threads (the trees are rebuilt before every run)
+static void benchSetOperations(size_t n)
+{
+    unsigned maxThreads = std::max(4u, std::thread::hardware_concurrency());
+    cout << "Set operations (two shards of " << n << " keys, "
+         << std::thread::hardware_concurrency() << " hardware threads):" << endl;
+    vector<std::pair<uint64_t, uint64_t> > first = sortedItems(n, 12);
+    vector<std::pair<uint64_t, uint64_t> > second = sortedItems(n, 13);
+    typedef AVLTree<uint64_t, uint64_t> Tree;
+
+    double start = now();
+    {
+        Tree mine(first.begin(), first.end());
+        Tree theirs(second.begin(), second.end());
+        start = now();
+        for(Tree::iterator it = theirs.begin(); it != theirs.end(); ++it) {
+            mine.insert(*it);
+        }
+        start = now() - start;
+    }
+    report("insert loop union", second.size(), start);
+
+    for(unsigned threads = 1; threads <= maxThreads; threads *= 2) {
+        ThreadPool pool(threads);
+        string suffix = " (" + to_string(threads) + " threads)";
+        {
+            Tree mine(first.begin(), first.end());
+            Tree theirs(second.begin(), second.end());
+            start = now();
+            mine.unionWith(theirs, &pool);
+            report(("unionWith" + suffix).c_str(), second.size(), now() - start);
+        }
+        {
+            Tree mine(first.begin(), first.end());
+            Tree theirs(second.begin(), second.end());
+            start = now();
+            mine.intersectWith(theirs, &pool);
+            report(("intersectWith" + suffix).c_str(), second.size(), now() - start);
+        }
+        {
+            Tree mine(first.begin(), first.end());
+            Tree theirs(second.begin(), second.end());
+            start = now();
+            mine.differenceWith(theirs, &pool);
+            report(("differenceWith" + suffix).c_str(), second.size(), now() - start);
+        }
+    }
+}
+
+// An unsorted batch of n keys merged into a tree of n keys, one insert at a
+// time versus insertBatch with pools of 1 to N threads
+static void benchBatchInsert(size_t n)
+{
+    unsigned maxThreads = std::max(4u, std::thread::hardware_concurrency());
+    cout << "Batch insert (" << n << " unsorted keys into " << n << "):" << endl;
+    vector<std::pair<uint64_t, uint64_t> > existing = sortedItems(n, 14);
+    vector<uint64_t> keys = randomKeys(n, 15);
+    vector<std::pair<uint64_t, uint64_t> > batch(n);
+    for(size_t i = 0; i < n; ++i) {
+        batch[i] = std::make_pair(keys[i] % (4 * n), i);
+    }
+    typedef AVLTree<uint64_t, uint64_t> Tree;
+
+    double start;
+    {
+        Tree tree(existing.begin(), existing.end());
+        start = now();
+        for(size_t i = 0; i < batch.size(); ++i) {
+            tree.insert(batch[i]);
+        }
+        report("insert loop", batch.size(), now() - start);
+    }
+    for(unsigned threads = 1; threads <= maxThreads; threads *= 2) {
+        ThreadPool pool(threads);
+        Tree tree(existing.begin(), existing.end());
+        start = now();
+        tree.insertBatch(batch.begin(), batch.end(), &pool);
+        report(("insertBatch (" + to_string(threads) + " threads)").c_str(), batch.size(), now() - start);
+    }
+}
+
+// What a multi-threaded service does without a concurrent tree
+struct LockedAVL
+{
+    AVLTree<uint64_t, uint64_t> tree;
+    std::mutex mutex;
+
+    bool find(uint64_t key, uint64_t& value)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        AVLTree<uint64_t, uint64_t>::iterator it = tree.find(key);
+        if(it == tree.end()) {
+            return false;
+        }
+        value = it->second;
+        return true;
+    }
+    void insert(const U64Pair& item)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tree.insert(item);
+    }
+    void remove(uint64_t key)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tree.remove(key);
+    }
+};
+
+// Each thread does its share of ops random finds, inserts and removes over
+// keys in [0, keySpace), writePercent of them writes split evenly
+template<typename Map>
+static double runMix(Map& map, unsigned threads, size_t ops, unsigned writePercent, uint64_t keySpace)
+{
+    std::atomic<bool> go(false);
+    vector<std::thread> workers;
+    for(unsigned t = 0; t < threads; ++t) {
+        workers.push_back(std::thread([&, t]() {
+            mt19937_64 rng(t + 1);
+            uint64_t sum = 0;
+            while(!go.load()) {
+                std::this_thread::yield();
+            }
+            for(size_t i = t; i < ops; i += threads) {
+                uint64_t key = rng() % keySpace;
+                unsigned roll = rng() % 200;
+                if(roll < writePercent) {
+                    map.insert(U64Pair(key, i));
+                }
+                else if(roll < 2 * writePercent) {
+                    map.remove(key);
+                }
+                else {
+                    uint64_t value;
+                    if(map.find(key, value)) {
+                        sum += value;
+                    }
+                }
+            }
+            if(sum == 1) {
+                cout << "  (checksum " << sum << ")" << endl;
+            }
+        }));
+    }
+    double start = now();
+    go.store(true);
+    for(size_t i = 0; i < workers.size(); ++i) {
+        workers[i].join();
+    }
+    return now() - start;
+}
+
+// A global mutex around AVLTree versus ConcurrentAVLTree, over 1 to N threads
+// and read-only, read-mostly and write-heavy mixes
+static void benchConcurrentAccess(size_t n)
+{
+    unsigned maxThreads = std::max(4u, std::thread::hardware_concurrency());
+    cout << "Concurrent access (" << n / 2 << " keys, "
+         << std::thread::hardware_concurrency() << " hardware threads):" << endl;
+    size_t ops = n / 4;
+    vector<uint64_t> keys = randomKeys(n / 2, 16);
+    LockedAVL locked;
+    ConcurrentAVLTree<uint64_t, uint64_t> shared;
+    for(size_t i = 0; i < keys.size(); ++i) {
+        locked.insert(U64Pair(keys[i] % n, i));
+        shared.insert(U64Pair(keys[i] % n, i));
+    }
+
+    const unsigned writePercents[] = { 0, 10, 50 };
+    for(size_t m = 0; m < sizeof(writePercents) / sizeof(writePercents[0]); ++m) {
+        cout << " " << writePercents[m] << "% writes:" << endl;
+        for(unsigned threads = 1; threads <= maxThreads; threads *= 2) {
+            string suffix = " (" + to_string(threads) + " threads)";
+            report(("mutex AVLTree" + suffix).c_str(), ops,
+                   runMix(locked, threads, ops, writePercents[m], n));
+            report(("ConcurrentAVLTree" + suffix).c_str(), ops,
+                   runMix(shared, threads, ops, writePercents[m], n));
+        }
+    }
+}
+
+// What path copying costs writers, and a full scan of a snapshot while a
+// writer thread keeps updating the tree underneath it
+static void benchSnapshots(size_t n)
+{
+    cout << "Snapshots (" << n << " keys):" << endl;
+    vector<uint64_t> keys = randomKeys(n, 17);
+    typedef PersistentAVLTree<uint64_t, uint64_t> Persistent;
+
+    double start = now();
+    {
+        AVLTree<uint64_t, uint64_t> tree;
+        for(size_t i = 0; i < n; ++i) {
+            tree.insert(U64Pair(keys[i], i));
+        }
+        report("AVLTree insert", n, now() - start);
+    }
+    Persistent persistent;
+    start = now();
+    for(size_t i = 0; i < n; ++i) {
+        persistent.insert(U64Pair(keys[i], i));
+    }
+    report("PersistentAVLTree insert", n, now() - start);
+
+    start = now();
+    size_t taken = 0;
+    for(size_t i = 0; i < n; ++i) {
+        taken += persistent.snapshot().size();
+    }
+    report("snapshot()", n, now() - start);
+
+    std::atomic<bool> scanning(true);
+    size_t updates = 0;
+    std::thread writer([&]() {
+        mt19937_64 rng(18);
+        while(scanning.load()) {
+            uint64_t key = keys[rng() % n];
+            if(rng() % 2) {
+                persistent.insert(U64Pair(key, updates));
+            }
+            else {
+                persistent.remove(key);
+            }
+            ++updates;
+        }
+    });
+    Persistent::Snapshot snapshot = persistent.snapshot();
+    start = now();
+    uint64_t sum = 0;
+    for(Persistent::const_iterator it = snapshot.begin(); it != snapshot.end(); ++it) {
+        sum += it->second;
+    }
+    double scanTime = now() - start;
+    scanning.store(false);
+    writer.join();
+    report("scan during writes", snapshot.size(), scanTime);
+    cout << "  (" << updates << " updates meanwhile)" << endl;
+    if(sum == 0 || taken == 0) {
+        cout << "  (checksum " << sum << ")" << endl;
+    }
+}
+
+// Full in-order scans of a tree whose nodes were allocated in random key
+// order, so each step lands on a cold node. Build with
+// make DEFS=-DBST_THREADED to compare against the threaded layout.
+static void benchIteration()
+{
+    const size_t n = 10000000;
+#ifdef BST_THREADED
+    cout << "Iteration (" << n << " keys, threaded nodes):" << endl;
+#else
+    cout << "Iteration (" << n << " keys, parent links):" << endl;
+#endif
+    vector<uint64_t> keys = randomKeys(n, 19);
+    typedef AVLTree<uint64_t, uint64_t> Tree;
+    Tree tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(U64Pair(keys[i], i));
+    }
+
+    uint64_t sum = 0;
+    auto forward = [&]() {
+        for(Tree::iterator it = tree.begin(); it != tree.end(); ++it) {
+            sum += it->second;
+        }
+    };
+    auto backward = [&]() {
+        for(Tree::reverse_iterator it = tree.rbegin(); it != tree.rend(); ++it) {
+            sum += it->second;
+        }
+    };
+    report("scan with ++", n, bestOf(3, forward));
+    report("scan with reverse_iterator", n, bestOf(3, backward));
+    if(sum == 0) {
+        cout << "  (checksum " << sum << ")" << endl;
+    }
+}
+
+// The same keys looked up in the live tree and in a FrozenMap copy of it
+static void benchFrozen(size_t n)
+{
+    cout << "Frozen map (" << n << " random keys):" << endl;
+    vector<uint64_t> keys = randomKeys(n, 20);
+    AVLTree<uint64_t, uint64_t> tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(U64Pair(keys[i], i));
+    }
+    double start = now();
+    FrozenMap<uint64_t, uint64_t> frozen(tree);
+    report("FrozenMap from AVLTree", n, now() - start);
+
+    vector<uint64_t> probes(keys);
+    shuffle(probes.begin(), probes.end(), mt19937_64(21));
+    uint64_t sum = 0;
+    auto live = [&]() {
+        for(size_t i = 0; i < probes.size(); ++i) {
+            sum += tree.find(probes[i])->second;
+        }
+    };
+    auto eytzinger = [&]() {
+        for(size_t i = 0; i < probes.size(); ++i) {
+            sum += frozen.find(probes[i])->second;
+        }
+    };
+    auto bounds = [&]() {
+        for(size_t i = 0; i < probes.size(); ++i) {
+            FrozenMap<uint64_t, uint64_t>::const_iterator it = frozen.lower_bound(probes[i] + 1);
+            sum += it == frozen.end() ? 0 : it->second;
+        }
+    };
+    report("AVLTree find", n, bestOf(3, live));
+    report("FrozenMap find", n, bestOf(3, eytzinger));
+    report("FrozenMap lower_bound", n, bestOf(3, bounds));
+    if(sum == 0) {
+        cout << "  (checksum " << sum << ")" << endl;
+    }
+}
+
+// Lookups in batches the size a request handler might resolve at once: one
+// find() per key versus findBatch over each batch
+static void benchFindBatch(size_t n)
+{
+    const size_t batchSize = 256;
+    cout << "Batched lookup (" << n << " random keys, batches of " << batchSize << "):" << endl;
+    vector<uint64_t> keys = randomKeys(n, 24);
+    typedef AVLTree<uint64_t, uint64_t> Tree;
+    Tree tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(U64Pair(keys[i], i));
+    }
+    vector<uint64_t> probes(keys);
+    shuffle(probes.begin(), probes.end(), mt19937_64(25));
+
+    uint64_t sum = 0;
+    vector<Tree::iterator> results(batchSize);
+    auto scalar = [&]() {
+        for(size_t i = 0; i < probes.size(); ++i) {
+            sum += tree.find(probes[i])->second;
+        }
+    };
+    auto batched = [&]() {
+        for(size_t i = 0; i < probes.size(); i += batchSize) {
+            size_t count = std::min(batchSize, probes.size() - i);
+            tree.findBatch(probes.begin() + i, probes.begin() + i + count, results.begin());
+            for(size_t j = 0; j < count; ++j) {
+                sum += results[j]->second;
+            }
+        }
+    };
+    report("find loop", n, bestOf(3, scalar));
+    report("findBatch", n, bestOf(3, batched));
+    if(sum == 0) {
+        cout << "  (checksum " << sum << ")" << endl;
+    }
+}
+
+// Random inserts, shuffled finds and removal of every key, through the
+// interface the binary trees and BTree share
+template<typename Map>
+static void benchMapOps(const char* name, const vector<uint64_t>& keys)
+{
+    vector<uint64_t> probes(keys);
+    shuffle(probes.begin(), probes.end(), mt19937_64(23));
+    Map map;
+    uint64_t sum = 0;
+    double start = now();
+    for(size_t i = 0; i < keys.size(); ++i) {
+        map.insert(U64Pair(keys[i], i));
+    }
+    double inserted = now();
+    for(size_t i = 0; i < probes.size(); ++i) {
+        sum += map.find(probes[i])->second;
+    }
+    double found = now();
+    for(size_t i = 0; i < probes.size(); ++i) {
+        map.remove(probes[i]);
+    }
+    double removed = now();
+    report((string(name) + " insert").c_str(), keys.size(), inserted - start);
+    report((string(name) + " find").c_str(), probes.size(), found - inserted);
+    report((string(name) + " remove").c_str(), probes.size(), removed - found);
+    if(sum == 0) {
+        cout << "  (checksum " << sum << ")" << endl;
+    }
+}
+
+template<unsigned Fanout>
+static double btreeBytesPerEntry(const vector<uint64_t>& keys)
+{
+    BTree<uint64_t, uint64_t, std::less<uint64_t>, Fanout> tree;
+    for(size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(U64Pair(keys[i], i));
+    }
+    return double(tree.memoryUsage()) / tree.size();
+}
+
+static void benchBTree(size_t n)
+{
+    cout << "B-tree vs AVL (" << n << " random keys):" << endl;
+    vector<uint64_t> keys = randomKeys(n, 22);
+    benchMapOps<AVLTree<uint64_t, uint64_t> >("AVLTree", keys);
+    benchMapOps<BTree<uint64_t, uint64_t, std::less<uint64_t>, 16> >("BTree<16>", keys);
+    benchMapOps<BTree<uint64_t, uint64_t> >("BTree<32>", keys);
+    benchMapOps<BTree<uint64_t, uint64_t, std::less<uint64_t>, 64> >("BTree<64>", keys);
+    cout << "  bytes per entry: AVLTree " << sizeof(AVLNode<uint64_t, uint64_t>)
+         << setprecision(1) << ", BTree<16> " << btreeBytesPerEntry<16>(keys)
+         << ", BTree<32> " << btreeBytesPerEntry<32>(keys)
+         << ", BTree<64> " << btreeBytesPerEntry<64>(keys) << " (allocator overhead not counted)" << endl;
+}
+
+// A BinarySearchTree fed sorted keys is one long chain. Validating and
+// destroying it used to recurse once per node; the time per node should
+// now stay flat as the chain grows.
+static void benchDegenerate(size_t n)
+{
+    cout << "Degenerate chains (sorted inserts into BinarySearchTree):" << endl;
+    typedef BinarySearchTree<uint64_t, uint64_t> Tree;
+    for(size_t size = n; size <= 16 * n; size *= 4) {
+        Tree* tree = new Tree;
+        for(size_t i = 0; i < size; ++i) {
+            tree->insert(tree->end(), U64Pair(i, i));
+        }
+        string label = to_string(size) + " nodes: ";
+        double start = now();
+        bool balanced = tree->isBalanced();
+        report((label + "isBalanced").c_str(), size, now() - start);
+        start = now();
+        delete tree;
+        report((label + "destroy").c_str(), size, now() - start);
+        if(balanced && size > 2) {
+            cout << "  (chain reported balanced)" << endl;
+        }
+    }
+}
+
+// Filtering a tree in place: erase(iterator) steps to the next item and
+// unlinks without searching, where remove(key) searches from the root
+static void benchEraseIterator(size_t n)
+{
+    cout << "Erase while iterating (" << n << " random keys, every other one erased):" << endl;
+    vector<uint64_t> keys = randomKeys(n, 21);
+    typedef AVLTree<uint64_t, uint64_t> Tree;
+    Tree byKey;
+    Tree byIterator;
+    for(size_t i = 0; i < n; ++i) {
+        byKey.insert(U64Pair(keys[i], i));
+        byIterator.insert(U64Pair(keys[i], i));
+    }
+
+    double start = now();
+    vector<uint64_t> doomed;
+    bool drop = true;
+    for(Tree::iterator it = byKey.begin(); it != byKey.end(); ++it, drop = !drop) {
+        if(drop) {
+            doomed.push_back(it->first);
+        }
+    }
+    for(size_t i = 0; i < doomed.size(); ++i) {
+        byKey.remove(doomed[i]);
+    }
+    report("collect, then remove(key)", doomed.size(), now() - start);
+
+    start = now();
+    drop = true;
+    for(Tree::iterator it = byIterator.begin(); it != byIterator.end(); drop = !drop) {
+        if(drop) {
+            it = byIterator.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+    report("it = erase(it)", doomed.size(), now() - start);
+}
+
+// Duplicating an index by re-inserting every item versus the structural copy
+// constructor, and handing it over by move
+static void benchCopy(size_t n)
+{
+    cout << "Copy and move (" << n << " random keys):" << endl;
+    vector<uint64_t> keys = randomKeys(n, 22);
+    typedef AVLTree<uint64_t, uint64_t> Tree;
+    Tree source;
+    for(size_t i = 0; i < n; ++i) {
+        source.insert(U64Pair(keys[i], i));
+    }
+
+    double start = now();
+    Tree reinserted;
+    for(Tree::iterator it = source.begin(); it != source.end(); ++it) {
+        reinserted.insert(*it);
+    }
+    report("re-insert every item", n, now() - start);
+
+    start = now();
+    Tree copied(source);
+    report("copy constructor", n, now() - start);
+
+    //passed along a ring of pipeline stages, so no move can be optimized out
+    const size_t moves = 1000000;
+    vector<Tree> stages(4);
+    stages[0] = std::move(copied);
+    start = now();
+    for(size_t i = 0; i < moves; ++i) {
+        stages[(i + 1) % stages.size()] = std::move(stages[i % stages.size()]);
+    }
+    report("move assignment", moves, now() - start);
+    if(stages[moves % stages.size()].empty() || reinserted.empty()) {
+        cout << "  (lost the items)" << endl;
+    }
+}
+
+// Restart cost: replaying every insert versus loading a snapshot, which is
+// read in order and built bottom-up without comparisons
+static void benchSnapshot(size_t n)
+{
+    cout << "Snapshots (" << n << " random keys, in memory):" << endl;
+    vector<uint64_t> keys = randomKeys(n, 23);
+    typedef AVLTree<uint64_t, uint64_t> Tree;
+
+    double start = now();
+    Tree replayed;
+    for(size_t i = 0; i < n; ++i) {
+        replayed.insert(U64Pair(keys[i], i));
+    }
+    report("replay inserts", n, now() - start);
+
+    stringstream snapshot;
+    start = now();
+    replayed.save(snapshot);
+    report("save", n, now() - start);
+
+    Tree loaded;
+    start = now();
+    loaded.load(snapshot);
+    report("load", n, now() - start);
+    cout << "  snapshot size " << snapshot.str().size() / n << " bytes per item" << endl;
+}
+
+// Random inserts through the write-ahead log at each durability level, then
+// a checkpoint and recovery. Syncing every change costs a disk flush each,
+// so that level only runs a slice of the keys.
+static void removeDurable(const string& dir)
+{
+    std::remove((dir + "/log").c_str());
+    std::remove((dir + "/checkpoint").c_str());
+    ::rmdir(dir.c_str());
+}
+
+static void benchDurable(size_t n)
+{
+    cout << "Durable map (" << n << " random keys):" << endl;
+    vector<uint64_t> keys = randomKeys(n, 24);
+    typedef DurableAVLTree<uint64_t, uint64_t> Durable;
+    const string dir = "/tmp/bst-bench-durable";
+    const char* names[] = { "insert, never synced", "insert, synced per 256", "insert, synced each" };
+    Durable::SyncPolicy policies[] = { Durable::SYNC_NEVER, Durable::SYNC_BATCH, Durable::SYNC_EVERY };
+
+    for(int level = 0; level < 3; ++level) {
+        removeDurable(dir);
+        size_t ops = policies[level] == Durable::SYNC_EVERY ? std::min<size_t>(n, 20000) : n;
+        Durable::Options options;
+        options.sync = policies[level];
+        options.checkpointRecords = 0;
+        double start = now();
+        {
+            Durable durable(dir, options);
+            for(size_t i = 0; i < ops; ++i) {
+                durable.insert(U64Pair(keys[i], i));
+            }
+            durable.commit();
+            report(names[level], ops, now() - start);
+            if(policies[level] != Durable::SYNC_BATCH) {
+                continue;
+            }
+        }
+        start = now();
+        {
+            Durable recovered(dir, options);
+            report("recover from the log", ops, now() - start);
+            start = now();
+            recovered.checkpoint();
+            report("checkpoint", ops, now() - start);
+        }
+        start = now();
+        Durable recovered(dir, options);
+        report("recover from a checkpoint", ops, now() - start);
+    }
+    removeDurable(dir);
+}
+
+// Startup cost of a saved index: loading a snapshot into heap nodes against
+// opening the mapped file, whose pages fault in as the first searches reach
+// them, followed by searches and in-place updates on the mapped tree.
+static void benchMapped(size_t n)
+{
+    cout << "Mapped AVL tree (" << n << " keys):" << endl;
+    vector<uint64_t> keys = randomKeys(n, 25);
+    vector<uint64_t> sortedKeys(keys);
+    std::sort(sortedKeys.begin(), sortedKeys.end());
+    vector<U64Pair> items;
+    for(size_t i = 0; i < n; ++i) {
+        items.push_back(U64Pair(sortedKeys[i], i));
+    }
+    typedef MappedAVLTree<uint64_t, uint64_t> Mapped;
+    const string snapshotPath = "/tmp/bst-bench-snapshot";
+    const string mappedPath = "/tmp/bst-bench-mapped";
+    std::remove(mappedPath.c_str());
+    {
+        AVLTree<uint64_t, uint64_t> tree(items.begin(), items.end());
+        tree.save(snapshotPath);
+        Mapped mapped(mappedPath);
+        mapped.assign(items.begin(), items.end());
+    }
+    const size_t probes = std::min<size_t>(n, 1000);
+
+    double start = now();
+    AVLTree<uint64_t, uint64_t> loaded;
+    loaded.load(snapshotPath);
+    report("load snapshot into the heap", n, now() - start);
+
+    start = now();
+    Mapped mapped(mappedPath, Mapped::READ_ONLY);
+    double openTime = now() - start;
+    uint64_t sum = 0;
+    for(size_t i = 0; i < probes; ++i) {
+        sum += mapped.find(keys[i])->second;
+    }
+    report("open mapped, first finds", probes, now() - start);
+    cout << "  (open alone " << std::fixed << std::setprecision(3) << openTime * 1000 << " ms)" << endl;
+
+    start = now();
+    for(size_t i = 0; i < n; ++i) {
+        sum += loaded.find(keys[i])->second;
+    }
+    report("find, heap", n, now() - start);
+    start = now();
+    for(size_t i = 0; i < n; ++i) {
+        sum += mapped.find(keys[i])->second;
+    }
+    report("find, mapped", n, now() - start);
+
+    {
+        Mapped writable(mappedPath);
+        mt19937_64 rng(26);
+        start = now();
+        for(size_t i = 0; i < n / 2; ++i) {
+            writable.remove(keys[i]);
+            writable.insert(U64Pair(rng(), i));
+        }
+        report("remove + insert in place", n, now() - start);
+    }
+    if(sum == 0) {
+        cout << "  (checksum " << sum << ")" << endl;
+    }
+    std::remove(snapshotPath.c_str());
+    std::remove(mappedPath.c_str());
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = 1000000;
+    if(argc > 1) {
+        n = strtoul(argv[1], NULL, 10);
+    }
+
+    benchAllocators(n);
+    benchNodeAccess(n);
+    benchBulkLoad(n);
+    benchUpsert(n);
+    benchStringKeys(n);
+    benchHinted(n);
+    benchRangeScan(n);
+    benchOrderStatistics(n);
+    benchRangeAggregate(n);
+    benchRangeErase(n);
+    benchSetOperations(n);
+    benchBatchInsert(n);
+    benchConcurrentAccess(n);
+    benchSnapshots(n);
+    benchFrozen(n);
+    benchBTree(n);
+    benchFindBatch(n);
+    benchIteration();
+    benchDegenerate(n);
+    benchEraseIterator(n);
+    benchCopy(n);
+    benchSnapshot(n);
+    benchDurable(n);
+    benchMapped(n);
+    return 0;
+}
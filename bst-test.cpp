@@ -1,7 +1,17 @@
 #include <iostream>
+#include <cstdio>
 #include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
 #include "bst.h"
 #include "avlbst.h"
+#include "ranked-avlbst.h"
+#include "frozen-map.h"
+#include "btree.h"
+#include "durable-avlbst.h"
+#include "mapped-avlbst.h"
 
 using namespace std;
 
@@ -44,5 +54,217 @@ int main(int argc, char *argv[])
     cout << "Erasing b" << endl;
     at.remove('b');
 
+    // Bulk load from a sorted range
+    vector<pair<char,int> > sorted;
+    for(char c = 'a'; c <= 'g'; ++c) {
+        sorted.push_back(std::make_pair(c, c - 'a'));
+    }
+    AVLTree<char,int> bulk(sorted.begin(), sorted.end());
+    cout << "\nBulk loaded AVLTree contents:" << endl;
+    for(AVLTree<char,int>::iterator it = bulk.begin(); it != bulk.end(); ++it) {
+        cout << it->first << " " << it->second << endl;
+    }
+    cout << "Balanced: " << bulk.isBalanced() << endl;
+
+    // Ordered queries
+    cout << "\nKeys in [c, f):";
+    for(AVLTree<char,int>::iterator it = bulk.range('c', 'f').begin(); it != bulk.range('c', 'f').end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+    bulk.remove('d');
+    cout << "floor(d) = " << bulk.floor('d')->first
+         << ", ceiling(d) = " << bulk.ceiling('d')->first
+         << ", upper_bound(e) = " << bulk.upper_bound('e')->first << endl;
+
+    // Bidirectional and reverse iteration
+    cout << "\nReversed:";
+    for(AVLTree<char,int>::reverse_iterator it = bulk.rbegin(); it != bulk.rend(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+    AVLTree<char,int>::iterator last = bulk.end();
+    --last;
+    cout << "Last key: " << last->first << ", before it: " << (--last)->first << endl;
+
+    // Several lookups at once
+    char wanted[] = { 'a', 'd', 'g' };
+    vector<AVLTree<char,int>::iterator> hits(3);
+    bulk.findBatch(wanted, wanted + 3, hits.begin());
+    cout << "findBatch(a, d, g):";
+    for(size_t i = 0; i < hits.size(); ++i) {
+        cout << " " << (hits[i] == bulk.end() ? string("missing") : to_string(hits[i]->second));
+    }
+    cout << endl;
+
+    // Read-only copy in Eytzinger order
+    FrozenMap<char,int> frozen(bulk);
+    cout << "\nFrozen contents:";
+    for(FrozenMap<char,int>::const_iterator it = frozen.begin(); it != frozen.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+    cout << "Frozen find(e) = " << frozen.find('e')->second
+         << ", lower_bound(d) = " << frozen.lower_bound('d')->first
+         << ", has d: " << (frozen.find('d') != frozen.end()) << endl;
+
+    // B-tree with four children per node, so a few keys already split it
+    BTree<char,int,std::less<char>,4> bp;
+    for(char c = 'a'; c <= 'j'; ++c) {
+        bp.insert(std::make_pair(c, c - 'a'));
+    }
+    bp.remove('c');
+    bp.remove('h');
+    cout << "\nBTree contents:";
+    for(BTree<char,int,std::less<char>,4>::iterator it = bp.begin(); it != bp.end(); ++it) {
+        cout << " " << it->first << "=" << it->second;
+    }
+    cout << endl;
+    cout << "BTree size " << bp.size() << ", bp['e'] = " << bp['e']
+         << ", has c: " << (bp.find('c') != bp.end()) << endl;
+
+    // Inserting through a base reference still creates AVL nodes and rebalances
+    AVLTree<char,int> viaBase;
+    BinarySearchTree<char,int>& base = viaBase;
+    for(char c = 'a'; c <= 'g'; ++c) {
+        base.try_emplace(c, c - 'a');
+    }
+    base.insert_or_assign('d', 30);
+    cout << "\nInserted through the base: d = " << viaBase['d']
+         << ", balanced: " << viaBase.isBalanced() << endl;
+    RankedAVLTree<char,int> ranked;
+    BinarySearchTree<char,int>& rankedBase = ranked;
+    for(char c = 'a'; c <= 'g'; ++c) {
+        rankedBase.insert(rankedBase.end(), std::make_pair(c, c - 'a'));
+    }
+    rankedBase.insert(rankedBase.find('c'), std::make_pair('c', 20));
+    cout << "Hinted through the base: size " << ranked.size() << ", rank(e) = " << ranked.rank('e')
+         << ", c = " << ranked['c'] << ", balanced: " << ranked.isBalanced() << endl;
+
+    // Erasing while iterating: erase() hands back the next item
+    AVLTree<char,int> letters(sorted.begin(), sorted.end());
+    for(AVLTree<char,int>::iterator it = letters.begin(); it != letters.end(); ) {
+        if(it->second % 2 == 0) {
+            it = letters.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+    cout << "\nOdd values left:";
+    for(AVLTree<char,int>::iterator it = letters.begin(); it != letters.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << ", balanced: " << letters.isBalanced() << endl;
+
+    // Copies are independent of the original; moves leave it empty
+    AVLTree<char,int> copied(bulk);
+    copied.remove('a');
+    AVLTree<char,int> moved(std::move(copied));
+    cout << "\nCopy without a: " << moved.begin()->first << " .. " << (--moved.end())->first
+         << ", original still has a: " << (bulk.find('a') != bulk.end())
+         << ", moved-from empty: " << copied.empty() << endl;
+    moved.swap(copied);
+    cout << "After swap, moved empty: " << moved.empty() << ", copied balanced: " << copied.isBalanced() << endl;
+
+    // Snapshot round trip through memory
+    stringstream snapshot;
+    bulk.save(snapshot);
+    AVLTree<char,int> reloaded;
+    reloaded.load(snapshot);
+    cout << "\nReloaded from " << snapshot.str().size() << " snapshot bytes:";
+    for(AVLTree<char,int>::iterator it = reloaded.begin(); it != reloaded.end(); ++it) {
+        cout << " " << it->first << "=" << it->second;
+    }
+    cout << ", balanced: " << reloaded.isBalanced() << endl;
+    string damaged = snapshot.str();
+    damaged[damaged.size() / 2] ^= 1;
+    stringstream damagedStream(damaged);
+    try {
+        reloaded.load(damagedStream);
+    }
+    catch(const SnapshotError& e) {
+        cout << "Loading a damaged copy: " << e.what() << endl;
+    }
+
+    // A durable map comes back from its log, and after a checkpoint from that
+    {
+        const string dir = "/tmp/bst-test-durable";
+        std::remove((dir + "/log").c_str());
+        std::remove((dir + "/checkpoint").c_str());
+        {
+            DurableAVLTree<char,int> durable(dir);
+            for(char c = 'a'; c <= 'e'; ++c) {
+                durable.insert(std::make_pair(c, c - 'a'));
+            }
+            durable.remove('b');
+        }
+        DurableAVLTree<char,int> reopened(dir);
+        cout << "\nRecovered from the log (" << reopened.logRecords() << " records):";
+        for(DurableAVLTree<char,int>::iterator it = reopened.begin(); it != reopened.end(); ++it) {
+            cout << " " << it->first << "=" << it->second;
+        }
+        cout << endl;
+        reopened.insert(std::make_pair('z', 25));
+        reopened.checkpoint();
+        reopened.remove('a');
+        reopened.commit();
+        DurableAVLTree<char,int> again(dir);
+        cout << "After a checkpoint (" << again.logRecords() << " record since):";
+        for(DurableAVLTree<char,int>::iterator it = again.begin(); it != again.end(); ++it) {
+            cout << " " << it->first << "=" << it->second;
+        }
+        cout << endl;
+    }
+    {
+        // A checkpoint that exists but cannot be opened must not read as missing;
+        // a symlink to itself fails with ELOOP, even for root
+        const string dir = "/tmp/bst-test-durable";
+        const string checkpoint = dir + "/checkpoint";
+        const string saved = dir + "/checkpoint.saved";
+        std::rename(checkpoint.c_str(), saved.c_str());
+        if(symlink("checkpoint", checkpoint.c_str()) == 0) {
+            try {
+                DurableAVLTree<char,int> unreadable(dir);
+                cout << "Opened with an unreadable checkpoint" << endl;
+            }
+            catch(const std::system_error&) {
+                cout << "Refused to open with an unreadable checkpoint" << endl;
+            }
+            std::remove(checkpoint.c_str());
+        }
+        std::rename(saved.c_str(), checkpoint.c_str());
+        DurableAVLTree<char,int> restored(dir);
+        cout << "Checkpoint restored, has z: " << (restored.find('z') != restored.end()) << endl;
+    }
+
+    // A mapped tree is updated in place and opened again without loading
+    {
+        const string path = "/tmp/bst-test-mapped";
+        std::remove(path.c_str());
+        {
+            MappedAVLTree<char,int> mapped(path);
+            mapped.assign(sorted.begin(), sorted.end());
+            mapped.remove('c');
+            mapped.insert(std::make_pair('z', 25));
+        }
+        MappedAVLTree<char,int> reopened(path, MappedAVLTree<char,int>::READ_ONLY);
+        cout << "\nMapped tree of " << reopened.size() << " items:";
+        for(MappedAVLTree<char,int>::iterator it = reopened.begin(); it != reopened.end(); ++it) {
+            cout << " " << it->first << "=" << it->second;
+        }
+        cout << ", balanced: " << reopened.isBalanced() << endl;
+    }
+
+    // Sorted inserts into a plain BST make a chain a million nodes long,
+    // which must be checked and destroyed without running out of stack
+    {
+        BinarySearchTree<int,int> chain;
+        for(int i = 0; i < 1000000; ++i) {
+            chain.insert(chain.end(), std::make_pair(i, i));
+        }
+        cout << "\nChain of " << 1000000 << " nodes, balanced: " << chain.isBalanced() << endl;
+    }
+
     return 0;
 }
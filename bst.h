@@ -2,23 +2,47 @@
 #define BST_H
 
 #include <iostream>
+#include <fstream>
 #include <exception>
 #include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <functional>
+#include <string>
 #include <utility>
+#include <tuple>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include "arena-allocator.h"
+#include "tree-snapshot.h"
+
+// Define BST_THREADED to give every node links to its in-order predecessor and
+// successor. The trees keep them current through inserts, removes, nodeSwap and
+// the AVL split/join family (rotations never change the order), so iterators
+// step in O(1) worst case instead of climbing parent links, at the cost of two
+// more pointers per node.
 
 /**
  * A templated class for a Node in a search tree.
- * The getters for parent/left/right are virtual so
- * that they can be overridden for future kinds of
- * search trees, such as Red Black trees, Splay trees,
- * and AVL trees.
+ * The getters for parent/left/right are deliberately not
+ * virtual: derived node types (such as AVLNode) redeclare
+ * them to return their own type, so the node type is fixed
+ * at compile time by the static type the tree works with.
+ * This keeps traversal inlinable and keeps a vtable pointer
+ * out of every node. Nodes are never deleted through a base
+ * pointer; trees destroy them as their real type (see
+ * BinarySearchTree::destroyNode).
  */
 template <typename Key, typename Value>
 class Node
 {
 public:
     Node(const Key& key, const Value& value, Node<Key, Value>* parent);
-    virtual ~Node();
+    template<typename KeyArg, typename... ValueArgs>
+    Node(std::piecewise_construct_t, Node<Key, Value>* parent, KeyArg&& key, ValueArgs&&... valueArgs);
+    ~Node();
 
     const std::pair<const Key, Value>& getItem() const;
     std::pair<const Key, Value>& getItem();
@@ -26,20 +50,38 @@ public:
     const Value& getValue() const;
     Value& getValue();
 
-    virtual Node<Key, Value>* getParent() const;
-    virtual Node<Key, Value>* getLeft() const;
-    virtual Node<Key, Value>* getRight() const;
+    Node<Key, Value>* getParent() const;
+    Node<Key, Value>* getLeft() const;
+    Node<Key, Value>* getRight() const;
 
     void setParent(Node<Key, Value>* parent);
     void setLeft(Node<Key, Value>* left);
     void setRight(Node<Key, Value>* right);
     void setValue(const Value &value);
 
+#ifdef BST_THREADED
+    Node<Key, Value>* getPrev() const;
+    Node<Key, Value>* getNext() const;
+    void setPrev(Node<Key, Value>* prev);
+    void setNext(Node<Key, Value>* next);
+#endif
+
 protected:
+    // A node is always at least 8-byte aligned on 64-bit targets, so the low bits
+    // of the parent link are free. Derived nodes may keep a few bits of their own
+    // state there instead of growing the node (see AVLNode).
+    static const uintptr_t PARENT_TAG_MASK = 7;
+    uintptr_t getParentTag() const;
+    void setParentTag(uintptr_t tag);
+
     std::pair<const Key, Value> item_;
-    Node<Key, Value>* parent_;
+    uintptr_t parentLink_;
     Node<Key, Value>* left_;
     Node<Key, Value>* right_;
+#ifdef BST_THREADED
+    Node<Key, Value>* prev_;
+    Node<Key, Value>* next_;
+#endif
 };
 
 /*
@@ -54,9 +96,35 @@ protected:
 template<typename Key, typename Value>
 Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* parent) :
     item_(key, value),
-    parent_(parent),
+    parentLink_(reinterpret_cast<uintptr_t>(parent)),
+    left_(NULL),
+    right_(NULL)
+#ifdef BST_THREADED
+    , prev_(NULL),
+    next_(NULL)
+#endif
+{
+
+}
+
+/**
+* Constructs the key from key and the value in place from valueArgs, so
+* neither has to be copied into the node.
+*/
+template<typename Key, typename Value>
+template<typename KeyArg, typename... ValueArgs>
+Node<Key, Value>::Node(std::piecewise_construct_t, Node<Key, Value>* parent,
+                       KeyArg&& key, ValueArgs&&... valueArgs) :
+    item_(std::piecewise_construct,
+          std::forward_as_tuple(std::forward<KeyArg>(key)),
+          std::forward_as_tuple(std::forward<ValueArgs>(valueArgs)...)),
+    parentLink_(reinterpret_cast<uintptr_t>(parent)),
     left_(NULL),
     right_(NULL)
+#ifdef BST_THREADED
+    , prev_(NULL),
+    next_(NULL)
+#endif
 {
 
 }
@@ -118,16 +186,16 @@ Value& Node<Key, Value>::getValue()
 }
 
 /**
-* An implementation of the virtual function for retreiving the parent.
+* A getter for the parent.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getParent() const
 {
-    return parent_;
+    return reinterpret_cast<Node<Key, Value>*>(parentLink_ & ~PARENT_TAG_MASK);
 }
 
 /**
-* An implementation of the virtual function for retreiving the left child.
+* A getter for the left child.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getLeft() const
@@ -136,7 +204,7 @@ Node<Key, Value>* Node<Key, Value>::getLeft() const
 }
 
 /**
-* An implementation of the virtual function for retreiving the right child.
+* A getter for the right child.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getRight() const
@@ -145,12 +213,12 @@ Node<Key, Value>* Node<Key, Value>::getRight() const
 }
 
 /**
-* A setter for setting the parent of a node.
+* A setter for setting the parent of a node. Any tag bits stay with the node.
 */
 template<typename Key, typename Value>
 void Node<Key, Value>::setParent(Node<Key, Value>* parent)
 {
-    parent_ = parent;
+    parentLink_ = reinterpret_cast<uintptr_t>(parent) | (parentLink_ & PARENT_TAG_MASK);
 }
 
 /**
@@ -171,6 +239,56 @@ void Node<Key, Value>::setRight(Node<Key, Value>* right)
     right_ = right;
 }
 
+#ifdef BST_THREADED
+/**
+* A getter for the node just before this one in key order, NULL for the first.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>* Node<Key, Value>::getPrev() const
+{
+    return prev_;
+}
+
+/**
+* A getter for the node just after this one in key order, NULL for the last.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>* Node<Key, Value>::getNext() const
+{
+    return next_;
+}
+
+template<typename Key, typename Value>
+void Node<Key, Value>::setPrev(Node<Key, Value>* prev)
+{
+    prev_ = prev;
+}
+
+template<typename Key, typename Value>
+void Node<Key, Value>::setNext(Node<Key, Value>* next)
+{
+    next_ = next;
+}
+#endif
+
+/**
+* A getter for the spare bits stored alongside the parent link.
+*/
+template<typename Key, typename Value>
+uintptr_t Node<Key, Value>::getParentTag() const
+{
+    return parentLink_ & PARENT_TAG_MASK;
+}
+
+/**
+* A setter for the spare bits stored alongside the parent link.
+*/
+template<typename Key, typename Value>
+void Node<Key, Value>::setParentTag(uintptr_t tag)
+{
+    parentLink_ = (parentLink_ & ~PARENT_TAG_MASK) | (tag & PARENT_TAG_MASK);
+}
+
 /**
 * A setter for the value of a node.
 */
@@ -186,22 +304,120 @@ void Node<Key, Value>::setValue(const Value& value)
   ---------------------------------------
 */
 
+/*
+  -------------------------------------------------------
+  Three-way key comparison used by the tree search loops.
+  -------------------------------------------------------
+*/
+
+/**
+* Detects a comparator member int compare(a, b) returning <0, 0 or >0.
+*/
+template<typename Compare, typename A, typename B>
+struct has_three_way_compare
+{
+    template<typename C>
+    static auto test(int) -> decltype(std::declval<const C&>().compare(std::declval<const A&>(),
+                                                                       std::declval<const B&>()),
+                                      std::true_type());
+    template<typename C>
+    static std::false_type test(...);
+
+    static const bool value = decltype(test<Compare>(0))::value;
+};
+
+template<typename Compare, typename A, typename B>
+int threeWayCompare(const Compare& comp, const A& a, const B& b, std::true_type)
+{
+    return comp.compare(a, b);
+}
+
+template<typename Compare, typename A, typename B>
+int threeWayCompare(const Compare& comp, const A& a, const B& b, std::false_type)
+{
+    return comp(a, b) ? -1 : (comp(b, a) ? 1 : 0);
+}
+
+/**
+* Orders a against b with a single call when the comparator can: either it has
+* a compare(a, b) member, or it is std::less over strings (basic_string::compare).
+* Any other strict weak ordering falls back to at most two predicate calls.
+*/
+template<typename Compare, typename A, typename B>
+int threeWayCompare(const Compare& comp, const A& a, const B& b)
+{
+    return threeWayCompare(comp, a, b,
+        std::integral_constant<bool, has_three_way_compare<Compare, A, B>::value>());
+}
+
+template<typename CharT, typename Traits, typename StrAlloc>
+int threeWayCompare(const std::less<std::basic_string<CharT, Traits, StrAlloc> >&,
+                    const std::basic_string<CharT, Traits, StrAlloc>& a,
+                    const std::basic_string<CharT, Traits, StrAlloc>& b)
+{
+    return a.compare(b);
+}
+
+/**
+* Hints that the cache line holding address is about to be read. A no-op on
+* compilers without __builtin_prefetch.
+*/
+inline void prefetchRead(const void* address)
+{
+#if defined(__GNUC__)
+    __builtin_prefetch(address);
+#else
+    (void)address;
+#endif
+}
+
 /**
 * A templated unbalanced binary search tree.
+* Keys are ordered by Compare, a strict weak ordering like std::less. A
+* comparator that also provides int compare(a, b) is used for one three-way
+* comparison per level. If Compare defines is_transparent, find() also accepts
+* any type the comparator can compare against Key, so lookups need not build a
+* temporary Key.
+* Nodes are obtained through Alloc (rebound to the node type), so passing an
+* ArenaAllocator carves them out of contiguous chunks and lets clear() drop
+* the whole arena at once.
 */
-template <typename Key, typename Value>
+template <typename Key, typename Value,
+          typename Compare = std::less<Key>,
+          typename Alloc = std::allocator<std::pair<const Key, Value> > >
 class BinarySearchTree
 {
 public:
     BinarySearchTree(); //TODO
+    explicit BinarySearchTree(const Compare& comp, const Alloc& alloc = Alloc());
+    explicit BinarySearchTree(const Alloc& alloc);
+    template<typename ForwardIt>
+    BinarySearchTree(ForwardIt first, ForwardIt last,
+                     const Compare& comp = Compare(), const Alloc& alloc = Alloc());
+    // Copies clone the shape in O(n) without comparing keys; moves and swap
+    // are O(1) and only hand over the root
+    BinarySearchTree(const BinarySearchTree& other);
+    BinarySearchTree(BinarySearchTree&& other);
+    BinarySearchTree& operator=(const BinarySearchTree& other);
+    BinarySearchTree& operator=(BinarySearchTree&& other);
+    void swap(BinarySearchTree& other);
     virtual ~BinarySearchTree(); //TODO
     virtual void insert(const std::pair<const Key, Value>& keyValuePair); //TODO
     virtual void remove(const Key& key); //TODO
+    template<typename ForwardIt>
+    void assign(ForwardIt first, ForwardIt last, bool checkSorted = true);
     void clear(); //TODO
     bool isBalanced() const; //TODO
     void print() const;
     bool empty() const;
 
+    // Binary snapshots in the format described in tree-snapshot.h. load()
+    // replaces the contents and builds a balanced tree in O(n).
+    void save(std::ostream& out) const;
+    void save(const std::string& path) const;
+    void load(std::istream& in);
+    void load(const std::string& path);
+
     template<typename PPKey, typename PPValue>
     friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue> & tree);
 public:
@@ -211,6 +427,12 @@ public:
     class iterator  // TODO
     {
     public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef value_type* pointer;
+        typedef value_type& reference;
+
         iterator();
 
         std::pair<const Key,Value>& operator*() const;
@@ -220,25 +442,102 @@ public:
         bool operator!=(const iterator& rhs) const;
 
         iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
 
     protected:
-        friend class BinarySearchTree<Key, Value>;
-        iterator(Node<Key,Value>* ptr);
+        friend class BinarySearchTree<Key, Value, Compare, Alloc>;
+        iterator(Node<Key,Value>* ptr, const BinarySearchTree* tree);
         Node<Key, Value> *current_;
+        // Only needed so that --end() can find the largest node
+        const BinarySearchTree* tree_;
+    };
+
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+
+    /**
+    * The keys in [lo, hi) as an iterable pair of iterators, so
+    * for(auto& item : tree.range(lo, hi)) visits only the matching items.
+    */
+    class range_view
+    {
+    public:
+        range_view(iterator first, iterator last);
+
+        iterator begin() const;
+        iterator end() const;
+        bool empty() const;
+
+    private:
+        iterator first_;
+        iterator last_;
     };
 
 public:
     iterator begin() const;
     iterator end() const;
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
+    Compare key_comp() const;
     iterator find(const Key& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator find(const K& key) const;
+    iterator find(iterator hint, const Key& key) const;
+    // Writes find(key) for each key in [first, last) to out, running several
+    // searches side by side so their cache misses overlap
+    template<typename ForwardIt, typename OutputIt>
+    OutputIt findBatch(ForwardIt first, ForwardIt last, OutputIt out) const;
+
+    // Ordered queries, each one O(height) descent. end() stands for "no such key".
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    std::pair<iterator, iterator> equal_range(const Key& key) const;
+    iterator floor(const Key& key) const;
+    iterator ceiling(const Key& key) const;
+    range_view range(const Key& lo, const Key& hi) const;
     Value& operator[](const Key& key);
     Value const & operator[](const Key& key) const;
 
+    // Single-traversal insertion. Each returns the item's position and whether
+    // it was inserted, and allocates a node only when the key is new.
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(const Key& key, M&& obj);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(Key&& key, M&& obj);
+
+    // Hinted insertion: the search starts from hint instead of the root (see
+    // fingerStart), and appending past the largest key with hint == end() is O(1)
+    // before rebalancing.
+    iterator insert(iterator hint, const std::pair<const Key, Value>& keyValuePair);
+
 protected:
     // Mandatory helper functions
     Node<Key, Value>* internalFind(const Key& k) const; // TODO
+    template<typename K>
+    Node<Key, Value>* findNode(const K& key, Node<Key, Value>* start) const;
+    template<typename K>
+    Node<Key, Value>* fingerStart(Node<Key, Value>* hint, const K& key) const;
+    Node<Key, Value>* hintStart(iterator hint, const Key& key) const;
+    Node<Key, Value>* getLargestNode() const;
+    // Lets derived trees, which the iterator does not befriend, hand out iterators
+    iterator makeIterator(Node<Key, Value>* node) const;
+    static Node<Key, Value>* iteratorNode(iterator it);
+    template<typename K>
+    Node<Key, Value>* lowerBoundNode(const K& key) const;
+    template<typename K>
+    Node<Key, Value>* upperBoundNode(const K& key) const;
+    template<typename K>
+    Node<Key, Value>* floorNode(const K& key) const;
     Node<Key, Value> *getSmallestNode() const;  // TODO
     static Node<Key, Value>* predecessor(Node<Key, Value>* current); // TODO
+    static Node<Key, Value>* successor(Node<Key, Value>* current);
     // Note:  static means these functions don't have a "this" pointer
     //        and instead just use the input argument.
 
@@ -248,12 +547,63 @@ protected:
 
     // Add helper functions here
     void clearHelper(Node<Key,Value>* node);
+    void clearNodes(std::true_type releaseArena);
+    void clearNodes(std::false_type releaseArena);
     int getHeight(Node<Key,Value>* node) const;
+    void measureSubtree(Node<Key,Value>* node, std::size_t& size, int& height) const;
+    int checkedHeight(Node<Key,Value>* node) const;
+    static int maxBalancedHeight(std::size_t n);
+
+    // Node allocation goes through the tree so derived trees can allocate their own node type
+    template<typename NodeT, typename NodeAllocT, typename... Args>
+    static NodeT* constructNode(NodeAllocT& alloc, Args&&... args);
+    Node<Key, Value>* createNode(const Key& key, const Value& value, Node<Key, Value>* parent);
+    virtual Node<Key, Value>* createBuildNode(const std::pair<const Key, Value>& item,
+                                              int leftHeight, int rightHeight);
+    virtual void destroyNode(Node<Key, Value>* node);
+
+    // Insertion helpers shared by BinarySearchTree and derived trees
+    Node<Key, Value>* findSlot(const Key& key, Node<Key, Value>* start,
+                               Node<Key, Value>*& parent, bool& asLeft) const;
+    template<typename KeyArg, typename... Args>
+    std::pair<iterator, bool> emplaceUnique(Node<Key, Value>* start, KeyArg&& key, Args&&... args);
+    // Creates the node for an item that emplaceUnique() is about to link in.
+    // Virtual, unlike the templates that call it, so inserting through a base
+    // reference still creates the derived tree's node type.
+    virtual Node<Key, Value>* createInsertNode(Node<Key, Value>* parent, Key&& key, Value&& value);
+    // Called after an insert overwrites the value of an existing item
+    virtual void valueAssigned(Node<Key, Value>* node);
+    virtual void linkNewNode(Node<Key, Value>* node, Node<Key, Value>* parent, bool asLeft);
+    // Called whenever node's children change shape, so trees that cache a summary
+    // of each subtree in the node (see RankedAVLTree) can recompute it
+    virtual void pullUp(Node<Key, Value>* node);
+
+    // In-order threading (see BST_THREADED); without it these do nothing
+    static void threadLink(Node<Key, Value>* before, Node<Key, Value>* after);
+    static void threadJoin(Node<Key, Value>* left, Node<Key, Value>* mid, Node<Key, Value>* right);
+    static void threadSwap(Node<Key, Value>* n1, Node<Key, Value>* n2);
+    void threadEnds();
+
+    // Copying and moving helpers
+    Alloc copyAllocator() const;
+    void cloneFrom(const BinarySearchTree& other);
+    virtual Node<Key, Value>* cloneNode(const Node<Key, Value>* source);
+
+    // Bulk loading helpers
+    template<typename ForwardIt>
+    Node<Key, Value>* buildSubtree(ForwardIt& it, std::size_t n, int& height);
+    static int balancedHeight(std::size_t n);
+
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<Node<Key, Value> > NodeAlloc;
+    typedef std::allocator_traits<NodeAlloc> NodeAllocTraits;
 
 
 protected:
     Node<Key, Value>* root_;
-    // You should not need other data members
+    // The node with the largest key, kept so appends need not walk the right spine
+    Node<Key, Value>* rightmost_;
+    NodeAlloc nodeAlloc_;
+    Compare comp_;
 };
 
 /*
@@ -265,9 +615,9 @@ Begin implementations for the BinarySearchTree::iterator class.
 /**
 * Explicit constructor that initializes an iterator with a given node pointer.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr)
-  : current_(ptr)
+template<class Key, class Value, class Compare, class Alloc>
+BinarySearchTree<Key, Value, Compare, Alloc>::iterator::iterator(Node<Key,Value> *ptr, const BinarySearchTree* tree)
+  : current_(ptr), tree_(tree)
 {
   //constructor with apointer needs to set current to that pointer
     // TODO
@@ -276,9 +626,9 @@ BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr)
 /**
 * A default constructor that initializes the iterator to NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator() 
-  : current_(nullptr)
+template<class Key, class Value, class Compare, class Alloc>
+BinarySearchTree<Key, Value, Compare, Alloc>::iterator::iterator() 
+  : current_(nullptr), tree_(nullptr)
 {
   //default constructor set the current to null
     // TODO
@@ -288,9 +638,9 @@ BinarySearchTree<Key, Value>::iterator::iterator()
 /**
 * Provides access to the item.
 */
-template<class Key, class Value>
+template<class Key, class Value, class Compare, class Alloc>
 std::pair<const Key,Value> &
-BinarySearchTree<Key, Value>::iterator::operator*() const
+BinarySearchTree<Key, Value, Compare, Alloc>::iterator::operator*() const
 {
     return current_->getItem();
 }
@@ -298,9 +648,9 @@ BinarySearchTree<Key, Value>::iterator::operator*() const
 /**
 * Provides access to the address of the item.
 */
-template<class Key, class Value>
+template<class Key, class Value, class Compare, class Alloc>
 std::pair<const Key,Value> *
-BinarySearchTree<Key, Value>::iterator::operator->() const
+BinarySearchTree<Key, Value, Compare, Alloc>::iterator::operator->() const
 {
     return &(current_->getItem());
 }
@@ -309,10 +659,10 @@ BinarySearchTree<Key, Value>::iterator::operator->() const
 * Checks if 'this' iterator's internals have the same value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class Compare, class Alloc>
 bool
-BinarySearchTree<Key, Value>::iterator::operator==(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Compare, Alloc>::iterator::operator==(
+    const BinarySearchTree<Key, Value, Compare, Alloc>::iterator& rhs) const
 {
     // TODO
     //returns if noth are equal but just returning true or false when comparing
@@ -323,10 +673,10 @@ BinarySearchTree<Key, Value>::iterator::operator==(
 * Checks if 'this' iterator's internals have a different value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class Compare, class Alloc>
 bool
-BinarySearchTree<Key, Value>::iterator::operator!=(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Compare, Alloc>::iterator::operator!=(
+    const BinarySearchTree<Key, Value, Compare, Alloc>::iterator& rhs) const
 {
     // TODO
     //returns if not equal, false if equal
@@ -338,9 +688,9 @@ BinarySearchTree<Key, Value>::iterator::operator!=(
 /**
 * Advances the iterator's location using an in-order sequencing
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator&
-BinarySearchTree<Key, Value>::iterator::operator++()
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator&
+BinarySearchTree<Key, Value, Compare, Alloc>::iterator::operator++()
 {
     // TODO
     if(current_ == nullptr){
@@ -348,30 +698,45 @@ BinarySearchTree<Key, Value>::iterator::operator++()
       //the end() stays at the nullptr
       return *this;
     }
-    //case where the current node has a right child
-    if(current_->getRight() != nullptr){
-      //move one step to the right child 
-      current_ = current_->getRight();
-      //keep going left until you reach the end
-      while(current_->getLeft() != nullptr){
-        current_ = current_->getLeft();
-      }
+    current_ = successor(current_);
+  //return the updated iterator 
+  return *this;
+
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc>::iterator::operator++(int)
+{
+    iterator old = *this;
+    ++(*this);
+    return old;
+}
+
+/**
+* Steps back to the previous item in order. Decrementing end() gives the
+* largest item; decrementing begin() is undefined, as for std::map.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator&
+BinarySearchTree<Key, Value, Compare, Alloc>::iterator::operator--()
+{
+    if(current_ == nullptr){
+      current_ = tree_->rightmost_;
     }
-    //case where there's no right child and you go up until you find a parent
     else{
-      Node<Key, Value>* parent = current_->getParent();
-      //keep going up 
-      while(parent != nullptr && current_ == parent->getRight()){
-        current_ = parent;
-        parent = parent->getParent();
-    
-      }
-      //after the loop, either we reached the root or we got the left child
-      current_ = parent;
+      current_ = predecessor(current_);
     }
-  //return the updated iterator 
-  return *this;
+    return *this;
+}
 
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc>::iterator::operator--(int)
+{
+    iterator old = *this;
+    --(*this);
+    return old;
 }
 
 
@@ -381,6 +746,33 @@ End implementations for the BinarySearchTree::iterator class.
 -------------------------------------------------------------
 */
 
+template<class Key, class Value, class Compare, class Alloc>
+BinarySearchTree<Key, Value, Compare, Alloc>::range_view::range_view(iterator first, iterator last)
+  : first_(first), last_(last)
+{
+
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc>::range_view::begin() const
+{
+    return first_;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc>::range_view::end() const
+{
+    return last_;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+bool BinarySearchTree<Key, Value, Compare, Alloc>::range_view::empty() const
+{
+    return first_ == last_;
+}
+
 /*
 -----------------------------------------------------
 Begin implementations for the BinarySearchTree class.
@@ -390,16 +782,110 @@ Begin implementations for the BinarySearchTree class.
 /**
 * Default constructor for a BinarySearchTree, which sets the root to NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::BinarySearchTree() 
-  : root_(nullptr)
+template<class Key, class Value, class Compare, class Alloc>
+BinarySearchTree<Key, Value, Compare, Alloc>::BinarySearchTree() 
+  : root_(nullptr), rightmost_(nullptr), nodeAlloc_(Alloc()), comp_()
 {
   //start with an empty tree so root is null
     // TODO
 }
 
-template<typename Key, typename Value>
-BinarySearchTree<Key, Value>::~BinarySearchTree()
+/**
+* Constructs an empty tree ordered by comp.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+BinarySearchTree<Key, Value, Compare, Alloc>::BinarySearchTree(const Compare& comp, const Alloc& alloc)
+  : root_(nullptr), rightmost_(nullptr), nodeAlloc_(alloc), comp_(comp)
+{
+
+}
+
+/**
+* Constructs an empty tree whose nodes come from the given allocator.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+BinarySearchTree<Key, Value, Compare, Alloc>::BinarySearchTree(const Alloc& alloc)
+  : root_(nullptr), rightmost_(nullptr), nodeAlloc_(alloc), comp_()
+{
+
+}
+
+/**
+* Builds a balanced tree from a range sorted by key. See assign().
+*/
+template<class Key, class Value, class Compare, class Alloc>
+template<typename ForwardIt>
+BinarySearchTree<Key, Value, Compare, Alloc>::BinarySearchTree(ForwardIt first, ForwardIt last,
+                                                       const Compare& comp, const Alloc& alloc)
+  : root_(nullptr), rightmost_(nullptr), nodeAlloc_(alloc), comp_(comp)
+{
+    assign(first, last);
+}
+
+/**
+* Copies other's items, shape and comparator. The nodes come from a fresh
+* allocator (see select_on_container_copy_construction), so an arena is
+* never shared between two trees.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+BinarySearchTree<Key, Value, Compare, Alloc>::BinarySearchTree(const BinarySearchTree& other)
+  : root_(nullptr), rightmost_(nullptr), nodeAlloc_(other.copyAllocator()), comp_(other.comp_)
+{
+    cloneFrom(other);
+}
+
+/**
+* Takes over other's nodes and allocator in O(1). other is left empty, with
+* a fresh allocator of its own, so clearing it cannot release an arena
+* these nodes still live in.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+BinarySearchTree<Key, Value, Compare, Alloc>::BinarySearchTree(BinarySearchTree&& other)
+  : root_(other.root_), rightmost_(other.rightmost_), nodeAlloc_(other.nodeAlloc_), comp_(other.comp_)
+{
+    other.root_ = nullptr;
+    other.rightmost_ = nullptr;
+    other.nodeAlloc_ = NodeAlloc(other.copyAllocator());
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+BinarySearchTree<Key, Value, Compare, Alloc>&
+BinarySearchTree<Key, Value, Compare, Alloc>::operator=(const BinarySearchTree& other)
+{
+    if(this != &other) {
+        BinarySearchTree copy(other);
+        swap(copy);
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+BinarySearchTree<Key, Value, Compare, Alloc>&
+BinarySearchTree<Key, Value, Compare, Alloc>::operator=(BinarySearchTree&& other)
+{
+    if(this != &other) {
+        BinarySearchTree moved(std::move(other));
+        swap(moved);
+    }
+    return *this;
+}
+
+/**
+* Exchanges the contents, comparators and allocators of the two trees in
+* O(1). Derived trees hide this with a version that also swaps their own
+* allocators, so both trees must have the same type.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::swap(BinarySearchTree& other)
+{
+    std::swap(root_, other.root_);
+    std::swap(rightmost_, other.rightmost_);
+    std::swap(nodeAlloc_, other.nodeAlloc_);
+    std::swap(comp_, other.comp_);
+}
+
+template<typename Key, typename Value, typename Compare, typename Alloc>
+BinarySearchTree<Key, Value, Compare, Alloc>::~BinarySearchTree()
 {
     // TODO
     //destructor needs to delete all the nodes so we call the clear function
@@ -410,14 +896,14 @@ BinarySearchTree<Key, Value>::~BinarySearchTree()
 /**
  * Returns true if tree is empty
 */
-template<class Key, class Value>
-bool BinarySearchTree<Key, Value>::empty() const
+template<class Key, class Value, class Compare, class Alloc>
+bool BinarySearchTree<Key, Value, Compare, Alloc>::empty() const
 {
     return root_ == NULL;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::print() const
+template<typename Key, typename Value, typename Compare, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::print() const
 {
     printRoot(root_);
     std::cout << "\n";
@@ -426,51 +912,89 @@ void BinarySearchTree<Key, Value>::print() const
 /**
 * Returns an iterator to the "smallest" item in the tree
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::begin() const
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc>::begin() const
 {
-    BinarySearchTree<Key, Value>::iterator begin(getSmallestNode());
+    BinarySearchTree<Key, Value, Compare, Alloc>::iterator begin(getSmallestNode(), this);
     return begin;
 }
 
 /**
 * Returns an iterator whose value means INVALID
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::end() const
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc>::end() const
 {
-    BinarySearchTree<Key, Value>::iterator end(NULL);
+    BinarySearchTree<Key, Value, Compare, Alloc>::iterator end(NULL, this);
     return end;
 }
 
+/**
+* Returns a reverse iterator to the "largest" item in the tree
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::reverse_iterator
+BinarySearchTree<Key, Value, Compare, Alloc>::rbegin() const
+{
+    return reverse_iterator(end());
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::reverse_iterator
+BinarySearchTree<Key, Value, Compare, Alloc>::rend() const
+{
+    return reverse_iterator(begin());
+}
+
+/**
+* Returns a copy of the comparator that orders the keys
+*/
+template<class Key, class Value, class Compare, class Alloc>
+Compare BinarySearchTree<Key, Value, Compare, Alloc>::key_comp() const
+{
+    return comp_;
+}
+
 /**
 * Returns an iterator to the item with the given key, k
 * or the end iterator if k does not exist in the tree
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::find(const Key & k) const
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc>::find(const Key & k) const
 {
     Node<Key, Value> *curr = internalFind(k);
-    BinarySearchTree<Key, Value>::iterator it(curr);
+    BinarySearchTree<Key, Value, Compare, Alloc>::iterator it(curr, this);
     return it;
 }
 
+/**
+* Heterogeneous lookup, only available with a transparent comparator:
+* k may be any type Compare can order against Key.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc>::find(const K & k) const
+{
+    return iterator(findNode(k, root_), this);
+}
+
 /**
  * @precondition The key exists in the map
  * Returns the value associated with the key
  */
-template<class Key, class Value>
-Value& BinarySearchTree<Key, Value>::operator[](const Key& key)
+template<class Key, class Value, class Compare, class Alloc>
+Value& BinarySearchTree<Key, Value, Compare, Alloc>::operator[](const Key& key)
 {
     Node<Key, Value> *curr = internalFind(key);
     if(curr == NULL) throw std::out_of_range("Invalid key");
     return curr->getValue();
 }
-template<class Key, class Value>
-Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
+template<class Key, class Value, class Compare, class Alloc>
+Value const & BinarySearchTree<Key, Value, Compare, Alloc>::operator[](const Key& key) const
 {
     Node<Key, Value> *curr = internalFind(key);
     if(curr == NULL) throw std::out_of_range("Invalid key");
@@ -483,78 +1007,514 @@ Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
 * Recall: If key is already in the tree, you should 
 * overwrite the current value with the updated value.
 */
-template<class Key, class Value>
-void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair)
+template<class Key, class Value, class Compare, class Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::insert(const std::pair<const Key, Value> &keyValuePair)
 {
-    // TODO
-    //empty case
-    if(root_ == nullptr){
-      root_ = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, nullptr);
-      return;
+    insert_or_assign(keyValuePair.first, keyValuePair.second);
+}
+
+/**
+* Constructs a value_type from args and inserts it if its key is not present.
+* The pair is built once on the stack to learn the key; the node then copies
+* the key and moves the value, so nothing is allocated when the key exists.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Alloc>::emplace(Args&&... args)
+{
+    std::pair<const Key, Value> item(std::forward<Args>(args)...);
+    return emplaceUnique(root_, item.first, std::move(item.second));
+}
+
+/**
+* Inserts a value constructed in place from args if key is not present.
+* If it is, nothing is constructed and args are left untouched.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Alloc>::try_emplace(const Key& key, Args&&... args)
+{
+    return emplaceUnique(root_, key, std::forward<Args>(args)...);
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Alloc>::try_emplace(Key&& key, Args&&... args)
+{
+    return emplaceUnique(root_, std::move(key), std::forward<Args>(args)...);
+}
+
+/**
+* Inserts key with obj as its value, or assigns obj to the existing value,
+* in a single traversal.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+template<typename M>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Alloc>::insert_or_assign(const Key& key, M&& obj)
+{
+    std::pair<iterator, bool> result =
+        emplaceUnique(root_, key, std::forward<M>(obj));
+    if(!result.second) {
+        result.first->second = std::forward<M>(obj);
+        valueAssigned(iteratorNode(result.first));
     }
-    //begin the search for the root
-    Node<Key, Value>* cur= root_;
-    Node<Key, Value>* parent= nullptr;
+    return result;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+template<typename M>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Alloc>::insert_or_assign(Key&& key, M&& obj)
+{
+    std::pair<iterator, bool> result =
+        emplaceUnique(root_, std::move(key), std::forward<M>(obj));
+    if(!result.second) {
+        result.first->second = std::forward<M>(obj);
+        valueAssigned(iteratorNode(result.first));
+    }
+    return result;
+}
+
+/**
+* Walks down once from start (root_, or a subtree fingerStart() picked).
+* Returns the node holding key if there is one; otherwise returns NULL and
+* sets parent/asLeft to where a new node would go (parent is NULL for an
+* empty tree).
+*/
+template<class Key, class Value, class Compare, class Alloc>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Compare, Alloc>::findSlot(const Key& key, Node<Key, Value>* start,
+                                                       Node<Key, Value>*& parent, bool& asLeft) const
+{
+    //begin the search at the root of the subtree known to hold key's slot
+    Node<Key, Value>* cur = start;
+    parent = nullptr;
+    asLeft = false;
 
-    //keep going down the tree until we find the null child position
+    //keep going down the tree until we find the null child position,
+    //with one three-way comparison per level
     while(cur != nullptr){
       //remember the parent before moving
       parent = cur;
-      if(keyValuePair.first <cur->getKey()){
+      int order = threeWayCompare(comp_, key, cur->getKey());
+      if(order < 0){
         //if the key you get is smaller, go left
-        cur= cur->getLeft();
+        asLeft = true;
+        cur = cur->getLeft();
       }
       //if the key is larger, then we go right
-      else if(keyValuePair.first > cur->getKey()){
+      else if(order > 0){
+        asLeft = false;
         cur = cur->getRight();
       }
       else{
-        //if the key already exists, overwrite the value
-        cur->setValue(keyValuePair.second);
-        return;
+        //the key already exists
+        return cur;
       }
     }
-    //case 3, we find the intersection place and cur is now null and the parents is te node where we attach the new one to 
-    Node<Key,Value>* n = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, parent);
-    //attach the new node as etiher the left or right child of the parent
-    if(keyValuePair.first < parent->getKey()){
-      parent->setLeft(n);
-    }
-    else{
-      parent->setRight(n);
+    return nullptr;
+}
+
+/**
+* The shared body of the insertion functions. The key and value are only
+* constructed once the search has missed; createInsertNode() then moves them
+* into a node of the tree's own type, which is handed to linkNewNode so
+* derived trees can rebalance.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+template<typename KeyArg, typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Alloc>::emplaceUnique(Node<Key, Value>* start, KeyArg&& key, Args&&... args)
+{
+    Node<Key, Value>* parent;
+    bool asLeft;
+    Node<Key, Value>* existing = findSlot(key, start, parent, asLeft);
+    if(existing != nullptr) {
+        return std::make_pair(iterator(existing, this), false);
     }
+    Key newKey(std::forward<KeyArg>(key));
+    Value value(std::forward<Args>(args)...);
+    Node<Key, Value>* node = createInsertNode(parent, std::move(newKey), std::move(value));
+    linkNewNode(node, parent, asLeft);
+    return std::make_pair(iterator(node, this), true);
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Compare, Alloc>::createInsertNode(Node<Key, Value>* parent, Key&& key, Value&& value)
+{
+    return constructNode<Node<Key, Value> >(nodeAlloc_, std::piecewise_construct, parent,
+                                            std::move(key), std::move(value));
 }
 
+/**
+* A plain tree caches nothing that depends on the values.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::valueAssigned(Node<Key, Value>*)
+{
+
+}
 
 /**
-* A remove method to remove a specific key from a Binary Search Tree.
-* Recall: The writeup specifies that if a node has 2 children you
-* should swap with the predecessor and then remove.
+* Attaches a freshly created node as the asLeft child of parent (or as the root).
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::remove(const Key& key)
+template<class Key, class Value, class Compare, class Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::linkNewNode(Node<Key, Value>* node, Node<Key, Value>* parent, bool asLeft)
 {
-    // TODO
-    //find the node with the given key
-    Node<Key,Value>* node = internalFind(key);
-    if (node == nullptr){
-      return;
+    if(parent == nullptr){
+      root_ = node;
+      rightmost_ = node;
     }
-    //if the node has two children, swap its predecessor
-    if(node->getLeft() != nullptr && node ->getRight() != nullptr){
-      Node<Key,Value>* pred = predecessor(node);
-      nodeSwap(node, pred);
-    }
-    //find the single child if there is one
-    Node<Key,Value>* child= nullptr;
-    if(node->getLeft() != nullptr){
-      child = node->getLeft();
+    //attach the new node as etiher the left or right child of the parent
+    else if(asLeft){
+#ifdef BST_THREADED
+      //a new left child comes just before its parent in order
+      threadLink(parent->getPrev(), node);
+      threadLink(node, parent);
+#endif
+      parent->setLeft(node);
     }
     else{
-      child = node -> getRight();
+#ifdef BST_THREADED
+      //and a new right child just after it
+      threadLink(node, parent->getNext());
+      threadLink(parent, node);
+#endif
+      parent->setRight(node);
+      if(parent == rightmost_){
+        rightmost_ = node;
+      }
     }
-    //update the child's parents pointer
-    Node<Key,Value>* parent = node->getParent();
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc>::makeIterator(Node<Key, Value>* node) const
+{
+    return iterator(node, this);
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Compare, Alloc>::iteratorNode(iterator it)
+{
+    return it.current_;
+}
+
+/**
+* A plain tree caches nothing about its subtrees.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::pullUp(Node<Key, Value>*)
+{
+
+}
+
+/**
+* Inserts (or overwrites, like insert) using hint as the starting point of the
+* search. Returns an iterator to the item.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc>::insert(iterator hint, const std::pair<const Key, Value>& keyValuePair)
+{
+    std::pair<iterator, bool> result = emplaceUnique(
+        hintStart(hint, keyValuePair.first), keyValuePair.first, keyValuePair.second);
+    if(!result.second) {
+        result.first->second = keyValuePair.second;
+        valueAssigned(iteratorNode(result.first));
+    }
+    return result.first;
+}
+
+/**
+* Looks the keys up in groups of GROUP_SIZE. Within a group the searches take
+* turns to descend one level, and each prefetches the child it moves to, so
+* by the time a search comes round again its node is usually in cache: the
+* misses of a whole group are in flight together instead of one level of one
+* search at a time. Returns out past the last iterator written.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+template<typename ForwardIt, typename OutputIt>
+OutputIt BinarySearchTree<Key, Value, Compare, Alloc>::findBatch(ForwardIt first, ForwardIt last, OutputIt out) const
+{
+    const std::size_t GROUP_SIZE = 16;
+    const Key* keys[GROUP_SIZE];
+    Node<Key, Value>* cur[GROUP_SIZE];
+    Node<Key, Value>* found[GROUP_SIZE];
+    while(first != last) {
+        std::size_t count = 0;
+        for(; count < GROUP_SIZE && first != last; ++count, ++first) {
+            keys[count] = &*first;
+            cur[count] = root_;
+            found[count] = nullptr;
+        }
+        std::size_t active = root_ == nullptr ? 0 : count;
+        while(active > 0) {
+            for(std::size_t i = 0; i < count; ++i) {
+                if(cur[i] == nullptr) {
+                    continue;
+                }
+                int order = threeWayCompare(comp_, *keys[i], cur[i]->getKey());
+                if(order == 0) {
+                    found[i] = cur[i];
+                    cur[i] = nullptr;
+                }
+                else {
+                    cur[i] = order < 0 ? cur[i]->getLeft() : cur[i]->getRight();
+                }
+                if(cur[i] != nullptr) {
+                    prefetchRead(cur[i]);
+                }
+                else {
+                    --active;
+                }
+            }
+        }
+        for(std::size_t i = 0; i < count; ++i) {
+            *out = iterator(found[i], this);
+            ++out;
+        }
+    }
+    return out;
+}
+
+/**
+* Finds key starting from hint rather than the root. Cheap when key is near hint.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc>::find(iterator hint, const Key& key) const
+{
+    return iterator(findNode(key, hintStart(hint, key)), this);
+}
+
+/**
+* Picks where a hinted search starts. end() means "probably past the largest
+* key": if so the slot is right under rightmost_ and a single comparison finds
+* it; otherwise the search starts at the root.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Compare, Alloc>::hintStart(iterator hint, const Key& key) const
+{
+    if(hint.current_ != nullptr) {
+        return fingerStart(hint.current_, key);
+    }
+    if(rightmost_ != nullptr && comp_(rightmost_->getKey(), key)) {
+        return rightmost_;
+    }
+    return root_;
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc>::lower_bound(const Key& key) const
+{
+    return iterator(lowerBoundNode(key), this);
+}
+
+/**
+* Returns an iterator to the first item whose key is greater than key.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc>::upper_bound(const Key& key) const
+{
+    return iterator(upperBoundNode(key), this);
+}
+
+/**
+* Returns [lower_bound(key), upper_bound(key)), which holds at most one item
+* since keys are unique.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator,
+          typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator>
+BinarySearchTree<Key, Value, Compare, Alloc>::equal_range(const Key& key) const
+{
+    iterator first = lower_bound(key);
+    iterator last = first;
+    //with unique keys the upper bound is just past an exact match
+    if(last != end() && !comp_(key, last->first)) {
+        ++last;
+    }
+    return std::make_pair(first, last);
+}
+
+/**
+* Returns an iterator to the item with the largest key not greater than key,
+* or end() if every key is greater.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc>::floor(const Key& key) const
+{
+    return iterator(floorNode(key), this);
+}
+
+/**
+* Returns an iterator to the item with the smallest key not less than key,
+* or end() if every key is less. Same as lower_bound.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc>::ceiling(const Key& key) const
+{
+    return lower_bound(key);
+}
+
+/**
+* Returns the items with keys in [lo, hi). Finding the ends costs two
+* descents; iterating costs time proportional to the number of items visited.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::range_view
+BinarySearchTree<Key, Value, Compare, Alloc>::range(const Key& lo, const Key& hi) const
+{
+    //an empty or inverted interval yields an empty view
+    if(!comp_(lo, hi)) {
+        return range_view(end(), end());
+    }
+    return range_view(lower_bound(lo), lower_bound(hi));
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+template<typename K>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Compare, Alloc>::lowerBoundNode(const K& key) const
+{
+    //remember the last node we turned left at, that's the smallest key >= key seen so far
+    Node<Key, Value>* cur = root_;
+    Node<Key, Value>* bound = nullptr;
+    while(cur != nullptr){
+      if(!comp_(cur->getKey(), key)){
+        bound = cur;
+        cur = cur->getLeft();
+      }
+      else{
+        cur = cur->getRight();
+      }
+    }
+    return bound;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+template<typename K>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Compare, Alloc>::upperBoundNode(const K& key) const
+{
+    Node<Key, Value>* cur = root_;
+    Node<Key, Value>* bound = nullptr;
+    while(cur != nullptr){
+      if(comp_(key, cur->getKey())){
+        bound = cur;
+        cur = cur->getLeft();
+      }
+      else{
+        cur = cur->getRight();
+      }
+    }
+    return bound;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+template<typename K>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Compare, Alloc>::floorNode(const K& key) const
+{
+    //mirror of lowerBoundNode: remember the last node we turned right at
+    Node<Key, Value>* cur = root_;
+    Node<Key, Value>* bound = nullptr;
+    while(cur != nullptr){
+      if(!comp_(key, cur->getKey())){
+        bound = cur;
+        cur = cur->getRight();
+      }
+      else{
+        cur = cur->getLeft();
+      }
+    }
+    return bound;
+}
+
+/**
+* Finger search: climbs from hint only as far as needed to reach the root of
+* the smallest subtree whose key range must contain key, so that a normal
+* descent from the returned node finds key (or its insertion slot).
+* Comparisons are only made at ancestors that bound the range on key's side,
+* so the cost is O(log d) for a key d positions away from the hint.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+template<typename K>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Compare, Alloc>::fingerStart(Node<Key, Value>* hint, const K& key) const
+{
+    int order = threeWayCompare(comp_, key, hint->getKey());
+    if(order == 0 || (order > 0 && hint == rightmost_)) {
+        return hint;
+    }
+    Node<Key, Value>* cur = hint;
+    while(cur->getParent() != nullptr) {
+        Node<Key, Value>* parent = cur->getParent();
+        //only a parent on key's side of cur can bound the range
+        if((order > 0) == (cur == parent->getLeft())) {
+            int parentOrder = threeWayCompare(comp_, key, parent->getKey());
+            if(parentOrder == 0) {
+                return parent;
+            }
+            if((parentOrder > 0) != (order > 0)) {
+                //key lies between hint and parent, so inside cur's subtree
+                return cur;
+            }
+        }
+        cur = parent;
+    }
+    return cur;
+}
+
+
+/**
+* A remove method to remove a specific key from a Binary Search Tree.
+* Recall: The writeup specifies that if a node has 2 children you
+* should swap with the predecessor and then remove.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::remove(const Key& key)
+{
+    // TODO
+    //find the node with the given key
+    Node<Key,Value>* node = internalFind(key);
+    if (node == nullptr){
+      return;
+    }
+    //if the node has two children, swap its predecessor
+    if(node->getLeft() != nullptr && node ->getRight() != nullptr){
+      Node<Key,Value>* pred = predecessor(node);
+      nodeSwap(node, pred);
+    }
+    //the largest key is going away, so its predecessor takes over
+    if(node == rightmost_){
+      rightmost_ = predecessor(node);
+    }
+    //find the single child if there is one
+    Node<Key,Value>* child= nullptr;
+    if(node->getLeft() != nullptr){
+      child = node->getLeft();
+    }
+    else{
+      child = node -> getRight();
+    }
+    //update the child's parents pointer
+    Node<Key,Value>* parent = node->getParent();
     if(child != nullptr){
       child ->setParent(parent);
     }
@@ -571,22 +1531,28 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
         //node was a right child and we update the parent's pointer
         parent ->setRight(child);
       }
+#ifdef BST_THREADED
+      threadLink(node->getPrev(), node->getNext());
+#endif
       //delete the node
-      delete node;
+      destroyNode(node);
 
 }
 
 
 
-template<class Key, class Value>
+template<class Key, class Value, class Compare, class Alloc>
 Node<Key, Value>*
-BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
+BinarySearchTree<Key, Value, Compare, Alloc>::predecessor(Node<Key, Value>* current)
 {
     // TODO
     //if the current is null then there is no predecessor
     if(current == nullptr){
       return nullptr;
     }
+#ifdef BST_THREADED
+    return current->getPrev();
+#else
     //case where the node has a left child
     if(current->getLeft() != nullptr){
       Node<Key,Value>* pred = current->getLeft();
@@ -604,43 +1570,542 @@ BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
       parent = parent->getParent();
     }
     return parent;
+#endif
 }
-//a helper function for clear
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clearHelper(Node<Key,Value>* node){
-  //base case
-  if(node == nullptr){
-    return;
+
+/**
+* The node after current in key order, or NULL if current is the largest.
+* O(1) with BST_THREADED; otherwise the mirror image of predecessor.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Compare, Alloc>::successor(Node<Key, Value>* current)
+{
+#ifdef BST_THREADED
+    return current->getNext();
+#else
+    //the smallest node of the right subtree, if there is one
+    if(current->getRight() != nullptr){
+      current = current->getRight();
+      while(current->getLeft() != nullptr){
+        current = current->getLeft();
+      }
+      return current;
+    }
+    //otherwise the first ancestor whose left subtree we are in
+    Node<Key, Value>* parent = current->getParent();
+    while(parent != nullptr && current == parent->getRight()){
+      current = parent;
+      parent = parent->getParent();
+    }
+    return parent;
+#endif
+}
+
+/**
+* Makes after follow before in the in-order threads. Either may be NULL.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::threadLink(Node<Key, Value>* before, Node<Key, Value>* after)
+{
+#ifdef BST_THREADED
+    if(before != nullptr){
+      before->setNext(after);
+    }
+    if(after != nullptr){
+      after->setPrev(before);
+    }
+#endif
+}
+
+/**
+* Threads the subtrees left < mid < right (mid may be NULL) into one run,
+* linking the largest node of left to mid and mid to the smallest of right.
+* The threads leading out of the run's first and last nodes are left as they
+* were; threadEnds() cuts them once a whole tree has been put together.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::threadJoin(Node<Key, Value>* left, Node<Key, Value>* mid,
+                                                              Node<Key, Value>* right)
+{
+#ifdef BST_THREADED
+    Node<Key, Value>* largest = left;
+    if(largest != nullptr){
+      while(largest->getRight() != nullptr){
+        largest = largest->getRight();
+      }
+    }
+    Node<Key, Value>* smallest = right;
+    if(smallest != nullptr){
+      while(smallest->getLeft() != nullptr){
+        smallest = smallest->getLeft();
+      }
+    }
+    if(mid != nullptr){
+      if(largest != nullptr){
+        threadLink(largest, mid);
+      }
+      if(smallest != nullptr){
+        threadLink(mid, smallest);
+      }
+    }
+    else if(largest != nullptr && smallest != nullptr){
+      threadLink(largest, smallest);
+    }
+#endif
+}
+
+/**
+* Exchanges the places of n1 and n2 in the threads, to follow nodeSwap.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::threadSwap(Node<Key, Value>* n1, Node<Key, Value>* n2)
+{
+#ifdef BST_THREADED
+    if(n2->getNext() == n1){
+      std::swap(n1, n2);
+    }
+    Node<Key, Value>* before1 = n1->getPrev();
+    Node<Key, Value>* after2 = n2->getNext();
+    if(n1->getNext() == n2){
+      threadLink(before1, n2);
+      threadLink(n2, n1);
+      threadLink(n1, after2);
+      return;
+    }
+    Node<Key, Value>* after1 = n1->getNext();
+    Node<Key, Value>* before2 = n2->getPrev();
+    threadLink(before1, n2);
+    threadLink(n2, after1);
+    threadLink(before2, n1);
+    threadLink(n1, after2);
+#endif
+}
+
+/**
+* Cuts the threads leading out of the first and last nodes of the tree.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::threadEnds()
+{
+#ifdef BST_THREADED
+    if(root_ != nullptr){
+      getSmallestNode()->setPrev(nullptr);
+      rightmost_->setNext(nullptr);
+    }
+#endif
+}
+
+/**
+* A helper function for clear that destroys the subtree rooted at node. It
+* needs no stack, however deep the subtree: a node with a left child is
+* rotated right, which moves the left subtree up, and a node without one is
+* destroyed and the walk moves on to its right child. Every rotation puts one
+* more node on the path of nodes without left children, so there are at most
+* n rotations and the whole teardown is O(n). Parent links are not used.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::clearHelper(Node<Key,Value>* node){
+  while(node != nullptr){
+    Node<Key,Value>* left = node->getLeft();
+    if(left != nullptr){
+      //rotate right: left's right subtree becomes node's left
+      node->setLeft(left->getRight());
+      left->setRight(node);
+      node = left;
+    }
+    else{
+      Node<Key,Value>* right = node->getRight();
+      destroyNode(node);
+      node = right;
+    }
   }
-    //recurse to delete the left subtree
-    clearHelper(node->getLeft());
-    //recurse to delete the right subtree
-    clearHelper(node->getRight());
-    //delete the node
-    delete node;
+}
+
+/**
+* With an arena allocator and trivially destructible items there is nothing
+* to run per node, so the whole arena is handed back in O(chunks).
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::clearNodes(std::true_type)
+{
+    nodeAlloc_.release();
+}
+
+template<typename Key, typename Value, typename Compare, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::clearNodes(std::false_type)
+{
+    clearHelper(root_);
+}
+
+/**
+* The allocator a copy of this tree should use.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+Alloc BinarySearchTree<Key, Value, Compare, Alloc>::copyAllocator() const
+{
+    return std::allocator_traits<Alloc>::select_on_container_copy_construction(Alloc(nodeAlloc_));
+}
+
+/**
+* Fills this empty tree with a copy of other's nodes in the same shape, in
+* O(n) with no comparisons or rotations. The walk follows the parent links
+* like measureSubtree, so it needs no stack however deep other is; each copy
+* is made on the way down and pulled up on the way back, once its children
+* are done. A failed allocation frees what was copied so far.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::cloneFrom(const BinarySearchTree& other)
+{
+    const Node<Key, Value>* source = other.root_;
+    if(source == nullptr) {
+        return;
+    }
+    Node<Key, Value>* copyRoot = cloneNode(source);
+    const Node<Key, Value>* cur = source;
+    const Node<Key, Value>* from = source->getParent();
+    Node<Key, Value>* copy = copyRoot;
+    //the copy most recently reached in order, to thread and to end on
+    Node<Key, Value>* last = nullptr;
+    try {
+        while(true) {
+            const Node<Key, Value>* next = nullptr;
+            if(from == cur->getParent()) {
+                //first time here: the left subtree, if any, comes first
+                next = cur->getLeft();
+                if(next == nullptr) {
+                    threadLink(last, copy);
+                    last = copy;
+                    next = cur->getRight();
+                }
+            }
+            else if(from == cur->getLeft()) {
+                threadLink(last, copy);
+                last = copy;
+                next = cur->getRight();
+            }
+            if(next != nullptr) {
+                Node<Key, Value>* child = cloneNode(next);
+                child->setParent(copy);
+                if(next == cur->getLeft()) {
+                    copy->setLeft(child);
+                }
+                else {
+                    copy->setRight(child);
+                }
+                from = cur;
+                cur = next;
+                copy = child;
+                continue;
+            }
+            pullUp(copy);
+            if(cur == source) {
+                break;
+            }
+            from = cur;
+            cur = cur->getParent();
+            copy = copy->getParent();
+        }
+    }
+    catch(...) {
+        clearHelper(copyRoot);
+        throw;
+    }
+    root_ = copyRoot;
+    rightmost_ = last;
+}
+
+/**
+* A detached copy of source's item; derived trees copy what else their
+* nodes store that pullUp() cannot recompute.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Compare, Alloc>::cloneNode(const Node<Key, Value>* source)
+{
+    return createNode(source->getKey(), source->getValue(), nullptr);
+}
+
+/**
+* Allocates a NodeT from alloc and constructs it from args.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+template<typename NodeT, typename NodeAllocT, typename... Args>
+NodeT* BinarySearchTree<Key, Value, Compare, Alloc>::constructNode(NodeAllocT& alloc, Args&&... args)
+{
+    typedef std::allocator_traits<NodeAllocT> Traits;
+    NodeT* node = Traits::allocate(alloc, 1);
+    try {
+        Traits::construct(alloc, node, std::forward<Args>(args)...);
+    }
+    catch(...) {
+        Traits::deallocate(alloc, node, 1);
+        throw;
+    }
+    return node;
+}
+
+/**
+* Allocates and constructs a plain Node from the tree's allocator.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Compare, Alloc>::createNode(const Key& key, const Value& value, Node<Key, Value>* parent)
+{
+    return constructNode<Node<Key, Value> >(nodeAlloc_, key, value, parent);
+}
+
+/**
+* Creates the node for one item of a bulk build. The heights of the subtrees it
+* will get are passed so that derived trees can initialize their balance info.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Compare, Alloc>::createBuildNode(const std::pair<const Key, Value>& item,
+                                                     int, int)
+{
+    return createNode(item.first, item.second, nullptr);
+}
+
+/**
+* Destroys a node created by createNode. Derived trees that allocate a larger
+* node type override this to release it with the matching allocator.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::destroyNode(Node<Key, Value>* node)
+{
+    NodeAllocTraits::destroy(nodeAlloc_, node);
+    NodeAllocTraits::deallocate(nodeAlloc_, node, 1);
 }
 
 /**
 * A method to remove all contents of the tree and
 * reset the values in the tree for use again.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clear()
+template<typename Key, typename Value, typename Compare, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::clear()
 {
     // TODO
     //delete everything from the root
-    clearHelper(root_);
+    clearNodes(std::integral_constant<bool,
+        is_arena_allocator<NodeAlloc>::value &&
+        std::is_trivially_destructible<std::pair<const Key, Value> >::value>());
     //reset the root again to null 
     root_=nullptr;
+    rightmost_=nullptr;
+}
+
+
+/**
+* Writes the items in key order after a header naming the format and the
+* key and value sizes, then a hash of it all. The items are counted with
+* measureSubtree first, so the walk needs no stack on any tree shape.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::save(std::ostream& out) const
+{
+    std::size_t count;
+    int height;
+    measureSubtree(root_, count, height);
+    SnapshotWriter writer(out);
+    writer.write(snapshot_detail::MAGIC, sizeof(snapshot_detail::MAGIC));
+    std::uint32_t header[4] = { SNAPSHOT_VERSION, snapshot_detail::ORDER_MARK,
+                                SnapshotCodec<Key>::SIZE, SnapshotCodec<Value>::SIZE };
+    writer.write(header, sizeof(header));
+    std::uint64_t items = count;
+    writer.write(&items, sizeof(items));
+    for(iterator it = begin(); it != end(); ++it) {
+        SnapshotCodec<Key>::write(writer, it->first);
+        SnapshotCodec<Value>::write(writer, it->second);
+    }
+    writer.finish();
+}
+
+template<typename Key, typename Value, typename Compare, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::save(const std::string& path) const
+{
+    std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+    if(!out) {
+        throw SnapshotError("cannot open " + path + " for writing");
+    }
+    save(out);
+}
+
+/**
+* Replaces the contents with a snapshot written by save(). The items are
+* trusted to be in order, as save() wrote them, so the tree is built
+* bottom-up like assign() without comparing a single key; the stored hash
+* catches a damaged file instead. The new tree is only swapped in once the
+* hash checks out, so on any SnapshotError the old contents are kept. The old
+* nodes are then freed one by one rather than with clear(), which could hand
+* back an arena the new nodes were just carved from.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::load(std::istream& in)
+{
+    SnapshotReader reader(in);
+    char magic[sizeof(snapshot_detail::MAGIC)];
+    reader.read(magic, sizeof(magic));
+    if(std::memcmp(magic, snapshot_detail::MAGIC, sizeof(magic)) != 0) {
+        throw SnapshotError("not a tree snapshot");
+    }
+    std::uint32_t header[4];
+    reader.read(header, sizeof(header));
+    if(header[0] != SNAPSHOT_VERSION) {
+        throw SnapshotError("unsupported version " + std::to_string(header[0]));
+    }
+    if(header[1] != snapshot_detail::ORDER_MARK) {
+        throw SnapshotError("written with the other byte order");
+    }
+    if(header[2] != SnapshotCodec<Key>::SIZE || header[3] != SnapshotCodec<Value>::SIZE) {
+        throw SnapshotError("written for other key or value types");
+    }
+    std::uint64_t items;
+    reader.read(&items, sizeof(items));
+
+    SnapshotItems<Key, Value> it(reader);
+    int height;
+    Node<Key, Value>* root = buildSubtree(it, static_cast<std::size_t>(items), height);
+    try {
+        reader.finish();
+    }
+    catch(...) {
+        clearHelper(root);
+        throw;
+    }
+    Node<Key, Value>* old = root_;
+    root_ = root;
+    rightmost_ = getLargestNode();
+    clearHelper(old);
+}
+
+template<typename Key, typename Value, typename Compare, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::load(const std::string& path)
+{
+    std::ifstream in(path.c_str(), std::ios::binary);
+    if(!in) {
+        throw SnapshotError("cannot open " + path + " for reading");
+    }
+    load(in);
+}
+
+/**
+* Replaces the contents of the tree with the key/value pairs in [first, last),
+* which must be sorted by strictly increasing key. The tree is built bottom-up
+* as a perfectly balanced tree in O(n) time with no comparisons or rotations.
+* With checkSorted the range is verified first and std::invalid_argument is
+* thrown (leaving the tree untouched) if it is unsorted or has duplicate keys.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+template<typename ForwardIt>
+void BinarySearchTree<Key, Value, Compare, Alloc>::assign(ForwardIt first, ForwardIt last, bool checkSorted)
+{
+    std::size_t n = 0;
+    if(checkSorted) {
+        ForwardIt prev = first;
+        for(ForwardIt it = first; it != last; ++it, ++n) {
+            if(n > 0 && !comp_(prev->first, it->first)) {
+                throw std::invalid_argument("Range is not sorted by unique key");
+            }
+            prev = it;
+        }
+    }
+    else {
+        n = std::distance(first, last);
+    }
+    clear();
+    int height;
+    root_ = buildSubtree(first, n, height);
+    rightmost_ = getLargestNode();
+}
+
+/**
+* Builds a balanced subtree from the next n items of the range, in order, and
+* returns its root (with a null parent). height is set to the subtree's height.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+template<typename ForwardIt>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Compare, Alloc>::buildSubtree(ForwardIt& it, std::size_t n, int& height)
+{
+    if(n == 0) {
+        height = 0;
+        return nullptr;
+    }
+    //the extra item (if any) goes right so every split matches balancedHeight
+    std::size_t leftCount = (n - 1) / 2;
+    std::size_t rightCount = n - 1 - leftCount;
+    int leftHeight, rightHeight;
+    Node<Key, Value>* left = buildSubtree(it, leftCount, leftHeight);
+    Node<Key, Value>* node = nullptr;
+    try {
+        node = createBuildNode(*it, leftHeight, balancedHeight(rightCount));
+    }
+    catch(...) {
+        clearHelper(left);
+        throw;
+    }
+    ++it;
+    threadJoin(left, node, nullptr);
+    node->setLeft(left);
+    if(left != nullptr) {
+        left->setParent(node);
+    }
+    Node<Key, Value>* right;
+    try {
+        right = buildSubtree(it, rightCount, rightHeight);
+    }
+    catch(...) {
+        clearHelper(node);
+        throw;
+    }
+    threadJoin(nullptr, node, right);
+    node->setRight(right);
+    if(right != nullptr) {
+        right->setParent(node);
+    }
+    pullUp(node);
+    height = std::max(leftHeight, rightHeight) + 1;
+    return node;
 }
 
+/**
+* Height of the tree buildSubtree produces from n items: floor(log2 n) + 1.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+int BinarySearchTree<Key, Value, Compare, Alloc>::balancedHeight(std::size_t n)
+{
+    int height = 0;
+    while(n != 0) {
+        ++height;
+        n >>= 1;
+    }
+    return height;
+}
+
+/**
+* A helper function to find the largest node in the tree.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Compare, Alloc>::getLargestNode() const
+{
+    Node<Key,Value>* cur=root_;
+    if(cur == nullptr){
+      return nullptr;
+    }
+    while(cur -> getRight() != nullptr){
+      cur = cur->getRight();
+    }
+    return cur;
+}
 
 /**
 * A helper function to find the smallest node in the tree.
 */
-template<typename Key, typename Value>
+template<typename Key, typename Value, typename Compare, typename Alloc>
 Node<Key, Value>*
-BinarySearchTree<Key, Value>::getSmallestNode() const
+BinarySearchTree<Key, Value, Compare, Alloc>::getSmallestNode() const
 {
     // TODO
     Node<Key,Value>* cur=root_;
@@ -661,18 +2126,31 @@ BinarySearchTree<Key, Value>::getSmallestNode() const
 * return a pointer to it or NULL if no item with that key
 * exists
 */
-template<typename Key, typename Value>
-Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) const
+template<typename Key, typename Value, typename Compare, typename Alloc>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare, Alloc>::internalFind(const Key& key) const
 {
     // TODO
-    //Traverse the tree until you find the key or hit null
-    Node<Key, Value>* cur = root_;
+    return findNode(key, root_);
+}
+
+/**
+* The search behind internalFind and heterogeneous find, making one
+* three-way comparison per level (see threeWayCompare). The search covers
+* the subtree rooted at start, which is root_ unless a hint narrowed it.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+template<typename K>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare, Alloc>::findNode(const K& key, Node<Key, Value>* start) const
+{
+    //Traverse the subtree until you find the key or hit null
+    Node<Key, Value>* cur = start;
     while(cur != nullptr){
-      if(key < cur->getKey()){
+      int order = threeWayCompare(comp_, key, cur->getKey());
+      if(order < 0){
         //if the key is smaller then go left
         cur = cur->getLeft();
       }
-      else if (key > cur->getKey()){
+      else if(order > 0){
         //if the key is larger then go right
         cur = cur->getRight();
       }
@@ -683,18 +2161,80 @@ Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) con
     }
     return nullptr;
 }
-//helper function for checking is balanced
-template<typename Key, typename Value>
-int BinarySearchTree<Key, Value>::getHeight(Node<Key,Value>* node)const{
+/**
+* The height of the subtree rooted at node (0 if node is NULL).
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+int BinarySearchTree<Key, Value, Compare, Alloc>::getHeight(Node<Key,Value>* node)const{
+  std::size_t size;
+  int height;
+  measureSubtree(node, size, height);
+  return height;
+}
+
+/**
+* Counts the nodes of the subtree rooted at node and finds its height in one
+* walk over the parent links, using O(1) extra space: coming down into a
+* node visits it, and whether the walk came back up from the left or the
+* right child says where to go next.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::measureSubtree(Node<Key,Value>* node,
+                                                          std::size_t& size, int& height) const
+{
+  size = 0;
+  height = 0;
+  if(node == nullptr){
+    return;
+  }
+  Node<Key,Value>* cur = node;
+  Node<Key,Value>* from = node->getParent();
+  int depth = 1;
+  while(true){
+    Node<Key,Value>* next = nullptr;
+    if(from == cur->getParent()){
+      //first time here, coming down
+      ++size;
+      height = std::max(height, depth);
+      next = cur->getLeft() != nullptr ? cur->getLeft() : cur->getRight();
+    }
+    else if(from == cur->getLeft()){
+      //back up from the left subtree, the right one is next
+      next = cur->getRight();
+    }
+    if(next != nullptr){
+      from = cur;
+      cur = next;
+      ++depth;
+    }
+    else if(cur == node){
+      return;
+    }
+    else{
+      //both subtrees are done
+      from = cur;
+      cur = cur->getParent();
+      --depth;
+    }
+  }
+}
+
+/**
+* The height of the subtree rooted at node, or -1 if some node in it has
+* subtrees whose heights differ by more than one. This recurses once per
+* level, so it is only called once the height is known to be logarithmic.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+int BinarySearchTree<Key, Value, Compare, Alloc>::checkedHeight(Node<Key,Value>* node)const{
   //empty case with height 0
   if(node == nullptr) return 0;
   //left subtree unbalanced 
-  int leftHeight = getHeight(node->getLeft());
+  int leftHeight = checkedHeight(node->getLeft());
   if(leftHeight==-1){
     return -1;
   }
   //right tree unbalanced
-  int rightHeight = getHeight(node->getRight());
+  int rightHeight = checkedHeight(node->getRight());
   if(rightHeight==-1){
     return -1;
   }
@@ -706,24 +2246,59 @@ int BinarySearchTree<Key, Value>::getHeight(Node<Key,Value>* node)const{
   return std::max(leftHeight, rightHeight) +1;
 }
 
+/**
+* The greatest height a balanced tree of n nodes can have. The sparsest
+* balanced tree of height h has N(h) = N(h - 1) + N(h - 2) + 1 nodes, which
+* grows like the Fibonacci numbers, so the answer is below 1.45 log2(n + 2)
+* and never more than about 90.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+int BinarySearchTree<Key, Value, Compare, Alloc>::maxBalancedHeight(std::size_t n)
+{
+  //sparsest[0] and sparsest[1] are N(h - 1) and N(h)
+  std::size_t sparsest[2] = { 0, 1 };
+  int height = 0;
+  while(sparsest[1] <= n){
+    ++height;
+    std::size_t next = sparsest[0] + sparsest[1] + 1;
+    if(next < sparsest[1]){
+      //overflow: no tree is that large
+      break;
+    }
+    sparsest[0] = sparsest[1];
+    sparsest[1] = next;
+  }
+  return height;
+}
+
 /**
  * Return true iff the BST is balanced.
+ * A tree taller than any balanced tree of its size is rejected after one
+ * O(1)-space walk, so a degenerate tree of any length is handled without
+ * recursion; otherwise the per-node check recurses at most ~90 levels deep.
  */
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::isBalanced() const
+template<typename Key, typename Value, typename Compare, typename Alloc>
+bool BinarySearchTree<Key, Value, Compare, Alloc>::isBalanced() const
 {
     // TODO
-    return getHeight(root_) != -1;
+    std::size_t size;
+    int height;
+    measureSubtree(root_, size, height);
+    if(height > maxBalancedHeight(size)) {
+        return false;
+    }
+    return checkedHeight(root_) != -1;
 }
 
 
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
+template<typename Key, typename Value, typename Compare, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
 {
     if((n1 == n2) || (n1 == NULL) || (n2 == NULL) ) {
         return;
     }
+    threadSwap(n1, n2);
     Node<Key, Value>* n1p = n1->getParent();
     Node<Key, Value>* n1r = n1->getRight();
     Node<Key, Value>* n1lt = n1->getLeft();
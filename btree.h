@@ -0,0 +1,842 @@
+#ifndef BTREE_H
+#define BTREE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+/**
+ * A B+ tree map with the same insert/remove/find/operator[]/iterator surface
+ * as BinarySearchTree, for comparing a wide-node layout against the binary
+ * trees. Every node holds up to Fanout - 1 keys in one contiguous array, so a
+ * search reads a few cache lines per level instead of one line per key
+ * compared, and the tree is log_(Fanout/2) n levels deep at most.
+ *
+ * Items live in the leaves, keys and values in separate arrays; inner nodes
+ * only hold separator keys. Leaves are linked both ways, so iteration never
+ * climbs the tree. Because keys and values are stored apart, dereferencing an
+ * iterator gives a std::pair<const Key&, Value&> rather than a reference to a
+ * stored pair (it->first and it->second work as usual).
+ *
+ * Within a node, arithmetic keys are searched by counting the keys less than
+ * the probe in one branch-free pass, which compilers can vectorize; other keys
+ * use binary search. Nodes default-construct their key and value slots, so
+ * Key and Value must be default constructible and move assignable. Fanout must
+ * be even and at least 4. Inserting and removing invalidate iterators.
+ */
+template <typename Key, typename Value, typename Compare = std::less<Key>, unsigned Fanout = 32>
+class BTree
+{
+    static_assert(Fanout >= 4 && Fanout % 2 == 0, "BTree fanout must be even and at least 4");
+
+private:
+    struct NodeBase;
+    struct Leaf;
+    struct Inner;
+
+public:
+    class iterator;
+
+    BTree();
+    explicit BTree(const Compare& comp);
+    ~BTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    bool empty() const;
+    std::size_t size() const;
+    // Bytes held by the nodes, for comparing memory per entry
+    std::size_t memoryUsage() const;
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+
+    /**
+    * A bidirectional iterator over the items in key order.
+    */
+    class iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const Key&, Value&> reference;
+
+        // What operator-> returns: holds the reference pair so that
+        // it->first and it->second can reach into it
+        class pointer
+        {
+        public:
+            explicit pointer(const reference& ref);
+            reference* operator->();
+
+        private:
+            reference ref_;
+        };
+
+        iterator();
+
+        reference operator*() const;
+        pointer operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
+
+    private:
+        friend class BTree<Key, Value, Compare, Fanout>;
+        iterator(Leaf* leaf, unsigned index, const BTree* tree);
+
+        Leaf* leaf_;
+        unsigned index_;
+        // Only needed so that --end() can find the last leaf
+        const BTree* tree_;
+    };
+
+private:
+    BTree(const BTree&) = delete;
+    BTree& operator=(const BTree&) = delete;
+
+    static const unsigned MAX_KEYS = Fanout - 1;
+    static const unsigned MIN_KEYS = MAX_KEYS / 2;
+    // Every node but the root has at least two children, so no tree that fits
+    // in memory is deeper than this
+    static const unsigned MAX_DEPTH = 64;
+
+    struct NodeBase
+    {
+        explicit NodeBase(bool isLeaf);
+
+        bool leaf;
+        unsigned count;
+        Key keys[MAX_KEYS];
+    };
+
+    struct Leaf : NodeBase
+    {
+        Leaf();
+
+        Value values[MAX_KEYS];
+        Leaf* prev;
+        Leaf* next;
+    };
+
+    // keys[i] separates children[i], whose keys are all less than it, from
+    // children[i + 1], whose keys are all at least it
+    struct Inner : NodeBase
+    {
+        Inner();
+
+        NodeBase* children[MAX_KEYS + 1];
+    };
+
+    // One step of a descent: the inner node and which child was taken
+    struct PathStep
+    {
+        Inner* node;
+        unsigned child;
+    };
+
+    Leaf* findLeaf(const Key& key, PathStep* path, unsigned& depth) const;
+    unsigned lowerIndex(const NodeBase* node, const Key& key) const;
+    unsigned upperIndex(const NodeBase* node, const Key& key) const;
+    unsigned lowerIndex(const NodeBase* node, const Key& key, std::true_type linear) const;
+    unsigned lowerIndex(const NodeBase* node, const Key& key, std::false_type linear) const;
+    unsigned upperIndex(const NodeBase* node, const Key& key, std::true_type linear) const;
+    unsigned upperIndex(const NodeBase* node, const Key& key, std::false_type linear) const;
+
+    void insertIntoLeaf(Leaf* leaf, unsigned pos, const Key& key, const Value& value);
+    Leaf* splitLeaf(Leaf* leaf, unsigned pos, const Key& key, const Value& value);
+    void insertSeparator(PathStep* path, unsigned depth, const Key& separator, NodeBase* right);
+    void insertIntoInner(Inner* node, unsigned pos, const Key& separator, NodeBase* right);
+
+    void eraseFromLeaf(Leaf* leaf, unsigned pos);
+    void fixLeafUnderflow(Leaf* leaf, PathStep* path, unsigned depth);
+    void fixInnerUnderflow(Inner* node, PathStep* path, unsigned depth);
+    void removeChild(Inner* parent, unsigned separator);
+
+    void destroy(NodeBase* node);
+    std::size_t nodeBytes(const NodeBase* node) const;
+
+    NodeBase* root_;
+    Leaf* first_;
+    Leaf* last_;
+    std::size_t size_;
+    Compare comp_;
+};
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the BTree::iterator class.
+  ---------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare, unsigned Fanout>
+BTree<Key, Value, Compare, Fanout>::iterator::pointer::pointer(const reference& ref) :
+    ref_(ref)
+{
+
+}
+
+template<class Key, class Value, class Compare, unsigned Fanout>
+typename BTree<Key, Value, Compare, Fanout>::iterator::reference*
+BTree<Key, Value, Compare, Fanout>::iterator::pointer::operator->()
+{
+    return &ref_;
+}
+
+template<class Key, class Value, class Compare, unsigned Fanout>
+BTree<Key, Value, Compare, Fanout>::iterator::iterator() :
+    leaf_(nullptr), index_(0), tree_(nullptr)
+{
+
+}
+
+template<class Key, class Value, class Compare, unsigned Fanout>
+BTree<Key, Value, Compare, Fanout>::iterator::iterator(Leaf* leaf, unsigned index, const BTree* tree) :
+    leaf_(leaf), index_(index), tree_(tree)
+{
+
+}
+
+template<class Key, class Value, class Compare, unsigned Fanout>
+typename BTree<Key, Value, Compare, Fanout>::iterator::reference
+BTree<Key, Value, Compare, Fanout>::iterator::operator*() const
+{
+    return reference(leaf_->keys[index_], leaf_->values[index_]);
+}
+
+template<class Key, class Value, class Compare, unsigned Fanout>
+typename BTree<Key, Value, Compare, Fanout>::iterator::pointer
+BTree<Key, Value, Compare, Fanout>::iterator::operator->() const
+{
+    return pointer(**this);
+}
+
+template<class Key, class Value, class Compare, unsigned Fanout>
+bool BTree<Key, Value, Compare, Fanout>::iterator::operator==(const iterator& rhs) const
+{
+    return leaf_ == rhs.leaf_ && index_ == rhs.index_;
+}
+
+template<class Key, class Value, class Compare, unsigned Fanout>
+bool BTree<Key, Value, Compare, Fanout>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Moves to the next slot, and on to the next leaf past the last one.
+*/
+template<class Key, class Value, class Compare, unsigned Fanout>
+typename BTree<Key, Value, Compare, Fanout>::iterator&
+BTree<Key, Value, Compare, Fanout>::iterator::operator++()
+{
+    if(leaf_ == nullptr) {
+        return *this;
+    }
+    if(++index_ == leaf_->count) {
+        leaf_ = leaf_->next;
+        index_ = 0;
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Compare, unsigned Fanout>
+typename BTree<Key, Value, Compare, Fanout>::iterator
+BTree<Key, Value, Compare, Fanout>::iterator::operator++(int)
+{
+    iterator old = *this;
+    ++(*this);
+    return old;
+}
+
+/**
+* Decrementing end() gives the largest item; decrementing begin() is undefined.
+*/
+template<class Key, class Value, class Compare, unsigned Fanout>
+typename BTree<Key, Value, Compare, Fanout>::iterator&
+BTree<Key, Value, Compare, Fanout>::iterator::operator--()
+{
+    if(leaf_ == nullptr) {
+        leaf_ = tree_->last_;
+        index_ = leaf_->count;
+    }
+    else if(index_ == 0) {
+        leaf_ = leaf_->prev;
+        index_ = leaf_->count;
+    }
+    --index_;
+    return *this;
+}
+
+template<class Key, class Value, class Compare, unsigned Fanout>
+typename BTree<Key, Value, Compare, Fanout>::iterator
+BTree<Key, Value, Compare, Fanout>::iterator::operator--(int)
+{
+    iterator old = *this;
+    --(*this);
+    return old;
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the BTree::iterator class.
+  -------------------------------------------------
+*/
+
+/*
+  -----------------------------------------
+  Begin implementations for the BTree class.
+  -----------------------------------------
+*/
+
+template<class Key, class Value, class Compare, unsigned Fanout>
+BTree<Key, Value, Compare, Fanout>::NodeBase::NodeBase(bool isLeaf) :
+    leaf(isLeaf), count(0)
+{
+
+}
+
+template<class Key, class Value, class Compare, unsigned Fanout>
+BTree<Key, Value, Compare, Fanout>::Leaf::Leaf() :
+    NodeBase(true), prev(nullptr), next(nullptr)
+{
+
+}
+
+template<class Key, class Value, class Compare, unsigned Fanout>
+BTree<Key, Value, Compare, Fanout>::Inner::Inner() :
+    NodeBase(false)
+{
+
+}
+
+template<class Key, class Value, class Compare, unsigned Fanout>
+BTree<Key, Value, Compare, Fanout>::BTree() :
+    root_(nullptr), first_(nullptr), last_(nullptr), size_(0), comp_()
+{
+
+}
+
+template<class Key, class Value, class Compare, unsigned Fanout>
+BTree<Key, Value, Compare, Fanout>::BTree(const Compare& comp) :
+    root_(nullptr), first_(nullptr), last_(nullptr), size_(0), comp_(comp)
+{
+
+}
+
+template<class Key, class Value, class Compare, unsigned Fanout>
+BTree<Key, Value, Compare, Fanout>::~BTree()
+{
+    clear();
+}
+
+template<class Key, class Value, class Compare, unsigned Fanout>
+bool BTree<Key, Value, Compare, Fanout>::empty() const
+{
+    return size_ == 0;
+}
+
+template<class Key, class Value, class Compare, unsigned Fanout>
+std::size_t BTree<Key, Value, Compare, Fanout>::size() const
+{
+    return size_;
+}
+
+template<class Key, class Value, class Compare, unsigned Fanout>
+void BTree<Key, Value, Compare, Fanout>::clear()
+{
+    if(root_ != nullptr) {
+        destroy(root_);
+    }
+    root_ = nullptr;
+    first_ = last_ = nullptr;
+    size_ = 0;
+}
+
+/**
+* The recursion is only as deep as the tree, which is a few levels.
+*/
+template<class Key, class Value, class Compare, unsigned Fanout>
+void BTree<Key, Value, Compare, Fanout>::destroy(NodeBase* node)
+{
+    if(node->leaf) {
+        delete static_cast<Leaf*>(node);
+        return;
+    }
+    Inner* inner = static_cast<Inner*>(node);
+    for(unsigned i = 0; i <= inner->count; ++i) {
+        destroy(inner->children[i]);
+    }
+    delete inner;
+}
+
+template<class Key, class Value, class Compare, unsigned Fanout>
+std::size_t BTree<Key, Value, Compare, Fanout>::memoryUsage() const
+{
+    return root_ == nullptr ? 0 : nodeBytes(root_);
+}
+
+template<class Key, class Value, class Compare, unsigned Fanout>
+std::size_t BTree<Key, Value, Compare, Fanout>::nodeBytes(const NodeBase* node) const
+{
+    if(node->leaf) {
+        return sizeof(Leaf);
+    }
+    const Inner* inner = static_cast<const Inner*>(node);
+    std::size_t bytes = sizeof(Inner);
+    for(unsigned i = 0; i <= inner->count; ++i) {
+        bytes += nodeBytes(inner->children[i]);
+    }
+    return bytes;
+}
+
+template<class Key, class Value, class Compare, unsigned Fanout>
+typename BTree<Key, Value, Compare, Fanout>::iterator
+BTree<Key, Value, Compare, Fanout>::begin() const
+{
+    return iterator(first_, 0, this);
+}
+
+template<class Key, class Value, class Compare, unsigned Fanout>
+typename BTree<Key, Value, Compare, Fanout>::iterator
+BTree<Key, Value, Compare, Fanout>::end() const
+{
+    return iterator(nullptr, 0, this);
+}
+
+/**
+* Returns an iterator to the item with the given key, or end().
+*/
+template<class Key, class Value, class Compare, unsigned Fanout>
+typename BTree<Key, Value, Compare, Fanout>::iterator
+BTree<Key, Value, Compare, Fanout>::find(const Key& key) const
+{
+    if(root_ == nullptr) {
+        return end();
+    }
+    PathStep path[MAX_DEPTH];
+    unsigned depth;
+    Leaf* leaf = findLeaf(key, path, depth);
+    unsigned pos = lowerIndex(leaf, key);
+    if(pos == leaf->count || comp_(key, leaf->keys[pos])) {
+        return end();
+    }
+    return iterator(leaf, pos, this);
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key, like BinarySearchTree::operator[]
+ */
+template<class Key, class Value, class Compare, unsigned Fanout>
+Value& BTree<Key, Value, Compare, Fanout>::operator[](const Key& key)
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+template<class Key, class Value, class Compare, unsigned Fanout>
+Value const & BTree<Key, Value, Compare, Fanout>::operator[](const Key& key) const
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+/**
+* Walks from the root to the leaf whose range holds key, recording in path the
+* inner nodes passed and the child taken at each. The tree must not be empty.
+*/
+template<class Key, class Value, class Compare, unsigned Fanout>
+typename BTree<Key, Value, Compare, Fanout>::Leaf*
+BTree<Key, Value, Compare, Fanout>::findLeaf(const Key& key, PathStep* path, unsigned& depth) const
+{
+    depth = 0;
+    NodeBase* node = root_;
+    while(!node->leaf) {
+        Inner* inner = static_cast<Inner*>(node);
+        unsigned child = upperIndex(inner, key);
+        path[depth].node = inner;
+        path[depth].child = child;
+        ++depth;
+        node = inner->children[child];
+    }
+    return static_cast<Leaf*>(node);
+}
+
+/**
+* The number of keys in node less than key.
+*/
+template<class Key, class Value, class Compare, unsigned Fanout>
+unsigned BTree<Key, Value, Compare, Fanout>::lowerIndex(const NodeBase* node, const Key& key) const
+{
+    return lowerIndex(node, key, std::integral_constant<bool, std::is_arithmetic<Key>::value>());
+}
+
+/**
+* The number of keys in node not greater than key, which is the child of an
+* inner node to descend into.
+*/
+template<class Key, class Value, class Compare, unsigned Fanout>
+unsigned BTree<Key, Value, Compare, Fanout>::upperIndex(const NodeBase* node, const Key& key) const
+{
+    return upperIndex(node, key, std::integral_constant<bool, std::is_arithmetic<Key>::value>());
+}
+
+/**
+* Arithmetic keys are cheap to compare, so every key is compared and the
+* results summed: no branch depends on the data, and the loop vectorizes.
+*/
+template<class Key, class Value, class Compare, unsigned Fanout>
+unsigned BTree<Key, Value, Compare, Fanout>::lowerIndex(const NodeBase* node, const Key& key,
+                                                       std::true_type) const
+{
+    unsigned index = 0;
+    for(unsigned i = 0; i < node->count; ++i) {
+        index += comp_(node->keys[i], key) ? 1 : 0;
+    }
+    return index;
+}
+
+template<class Key, class Value, class Compare, unsigned Fanout>
+unsigned BTree<Key, Value, Compare, Fanout>::lowerIndex(const NodeBase* node, const Key& key,
+                                                       std::false_type) const
+{
+    return std::lower_bound(node->keys, node->keys + node->count, key, comp_) - node->keys;
+}
+
+template<class Key, class Value, class Compare, unsigned Fanout>
+unsigned BTree<Key, Value, Compare, Fanout>::upperIndex(const NodeBase* node, const Key& key,
+                                                       std::true_type) const
+{
+    unsigned index = 0;
+    for(unsigned i = 0; i < node->count; ++i) {
+        index += comp_(key, node->keys[i]) ? 0 : 1;
+    }
+    return index;
+}
+
+template<class Key, class Value, class Compare, unsigned Fanout>
+unsigned BTree<Key, Value, Compare, Fanout>::upperIndex(const NodeBase* node, const Key& key,
+                                                       std::false_type) const
+{
+    return std::upper_bound(node->keys, node->keys + node->count, key, comp_) - node->keys;
+}
+
+/**
+* Inserts the item, or overwrites the value if the key is already present.
+* A full leaf is split in two and the split carried up as far as needed.
+*/
+template<class Key, class Value, class Compare, unsigned Fanout>
+void BTree<Key, Value, Compare, Fanout>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    const Key& key = keyValuePair.first;
+    if(root_ == nullptr) {
+        Leaf* leaf = new Leaf();
+        insertIntoLeaf(leaf, 0, key, keyValuePair.second);
+        root_ = first_ = last_ = leaf;
+        size_ = 1;
+        return;
+    }
+    PathStep path[MAX_DEPTH];
+    unsigned depth;
+    Leaf* leaf = findLeaf(key, path, depth);
+    unsigned pos = lowerIndex(leaf, key);
+    if(pos < leaf->count && !comp_(key, leaf->keys[pos])) {
+        leaf->values[pos] = keyValuePair.second;
+        return;
+    }
+    ++size_;
+    if(leaf->count < MAX_KEYS) {
+        insertIntoLeaf(leaf, pos, key, keyValuePair.second);
+        return;
+    }
+    Leaf* right = splitLeaf(leaf, pos, key, keyValuePair.second);
+    insertSeparator(path, depth, right->keys[0], right);
+}
+
+template<class Key, class Value, class Compare, unsigned Fanout>
+void BTree<Key, Value, Compare, Fanout>::insertIntoLeaf(Leaf* leaf, unsigned pos, const Key& key, const Value& value)
+{
+    std::move_backward(leaf->keys + pos, leaf->keys + leaf->count, leaf->keys + leaf->count + 1);
+    std::move_backward(leaf->values + pos, leaf->values + leaf->count, leaf->values + leaf->count + 1);
+    leaf->keys[pos] = key;
+    leaf->values[pos] = value;
+    ++leaf->count;
+}
+
+/**
+* Splits a full leaf while inserting the item at pos, leaving the lower half
+* in leaf and returning the new right sibling with the upper half.
+*/
+template<class Key, class Value, class Compare, unsigned Fanout>
+typename BTree<Key, Value, Compare, Fanout>::Leaf*
+BTree<Key, Value, Compare, Fanout>::splitLeaf(Leaf* leaf, unsigned pos, const Key& key, const Value& value)
+{
+    //MAX_KEYS + 1 items in all, the left half keeping the extra one
+    const unsigned leftCount = (MAX_KEYS + 2) / 2;
+    Leaf* right = new Leaf();
+    //if the new item goes left, one more of the old ones has to move right
+    unsigned moveFrom = pos < leftCount ? leftCount - 1 : leftCount;
+    std::move(leaf->keys + moveFrom, leaf->keys + leaf->count, right->keys);
+    std::move(leaf->values + moveFrom, leaf->values + leaf->count, right->values);
+    right->count = leaf->count - moveFrom;
+    leaf->count = moveFrom;
+    if(pos < leftCount) {
+        insertIntoLeaf(leaf, pos, key, value);
+    }
+    else {
+        insertIntoLeaf(right, pos - leftCount, key, value);
+    }
+
+    right->prev = leaf;
+    right->next = leaf->next;
+    if(leaf->next != nullptr) {
+        leaf->next->prev = right;
+    }
+    else {
+        last_ = right;
+    }
+    leaf->next = right;
+    return right;
+}
+
+/**
+* Adds separator and the new node right just after the child taken at the
+* bottom of path, splitting full inner nodes on the way up and growing a new
+* root if the old one splits.
+*/
+template<class Key, class Value, class Compare, unsigned Fanout>
+void BTree<Key, Value, Compare, Fanout>::insertSeparator(PathStep* path, unsigned depth,
+                                                         const Key& separator, NodeBase* right)
+{
+    Key pending = separator;
+    while(depth > 0) {
+        --depth;
+        Inner* node = path[depth].node;
+        unsigned pos = path[depth].child;
+        if(node->count < MAX_KEYS) {
+            insertIntoInner(node, pos, pending, right);
+            return;
+        }
+        //split around the middle key, which moves up instead of staying in either half
+        const unsigned mid = MAX_KEYS / 2;
+        Inner* sibling = new Inner();
+        Key up = std::move(node->keys[mid]);
+        std::move(node->keys + mid + 1, node->keys + MAX_KEYS, sibling->keys);
+        std::copy(node->children + mid + 1, node->children + MAX_KEYS + 1, sibling->children);
+        sibling->count = MAX_KEYS - mid - 1;
+        node->count = mid;
+        if(pos <= mid) {
+            insertIntoInner(node, pos, pending, right);
+        }
+        else {
+            insertIntoInner(sibling, pos - mid - 1, pending, right);
+        }
+        pending = std::move(up);
+        right = sibling;
+    }
+    Inner* root = new Inner();
+    root->keys[0] = std::move(pending);
+    root->children[0] = root_;
+    root->children[1] = right;
+    root->count = 1;
+    root_ = root;
+}
+
+/**
+* Inserts separator at pos with right as the child just after it.
+*/
+template<class Key, class Value, class Compare, unsigned Fanout>
+void BTree<Key, Value, Compare, Fanout>::insertIntoInner(Inner* node, unsigned pos, const Key& separator, NodeBase* right)
+{
+    std::move_backward(node->keys + pos, node->keys + node->count, node->keys + node->count + 1);
+    std::copy_backward(node->children + pos + 1, node->children + node->count + 1,
+                       node->children + node->count + 2);
+    node->keys[pos] = separator;
+    node->children[pos + 1] = right;
+    ++node->count;
+}
+
+/**
+* Removes the item with the given key, if present. A leaf left with fewer
+* than MIN_KEYS items borrows one from a sibling or merges with it, and a
+* merge can carry the underflow up the path.
+*/
+template<class Key, class Value, class Compare, unsigned Fanout>
+void BTree<Key, Value, Compare, Fanout>::remove(const Key& key)
+{
+    if(root_ == nullptr) {
+        return;
+    }
+    PathStep path[MAX_DEPTH];
+    unsigned depth;
+    Leaf* leaf = findLeaf(key, path, depth);
+    unsigned pos = lowerIndex(leaf, key);
+    if(pos == leaf->count || comp_(key, leaf->keys[pos])) {
+        return;
+    }
+    eraseFromLeaf(leaf, pos);
+    --size_;
+    if(depth == 0) {
+        //the root leaf may hold any number of items
+        if(leaf->count == 0) {
+            delete leaf;
+            root_ = nullptr;
+            first_ = last_ = nullptr;
+        }
+        return;
+    }
+    if(leaf->count < MIN_KEYS) {
+        fixLeafUnderflow(leaf, path, depth);
+    }
+}
+
+template<class Key, class Value, class Compare, unsigned Fanout>
+void BTree<Key, Value, Compare, Fanout>::eraseFromLeaf(Leaf* leaf, unsigned pos)
+{
+    std::move(leaf->keys + pos + 1, leaf->keys + leaf->count, leaf->keys + pos);
+    std::move(leaf->values + pos + 1, leaf->values + leaf->count, leaf->values + pos);
+    --leaf->count;
+}
+
+/**
+* Refills a leaf that has dropped below MIN_KEYS from its left or right
+* sibling under the same parent, or merges the two if neither can spare one.
+*/
+template<class Key, class Value, class Compare, unsigned Fanout>
+void BTree<Key, Value, Compare, Fanout>::fixLeafUnderflow(Leaf* leaf, PathStep* path, unsigned depth)
+{
+    Inner* parent = path[depth - 1].node;
+    unsigned child = path[depth - 1].child;
+    Leaf* left = child > 0 ? static_cast<Leaf*>(parent->children[child - 1]) : nullptr;
+    Leaf* right = child < parent->count ? static_cast<Leaf*>(parent->children[child + 1]) : nullptr;
+
+    if(left != nullptr && left->count > MIN_KEYS) {
+        insertIntoLeaf(leaf, 0, left->keys[left->count - 1], left->values[left->count - 1]);
+        --left->count;
+        parent->keys[child - 1] = leaf->keys[0];
+        return;
+    }
+    if(right != nullptr && right->count > MIN_KEYS) {
+        insertIntoLeaf(leaf, leaf->count, right->keys[0], right->values[0]);
+        eraseFromLeaf(right, 0);
+        parent->keys[child] = right->keys[0];
+        return;
+    }
+
+    //merge the right one of the pair into the left one
+    unsigned separator = left != nullptr ? child - 1 : child;
+    Leaf* into = left != nullptr ? left : leaf;
+    Leaf* from = left != nullptr ? leaf : right;
+    std::move(from->keys, from->keys + from->count, into->keys + into->count);
+    std::move(from->values, from->values + from->count, into->values + into->count);
+    into->count += from->count;
+    into->next = from->next;
+    if(from->next != nullptr) {
+        from->next->prev = into;
+    }
+    else {
+        last_ = into;
+    }
+    delete from;
+    removeChild(parent, separator);
+    fixInnerUnderflow(parent, path, depth - 1);
+}
+
+/**
+* Drops the separator at index separator and the child just after it.
+*/
+template<class Key, class Value, class Compare, unsigned Fanout>
+void BTree<Key, Value, Compare, Fanout>::removeChild(Inner* parent, unsigned separator)
+{
+    std::move(parent->keys + separator + 1, parent->keys + parent->count, parent->keys + separator);
+    std::copy(parent->children + separator + 2, parent->children + parent->count + 1,
+              parent->children + separator + 1);
+    --parent->count;
+}
+
+/**
+* The inner node at path[depth] has just lost a child. The root only shrinks
+* once it has a single child left, which then becomes the root; any other node
+* below MIN_KEYS rotates a key through the parent or merges with a sibling.
+*/
+template<class Key, class Value, class Compare, unsigned Fanout>
+void BTree<Key, Value, Compare, Fanout>::fixInnerUnderflow(Inner* node, PathStep* path, unsigned depth)
+{
+    while(true) {
+        if(depth == 0) {
+            if(node->count == 0) {
+                root_ = node->children[0];
+                delete node;
+            }
+            return;
+        }
+        if(node->count >= MIN_KEYS) {
+            return;
+        }
+        Inner* parent = path[depth - 1].node;
+        unsigned child = path[depth - 1].child;
+        Inner* left = child > 0 ? static_cast<Inner*>(parent->children[child - 1]) : nullptr;
+        Inner* right = child < parent->count ? static_cast<Inner*>(parent->children[child + 1]) : nullptr;
+
+        if(left != nullptr && left->count > MIN_KEYS) {
+            //the parent's separator comes down in front, left's last key goes up
+            std::move_backward(node->keys, node->keys + node->count, node->keys + node->count + 1);
+            std::copy_backward(node->children, node->children + node->count + 1,
+                               node->children + node->count + 2);
+            node->keys[0] = std::move(parent->keys[child - 1]);
+            node->children[0] = left->children[left->count];
+            ++node->count;
+            parent->keys[child - 1] = std::move(left->keys[left->count - 1]);
+            --left->count;
+            return;
+        }
+        if(right != nullptr && right->count > MIN_KEYS) {
+            node->keys[node->count] = std::move(parent->keys[child]);
+            node->children[node->count + 1] = right->children[0];
+            ++node->count;
+            parent->keys[child] = std::move(right->keys[0]);
+            std::move(right->keys + 1, right->keys + right->count, right->keys);
+            std::copy(right->children + 1, right->children + right->count + 1, right->children);
+            --right->count;
+            return;
+        }
+
+        //merge the right one of the pair, with the separator between them, into the left one
+        unsigned separator = left != nullptr ? child - 1 : child;
+        Inner* into = left != nullptr ? left : node;
+        Inner* from = left != nullptr ? node : right;
+        into->keys[into->count] = std::move(parent->keys[separator]);
+        std::move(from->keys, from->keys + from->count, into->keys + into->count + 1);
+        std::copy(from->children, from->children + from->count + 1, into->children + into->count + 1);
+        into->count += from->count + 1;
+        delete from;
+        removeChild(parent, separator);
+        node = parent;
+        --depth;
+    }
+}
+
+/*
+  ---------------------------------------
+  End implementations for the BTree class.
+  ---------------------------------------
+*/
+
+#endif
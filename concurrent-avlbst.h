@@ -0,0 +1,1030 @@
+#ifndef CONCURRENT_AVLBST_H
+#define CONCURRENT_AVLBST_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include "bst.h"
+#include "epoch-domain.h"
+
+/**
+ * An AVL map that many threads can use at once, after the optimistic
+ * relaxed-balance tree of Bronson, Casper, Chafi and Olukotun. find() takes no
+ * locks: it walks down hand over hand, reading each node's version before
+ * descending and checking afterwards that the node has not been rotated down
+ * or unlinked in the meantime, retrying from the parent if it has. Writers lock
+ * only the node they change, its parent when unlinking, and the nodes taking
+ * part in a rotation.
+ *
+ * Removing a node with two children just clears its value and leaves it as a
+ * routing node; routing nodes are unlinked once they have at most one child.
+ * Balance is repaired after each change by the thread that made it, so the tree
+ * may be briefly out of balance while writers are running but is a proper AVL
+ * tree again once they are done.
+ *
+ * Unlinked nodes and replaced values go to an EpochDomain and are freed once no
+ * running operation can still see them. Nodes and values come from new, since
+ * they are allocated concurrently and the arena allocator is single threaded.
+ *
+ * There are no iterators; clear(), size(), empty() and isBalanced() need the
+ * tree to themselves.
+ */
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class ConcurrentAVLTree
+{
+public:
+    explicit ConcurrentAVLTree(const Compare& comp = Compare());
+    ~ConcurrentAVLTree();
+
+    bool insert(const std::pair<const Key, Value>& keyValuePair);
+    bool remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+
+    void clear();
+    bool empty() const;
+    std::size_t size() const;
+    bool isBalanced() const;
+
+private:
+    ConcurrentAVLTree(const ConcurrentAVLTree&) = delete;
+    ConcurrentAVLTree& operator=(const ConcurrentAVLTree&) = delete;
+
+    typedef std::uint64_t Version;
+
+    // A version is a change count times CHANGE_STEP plus these flag bits
+    static const Version UNLINKED = 1;
+    static const Version CHANGING = 2;
+    static const Version CHANGE_STEP = 4;
+
+    // nodeCondition() results; anything else is the height the node should have
+    static const int UNLINK_REQUIRED = -1;
+    static const int REBALANCE_REQUIRED = -2;
+    static const int NOTHING_REQUIRED = -3;
+
+    static const unsigned SPIN_LIMIT = 64;
+
+    // Deeper than any AVL tree that fits in memory; past it revisits are dropped
+    static const unsigned MAX_REVISITS = 64;
+
+    // A test-and-test-and-set lock that yields after a few spins
+    class NodeLock
+    {
+    public:
+        NodeLock() : held_(false) { }
+        void lock();
+        void unlock();
+
+    private:
+        std::atomic<bool> held_;
+    };
+
+    struct Node;
+
+    // Everything but the key, so the root holder needs no Key
+    struct Links
+    {
+        Links(Links* parent, Value* value) :
+            version(0), height(parent == nullptr ? 0 : 1),
+            parent(parent), left(nullptr), right(nullptr), value(value) { }
+
+        std::atomic<Node*>& child(int dir) { return dir < 0 ? left : right; }
+
+        std::atomic<Version> version;
+        std::atomic<int> height;
+        std::atomic<Links*> parent;
+        std::atomic<Node*> left;
+        std::atomic<Node*> right;
+        std::atomic<Value*> value;      // nullptr for a routing node
+        NodeLock lock;
+    };
+
+    struct Node : Links
+    {
+        Node(const Key& key, Value* value, Links* parent) :
+            Links(parent, value), key(key) { }
+
+        const Key key;
+    };
+
+    typedef EpochDomain::Guard Guard;
+
+    static bool isChanging(Version version) { return (version & CHANGING) != 0; }
+    static bool isUnlinked(Version version) { return (version & UNLINKED) != 0; }
+    static bool isChangingOrUnlinked(Version version) { return (version & (CHANGING | UNLINKED)) != 0; }
+    static int height(const Node* node) { return node == nullptr ? 0 : node->height.load(); }
+    static void waitUntilChangeCompleted(const Links* node, Version version);
+
+    Value* getValue(const Key& key) const;
+    bool attemptGet(const Key& key, Node* node, int dir, Version nodeVersion, Value*& result) const;
+
+    Value* update(const Key& key, Value* newValue, Guard& guard);
+    bool attemptInsertIntoEmpty(const Key& key, Value* newValue);
+    bool attemptUpdate(const Key& key, Value* newValue, Links* parent, Node* node,
+                       Version nodeVersion, Value*& previous, Guard& guard);
+    bool attemptNodeUpdate(Value* newValue, Links* parent, Node* node, Value*& previous, Guard& guard);
+    bool attemptUnlinkLocked(Links* parent, Node* node, Guard& guard);
+
+    int nodeCondition(Links* node) const;
+    Links* fixHeightLocked(Links* node);
+    void fixHeightAndRebalance(Links* node, Guard& guard);
+    Links* rebalanceLocked(Links* nParent, Node* n, Guard& guard);
+    Links* rebalanceToRightLocked(Links* nParent, Node* n, Node* nL, int hR0);
+    Links* rebalanceToLeftLocked(Links* nParent, Node* n, Node* nR, int hL0);
+    Links* rotateRightLocked(Links* nParent, Node* n, Node* nL, int hR, int hLL, Node* nLR, int hLR);
+    Links* rotateLeftLocked(Links* nParent, Node* n, int hL, Node* nR, Node* nRL, int hRL, int hRR);
+    Links* rotateRightOverLeftLocked(Links* nParent, Node* n, Node* nL, int hR, int hLL, Node* nLR, int hLRL);
+    Links* rotateLeftOverRightLocked(Links* nParent, Node* n, int hL, Node* nR, Node* nRL, int hRR, int hRLR);
+
+    void clearHelper(Node* node);
+    std::size_t sizeHelper(const Node* node) const;
+    int checkBalance(const Node* node) const;
+
+    // holder_.right is the root; holder_ itself has no key and no parent
+    Links holder_;
+    Compare comp_;
+    mutable EpochDomain domain_;
+};
+
+/*
+  --------------------------------------------------------
+  Begin implementations for the ConcurrentAVLTree class.
+  --------------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::NodeLock::lock()
+{
+    unsigned spins = 0;
+    while(held_.exchange(true, std::memory_order_acquire)) {
+        while(held_.load(std::memory_order_relaxed)) {
+            if(++spins >= SPIN_LIMIT) {
+                std::this_thread::yield();
+            }
+        }
+    }
+}
+
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::NodeLock::unlock()
+{
+    held_.store(false, std::memory_order_release);
+}
+
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::ConcurrentAVLTree(const Compare& comp) :
+    holder_(nullptr, nullptr),
+    comp_(comp)
+{
+
+}
+
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::~ConcurrentAVLTree()
+{
+    clear();
+}
+
+/**
+* Sets key's value, adding the key if it is absent. Returns whether it was added.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    std::unique_ptr<Value> value(new Value(keyValuePair.second));
+    Guard guard(domain_);
+    Value* previous = update(keyValuePair.first, value.get(), guard);
+    value.release();
+    if(previous != nullptr) {
+        guard.retire(previous);
+    }
+    return previous == nullptr;
+}
+
+/**
+* Removes key if it is present. Returns whether it was.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    Guard guard(domain_);
+    Value* previous = update(key, nullptr, guard);
+    if(previous != nullptr) {
+        guard.retire(previous);
+    }
+    return previous != nullptr;
+}
+
+/**
+* Copies key's value into value and returns true, or returns false if key is absent.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::find(const Key& key, Value& value) const
+{
+    Guard guard(domain_);
+    Value* found = getValue(key);
+    if(found == nullptr) {
+        return false;
+    }
+    value = *found;
+    return true;
+}
+
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::contains(const Key& key) const
+{
+    Guard guard(domain_);
+    return getValue(key) != nullptr;
+}
+
+/**
+* Deletes every node and value. Not safe against concurrent operations.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::clear()
+{
+    clearHelper(holder_.right.load());
+    holder_.right.store(nullptr);
+}
+
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::empty() const
+{
+    return size() == 0;
+}
+
+/**
+* Counts the keys present, skipping routing nodes. Not safe against concurrent writers.
+*/
+template<class Key, class Value, class Compare>
+std::size_t ConcurrentAVLTree<Key, Value, Compare>::size() const
+{
+    return sizeHelper(holder_.right.load());
+}
+
+/**
+* Checks the AVL property and the stored heights. Not safe against concurrent writers.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::isBalanced() const
+{
+    return checkBalance(holder_.right.load()) >= 0;
+}
+
+/**
+* A node's version only changes while its writer holds the node's lock, so
+* spinning briefly and then yielding is enough to see the change through.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::waitUntilChangeCompleted(const Links* node, Version version)
+{
+    if(!isChanging(version)) {
+        return;
+    }
+    for(unsigned spins = 0; node->version.load() == version; ++spins) {
+        if(spins >= SPIN_LIMIT) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+/**
+* Returns the value pointer for key, or nullptr; only valid inside the caller's guard.
+*/
+template<class Key, class Value, class Compare>
+Value* ConcurrentAVLTree<Key, Value, Compare>::getValue(const Key& key) const
+{
+    while(true) {
+        Node* right = holder_.right.load();
+        if(right == nullptr) {
+            return nullptr;
+        }
+        int dir = threeWayCompare(comp_, key, right->key);
+        if(dir == 0) {
+            return right->value.load();
+        }
+        Version version = right->version.load();
+        if(isChangingOrUnlinked(version)) {
+            waitUntilChangeCompleted(right, version);
+        }
+        else if(right == holder_.right.load()) {
+            Value* result;
+            if(attemptGet(key, right, dir, version, result)) {
+                return result;
+            }
+        }
+    }
+}
+
+/**
+* Searches below node, whose version was nodeVersion when it was reached.
+* Returns false if node changed in a way that may have moved key out of its
+* subtree, in which case the caller has to retry from its own node.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::attemptGet(const Key& key, Node* node, int dir,
+                                                       Version nodeVersion, Value*& result) const
+{
+    while(true) {
+        Node* child = node->child(dir).load();
+        if(child == nullptr) {
+            if(node->version.load() != nodeVersion) {
+                return false;
+            }
+            result = nullptr;
+            return true;
+        }
+        int childDir = threeWayCompare(comp_, key, child->key);
+        if(childDir == 0) {
+            result = child->value.load();
+            return true;
+        }
+        Version childVersion = child->version.load();
+        if(isChangingOrUnlinked(childVersion)) {
+            waitUntilChangeCompleted(child, childVersion);
+            if(node->version.load() != nodeVersion) {
+                return false;
+            }
+        }
+        else if(child != node->child(dir).load()) {
+            if(node->version.load() != nodeVersion) {
+                return false;
+            }
+        }
+        else {
+            if(node->version.load() != nodeVersion) {
+                return false;
+            }
+            if(attemptGet(key, child, childDir, childVersion, result)) {
+                return true;
+            }
+        }
+    }
+}
+
+/**
+* Sets key's value to newValue, or removes key if newValue is nullptr, and
+* returns the value it replaced (nullptr if key was absent). The caller
+* retires the returned value.
+*/
+template<class Key, class Value, class Compare>
+Value* ConcurrentAVLTree<Key, Value, Compare>::update(const Key& key, Value* newValue, Guard& guard)
+{
+    while(true) {
+        Node* right = holder_.right.load();
+        if(right == nullptr) {
+            if(newValue == nullptr || attemptInsertIntoEmpty(key, newValue)) {
+                return nullptr;
+            }
+        }
+        else {
+            Version version = right->version.load();
+            if(isChangingOrUnlinked(version)) {
+                waitUntilChangeCompleted(right, version);
+            }
+            else if(right == holder_.right.load()) {
+                Value* previous;
+                if(attemptUpdate(key, newValue, &holder_, right, version, previous, guard)) {
+                    return previous;
+                }
+            }
+        }
+    }
+}
+
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::attemptInsertIntoEmpty(const Key& key, Value* newValue)
+{
+    std::lock_guard<NodeLock> lock(holder_.lock);
+    if(holder_.right.load() != nullptr) {
+        return false;
+    }
+    holder_.right.store(new Node(key, newValue, &holder_));
+    return true;
+}
+
+/**
+* The update counterpart of attemptGet(). A missing child is filled in under
+* node's lock once node is known not to have changed since it was reached.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::attemptUpdate(const Key& key, Value* newValue,
+                                                          Links* parent, Node* node, Version nodeVersion,
+                                                          Value*& previous, Guard& guard)
+{
+    int dir = threeWayCompare(comp_, key, node->key);
+    if(dir == 0) {
+        return attemptNodeUpdate(newValue, parent, node, previous, guard);
+    }
+    while(true) {
+        Node* child = node->child(dir).load();
+        if(node->version.load() != nodeVersion) {
+            return false;
+        }
+        if(child == nullptr) {
+            if(newValue == nullptr) {
+                previous = nullptr;
+                return true;
+            }
+            Links* damaged = nullptr;
+            bool linked = false;
+            {
+                std::lock_guard<NodeLock> lock(node->lock);
+                if(node->version.load() != nodeVersion) {
+                    return false;
+                }
+                if(node->child(dir).load() == nullptr) {
+                    node->child(dir).store(new Node(key, newValue, node));
+                    damaged = fixHeightLocked(node);
+                    linked = true;
+                }
+            }
+            if(linked) {
+                fixHeightAndRebalance(damaged, guard);
+                previous = nullptr;
+                return true;
+            }
+        }
+        else {
+            Version childVersion = child->version.load();
+            if(isChangingOrUnlinked(childVersion)) {
+                waitUntilChangeCompleted(child, childVersion);
+            }
+            else if(child == node->child(dir).load()) {
+                if(node->version.load() != nodeVersion) {
+                    return false;
+                }
+                if(attemptUpdate(key, newValue, node, child, childVersion, previous, guard)) {
+                    return true;
+                }
+            }
+        }
+    }
+}
+
+/**
+* Updates the node holding the key. A removal that leaves node with fewer than
+* two children unlinks it, which needs the parent's lock as well; otherwise
+* only the value changes (a removal leaving a routing node behind).
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::attemptNodeUpdate(Value* newValue, Links* parent, Node* node,
+                                                              Value*& previous, Guard& guard)
+{
+    if(newValue == nullptr && node->value.load() == nullptr) {
+        previous = nullptr;
+        return true;
+    }
+    if(newValue == nullptr && (node->left.load() == nullptr || node->right.load() == nullptr)) {
+        Links* damaged;
+        {
+            std::lock_guard<NodeLock> parentLock(parent->lock);
+            if(isUnlinked(parent->version.load()) || node->parent.load() != parent) {
+                return false;
+            }
+            {
+                std::lock_guard<NodeLock> nodeLock(node->lock);
+                previous = node->value.load();
+                if(previous == nullptr) {
+                    return true;
+                }
+                if(!attemptUnlinkLocked(parent, node, guard)) {
+                    return false;
+                }
+            }
+            damaged = fixHeightLocked(parent);
+        }
+        fixHeightAndRebalance(damaged, guard);
+        return true;
+    }
+
+    std::lock_guard<NodeLock> lock(node->lock);
+    if(isUnlinked(node->version.load())) {
+        return false;
+    }
+    previous = node->value.load();
+    if(newValue == nullptr) {
+        if(previous == nullptr) {
+            return true;
+        }
+        //a child went away since we looked, so this should be an unlink now
+        if(node->left.load() == nullptr || node->right.load() == nullptr) {
+            return false;
+        }
+    }
+    node->value.store(newValue);
+    return true;
+}
+
+/**
+* Splices node (with at most one child) out from under parent; both are locked.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::attemptUnlinkLocked(Links* parent, Node* node, Guard& guard)
+{
+    Node* parentLeft = parent->left.load();
+    Node* parentRight = parent->right.load();
+    if(parentLeft != node && parentRight != node) {
+        return false;
+    }
+    Node* left = node->left.load();
+    Node* right = node->right.load();
+    if(left != nullptr && right != nullptr) {
+        return false;
+    }
+    Node* splice = left != nullptr ? left : right;
+    if(parentLeft == node) {
+        parent->left.store(splice);
+    }
+    else {
+        parent->right.store(splice);
+    }
+    if(splice != nullptr) {
+        splice->parent.store(parent);
+    }
+    node->version.store(UNLINKED);
+    node->value.store(nullptr);
+    guard.retire(node);
+    return true;
+}
+
+/**
+* What node needs: to be unlinked (a routing node with a free child slot), a
+* rotation, a new height (returned), or nothing.
+*/
+template<class Key, class Value, class Compare>
+int ConcurrentAVLTree<Key, Value, Compare>::nodeCondition(Links* node) const
+{
+    Node* nL = node->left.load();
+    Node* nR = node->right.load();
+    if((nL == nullptr || nR == nullptr) && node->value.load() == nullptr) {
+        return UNLINK_REQUIRED;
+    }
+    int hN = node->height.load();
+    int hL0 = height(nL);
+    int hR0 = height(nR);
+    int hNRepl = 1 + std::max(hL0, hR0);
+    int bal = hL0 - hR0;
+    if(bal < -1 || bal > 1) {
+        return REBALANCE_REQUIRED;
+    }
+    return hN != hNRepl ? hNRepl : NOTHING_REQUIRED;
+}
+
+/**
+* Fixes node's height if that is all it needs. Returns the next node that may
+* need attention: node itself if it needs more than a height fix, its parent
+* if its height changed, or nullptr.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Links*
+ConcurrentAVLTree<Key, Value, Compare>::fixHeightLocked(Links* node)
+{
+    int condition = nodeCondition(node);
+    switch(condition) {
+    case REBALANCE_REQUIRED:
+    case UNLINK_REQUIRED:
+        return node;
+    case NOTHING_REQUIRED:
+        return nullptr;
+    default:
+        node->height.store(condition);
+        return node->parent.load();
+    }
+}
+
+/**
+* Walks up from node repairing heights, balance and routing nodes until
+* nothing is left to do or the root holder is reached.
+*
+* A rotation can hand back a node below nParent while nParent's own height is
+* now stale too, and repairing the deeper node need not change any height on
+* the way back up. Such parents are kept on a short stack and revisited once
+* the walk from the deeper node runs out.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::fixHeightAndRebalance(Links* node, Guard& guard)
+{
+    Links* revisit[MAX_REVISITS];
+    unsigned revisits = 0;
+    while(true) {
+        if(node == nullptr || node->parent.load() == nullptr || isUnlinked(node->version.load())) {
+            if(revisits == 0) {
+                return;
+            }
+            node = revisit[--revisits];
+            continue;
+        }
+        int condition = nodeCondition(node);
+        if(condition == NOTHING_REQUIRED) {
+            node = nullptr;
+        }
+        else if(condition != UNLINK_REQUIRED && condition != REBALANCE_REQUIRED) {
+            std::lock_guard<NodeLock> lock(node->lock);
+            node = fixHeightLocked(node);
+        }
+        else {
+            Links* nParent = node->parent.load();
+            std::lock_guard<NodeLock> parentLock(nParent->lock);
+            if(!isUnlinked(nParent->version.load()) && node->parent.load() == nParent) {
+                std::lock_guard<NodeLock> nodeLock(node->lock);
+                node = rebalanceLocked(nParent, static_cast<Node*>(node), guard);
+                if(node != nullptr && node != nParent && revisits < MAX_REVISITS &&
+                   (revisits == 0 || revisit[revisits - 1] != nParent)) {
+                    revisit[revisits++] = nParent;
+                }
+            }
+        }
+    }
+}
+
+/**
+* With nParent and n locked, unlinks n if it is a removable routing node or
+* starts a rotation if it is out of balance. Returns the next damaged node.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Links*
+ConcurrentAVLTree<Key, Value, Compare>::rebalanceLocked(Links* nParent, Node* n, Guard& guard)
+{
+    Node* nL = n->left.load();
+    Node* nR = n->right.load();
+    if((nL == nullptr || nR == nullptr) && n->value.load() == nullptr) {
+        if(attemptUnlinkLocked(nParent, n, guard)) {
+            return fixHeightLocked(nParent);
+        }
+        return n;
+    }
+    int hN = n->height.load();
+    int hL0 = height(nL);
+    int hR0 = height(nR);
+    int hNRepl = 1 + std::max(hL0, hR0);
+    int bal = hL0 - hR0;
+    if(bal > 1) {
+        return rebalanceToRightLocked(nParent, n, nL, hR0);
+    }
+    if(bal < -1) {
+        return rebalanceToLeftLocked(nParent, n, nR, hL0);
+    }
+    if(hNRepl != hN) {
+        n->height.store(hNRepl);
+        return fixHeightLocked(nParent);
+    }
+    return nullptr;
+}
+
+/**
+* n's left side is too tall. Rotates right, first rotating nL left when its
+* right side is the taller (as one double rotation when that leaves nL sound).
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Links*
+ConcurrentAVLTree<Key, Value, Compare>::rebalanceToRightLocked(Links* nParent, Node* n, Node* nL, int hR0)
+{
+    std::lock_guard<NodeLock> leftLock(nL->lock);
+    int hL = nL->height.load();
+    if(hL - hR0 <= 1) {
+        return n;
+    }
+    Node* nLR = nL->right.load();
+    int hLL0 = height(nL->left.load());
+    int hLR0 = height(nLR);
+    if(hLL0 >= hLR0) {
+        return rotateRightLocked(nParent, n, nL, hR0, hLL0, nLR, hLR0);
+    }
+    {
+        std::lock_guard<NodeLock> leftRightLock(nLR->lock);
+        int hLR = nLR->height.load();
+        if(hLL0 >= hLR) {
+            return rotateRightLocked(nParent, n, nL, hR0, hLL0, nLR, hLR);
+        }
+        Node* nLRL = nLR->left.load();
+        int hLRL = height(nLRL);
+        int b = hLL0 - hLRL;
+        if(b >= -1 && b <= 1) {
+            if(!((hLL0 == 0 || hLRL == 0) && nL->value.load() == nullptr)) {
+                return rotateRightOverLeftLocked(nParent, n, nL, hR0, hLL0, nLR, hLRL);
+            }
+            //the double rotation would leave nL a routing node to unlink beside
+            //n rather than above it, so lift nLR on its own and keep the damage
+            //on one path
+            return rotateLeftLocked(n, nL, hLL0, nLR, nLRL, hLRL, height(nLR->right.load()));
+        }
+    }
+    //fix nL on its own; n is rebalanced later if it still needs it
+    return rebalanceToLeftLocked(n, nL, nLR, hLL0);
+}
+
+/**
+* The mirror image of rebalanceToRightLocked().
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Links*
+ConcurrentAVLTree<Key, Value, Compare>::rebalanceToLeftLocked(Links* nParent, Node* n, Node* nR, int hL0)
+{
+    std::lock_guard<NodeLock> rightLock(nR->lock);
+    int hR = nR->height.load();
+    if(hL0 - hR >= -1) {
+        return n;
+    }
+    Node* nRL = nR->left.load();
+    int hRL0 = height(nRL);
+    int hRR0 = height(nR->right.load());
+    if(hRR0 >= hRL0) {
+        return rotateLeftLocked(nParent, n, hL0, nR, nRL, hRL0, hRR0);
+    }
+    {
+        std::lock_guard<NodeLock> rightLeftLock(nRL->lock);
+        int hRL = nRL->height.load();
+        if(hRR0 >= hRL) {
+            return rotateLeftLocked(nParent, n, hL0, nR, nRL, hRL, hRR0);
+        }
+        Node* nRLR = nRL->right.load();
+        int hRLR = height(nRLR);
+        int b = hRR0 - hRLR;
+        if(b >= -1 && b <= 1) {
+            if(!((hRR0 == 0 || hRLR == 0) && nR->value.load() == nullptr)) {
+                return rotateLeftOverRightLocked(nParent, n, hL0, nR, nRL, hRR0, hRLR);
+            }
+            return rotateRightLocked(n, nR, nRL, hRR0, height(nRL->left.load()), nRLR, hRLR);
+        }
+    }
+    return rebalanceToRightLocked(n, nR, nRL, hRR0);
+}
+
+/**
+* Rotates nL up over n. Only n's key range shrinks, so only n is marked as
+* changing; a reader already below nL stays in a subtree that still covers it.
+* Returns whichever of n, nL or nParent still needs work.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Links*
+ConcurrentAVLTree<Key, Value, Compare>::rotateRightLocked(Links* nParent, Node* n, Node* nL, int hR,
+                                                         int hLL, Node* nLR, int hLR)
+{
+    Version nodeVersion = n->version.load();
+    Node* nPL = nParent->left.load();
+    n->version.store(nodeVersion | CHANGING);
+
+    n->left.store(nLR);
+    if(nLR != nullptr) {
+        nLR->parent.store(n);
+    }
+    nL->right.store(n);
+    n->parent.store(nL);
+    if(nPL == n) {
+        nParent->left.store(nL);
+    }
+    else {
+        nParent->right.store(nL);
+    }
+    nL->parent.store(nParent);
+
+    int hNRepl = 1 + std::max(hLR, hR);
+    n->height.store(hNRepl);
+    nL->height.store(1 + std::max(hLL, hNRepl));
+    n->version.store(nodeVersion + CHANGE_STEP);
+
+    int balN = hLR - hR;
+    if(balN < -1 || balN > 1) {
+        return n;
+    }
+    if((nLR == nullptr || hR == 0) && n->value.load() == nullptr) {
+        return n;
+    }
+    int balL = hLL - hNRepl;
+    if(balL < -1 || balL > 1) {
+        return nL;
+    }
+    if(hLL == 0 && nL->value.load() == nullptr) {
+        return nL;
+    }
+    return fixHeightLocked(nParent);
+}
+
+/**
+* The mirror image of rotateRightLocked().
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Links*
+ConcurrentAVLTree<Key, Value, Compare>::rotateLeftLocked(Links* nParent, Node* n, int hL, Node* nR,
+                                                        Node* nRL, int hRL, int hRR)
+{
+    Version nodeVersion = n->version.load();
+    Node* nPL = nParent->left.load();
+    n->version.store(nodeVersion | CHANGING);
+
+    n->right.store(nRL);
+    if(nRL != nullptr) {
+        nRL->parent.store(n);
+    }
+    nR->left.store(n);
+    n->parent.store(nR);
+    if(nPL == n) {
+        nParent->left.store(nR);
+    }
+    else {
+        nParent->right.store(nR);
+    }
+    nR->parent.store(nParent);
+
+    int hNRepl = 1 + std::max(hL, hRL);
+    n->height.store(hNRepl);
+    nR->height.store(1 + std::max(hNRepl, hRR));
+    n->version.store(nodeVersion + CHANGE_STEP);
+
+    int balN = hRL - hL;
+    if(balN < -1 || balN > 1) {
+        return n;
+    }
+    if((nRL == nullptr || hL == 0) && n->value.load() == nullptr) {
+        return n;
+    }
+    int balR = hRR - hNRepl;
+    if(balR < -1 || balR > 1) {
+        return nR;
+    }
+    if(hRR == 0 && nR->value.load() == nullptr) {
+        return nR;
+    }
+    return fixHeightLocked(nParent);
+}
+
+/**
+* Rotates nLR up over both nL and n, which both lose part of their key range
+* and so are both marked as changing.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Links*
+ConcurrentAVLTree<Key, Value, Compare>::rotateRightOverLeftLocked(Links* nParent, Node* n, Node* nL, int hR,
+                                                                 int hLL, Node* nLR, int hLRL)
+{
+    Version nodeVersion = n->version.load();
+    Version leftVersion = nL->version.load();
+    Node* nPL = nParent->left.load();
+    Node* nLRL = nLR->left.load();
+    Node* nLRR = nLR->right.load();
+    int hLRR = height(nLRR);
+    n->version.store(nodeVersion | CHANGING);
+    nL->version.store(leftVersion | CHANGING);
+
+    n->left.store(nLRR);
+    if(nLRR != nullptr) {
+        nLRR->parent.store(n);
+    }
+    nL->right.store(nLRL);
+    if(nLRL != nullptr) {
+        nLRL->parent.store(nL);
+    }
+    nLR->left.store(nL);
+    nL->parent.store(nLR);
+    nLR->right.store(n);
+    n->parent.store(nLR);
+    if(nPL == n) {
+        nParent->left.store(nLR);
+    }
+    else {
+        nParent->right.store(nLR);
+    }
+    nLR->parent.store(nParent);
+
+    int hNRepl = 1 + std::max(hLRR, hR);
+    n->height.store(hNRepl);
+    int hLRepl = 1 + std::max(hLL, hLRL);
+    nL->height.store(hLRepl);
+    nLR->height.store(1 + std::max(hLRepl, hNRepl));
+    n->version.store(nodeVersion + CHANGE_STEP);
+    nL->version.store(leftVersion + CHANGE_STEP);
+
+    int balN = hLRR - hR;
+    if(balN < -1 || balN > 1) {
+        return n;
+    }
+    if((nLRR == nullptr || hR == 0) && n->value.load() == nullptr) {
+        return n;
+    }
+    int balLR = hLRepl - hNRepl;
+    if(balLR < -1 || balLR > 1) {
+        return nLR;
+    }
+    return fixHeightLocked(nParent);
+}
+
+/**
+* The mirror image of rotateRightOverLeftLocked().
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Links*
+ConcurrentAVLTree<Key, Value, Compare>::rotateLeftOverRightLocked(Links* nParent, Node* n, int hL, Node* nR,
+                                                                 Node* nRL, int hRR, int hRLR)
+{
+    Version nodeVersion = n->version.load();
+    Version rightVersion = nR->version.load();
+    Node* nPL = nParent->left.load();
+    Node* nRLL = nRL->left.load();
+    Node* nRLR = nRL->right.load();
+    int hRLL = height(nRLL);
+    n->version.store(nodeVersion | CHANGING);
+    nR->version.store(rightVersion | CHANGING);
+
+    n->right.store(nRLL);
+    if(nRLL != nullptr) {
+        nRLL->parent.store(n);
+    }
+    nR->left.store(nRLR);
+    if(nRLR != nullptr) {
+        nRLR->parent.store(nR);
+    }
+    nRL->right.store(nR);
+    nR->parent.store(nRL);
+    nRL->left.store(n);
+    n->parent.store(nRL);
+    if(nPL == n) {
+        nParent->left.store(nRL);
+    }
+    else {
+        nParent->right.store(nRL);
+    }
+    nRL->parent.store(nParent);
+
+    int hNRepl = 1 + std::max(hL, hRLL);
+    n->height.store(hNRepl);
+    int hRRepl = 1 + std::max(hRLR, hRR);
+    nR->height.store(hRRepl);
+    nRL->height.store(1 + std::max(hNRepl, hRRepl));
+    n->version.store(nodeVersion + CHANGE_STEP);
+    nR->version.store(rightVersion + CHANGE_STEP);
+
+    int balN = hRLL - hL;
+    if(balN < -1 || balN > 1) {
+        return n;
+    }
+    if((nRLL == nullptr || hL == 0) && n->value.load() == nullptr) {
+        return n;
+    }
+    int balRL = hRRepl - hNRepl;
+    if(balRL < -1 || balRL > 1) {
+        return nRL;
+    }
+    return fixHeightLocked(nParent);
+}
+
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::clearHelper(Node* node)
+{
+    if(node == nullptr) {
+        return;
+    }
+    clearHelper(node->left.load());
+    clearHelper(node->right.load());
+    delete node->value.load();
+    delete node;
+}
+
+template<class Key, class Value, class Compare>
+std::size_t ConcurrentAVLTree<Key, Value, Compare>::sizeHelper(const Node* node) const
+{
+    if(node == nullptr) {
+        return 0;
+    }
+    return (node->value.load() != nullptr ? 1 : 0) +
+           sizeHelper(node->left.load()) + sizeHelper(node->right.load());
+}
+
+/**
+* Returns the subtree's height, or -1 if it is unbalanced, has a stale stored
+* height, or keeps a routing node that should have been unlinked.
+*/
+template<class Key, class Value, class Compare>
+int ConcurrentAVLTree<Key, Value, Compare>::checkBalance(const Node* node) const
+{
+    if(node == nullptr) {
+        return 0;
+    }
+    const Node* left = node->left.load();
+    const Node* right = node->right.load();
+    if((left == nullptr || right == nullptr) && node->value.load() == nullptr) {
+        return -1;
+    }
+    int leftHeight = checkBalance(left);
+    int rightHeight = checkBalance(right);
+    if(leftHeight < 0 || rightHeight < 0 || std::abs(leftHeight - rightHeight) > 1) {
+        return -1;
+    }
+    int nodeHeight = 1 + std::max(leftHeight, rightHeight);
+    return node->height.load() == nodeHeight ? nodeHeight : -1;
+}
+
+/*
+  ------------------------------------------------------
+  End implementations for the ConcurrentAVLTree class.
+  ------------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,623 @@
+#ifndef DURABLE_AVLBST_H
+#define DURABLE_AVLBST_H
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "avlbst.h"
+#include "tree-snapshot.h"
+
+/**
+ * An AVLTree that survives crashes. Every insert and remove is applied to the
+ * tree in memory and appended as a record to a write-ahead log in dir; from
+ * time to time the whole tree is saved as a checkpoint (see
+ * BinarySearchTree::save) and the log starts over. Constructing the map on
+ * the same directory recovers it: the checkpoint is loaded and the log
+ * replayed on top.
+ *
+ * Records are grouped into batches, and each batch goes to the log with one
+ * write() and, depending on the SyncPolicy, one fsync, so the cost of a sync
+ * is shared by every record in the batch:
+ *
+ *   SYNC_EVERY  each change is its own batch and is on disk when it returns
+ *   SYNC_BATCH  a batch is written and synced once batchRecords changes are
+ *               pending, or on commit(); changes since then can be lost
+ *   SYNC_NEVER  batches are written but never synced, so they survive the
+ *               process crashing but not the machine
+ *
+ * Each batch is framed with its length and a hash, so a batch torn by a
+ * crash is recognized and cut off during recovery. The keys and values are
+ * written with SnapshotCodec. Like AVLTree, this is not thread-safe.
+ *
+ * insert() and remove() change the tree before the record is logged, so
+ * when writing the batch fails the exception arrives with the change
+ * already made in memory. A failed write is cut back off the log and the
+ * records stay pending, for a later commit() to retry. A failed sync
+ * cannot be retried, since the OS may have dropped the pages it could not
+ * write; the log then refuses every further change with
+ * std::runtime_error, and the map has to be reopened to recover what
+ * reached the disk.
+ */
+template <class Key, class Value, class Compare = std::less<Key> >
+class DurableAVLTree
+{
+public:
+    typedef AVLTree<Key, Value, Compare> tree_type;
+    typedef typename tree_type::iterator iterator;
+
+    enum SyncPolicy { SYNC_NEVER, SYNC_BATCH, SYNC_EVERY };
+
+    struct Options
+    {
+        Options();
+
+        SyncPolicy sync;
+        // Changes gathered into one write under SYNC_BATCH and SYNC_NEVER
+        std::size_t batchRecords;
+        // Log records after which the tree is checkpointed; 0 leaves it to checkpoint()
+        std::size_t checkpointRecords;
+    };
+
+    explicit DurableAVLTree(const std::string& dir, const Options& options = Options());
+    ~DurableAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void commit();
+    void checkpoint();
+
+    const tree_type& tree() const;
+    iterator find(const Key& key) const;
+    iterator begin() const;
+    iterator end() const;
+    bool empty() const;
+    // Records in the log since the last checkpoint, committed or not
+    std::size_t logRecords() const;
+
+private:
+    DurableAVLTree(const DurableAVLTree&) = delete;
+    DurableAVLTree& operator=(const DurableAVLTree&) = delete;
+
+    enum RecordType { RECORD_INSERT = 1, RECORD_REMOVE = 2 };
+
+    // Each batch starts with its payload size, record count, and a hash of
+    // both and the payload
+    struct BatchHeader
+    {
+        std::uint64_t size;
+        std::uint64_t records;
+        std::uint64_t hash;
+    };
+
+    void recover();
+    bool replayBatch(std::istream& in, std::uint64_t available);
+    static std::uint64_t batchHash(const BatchHeader& header, const std::string& payload);
+    void startLog();
+    void logged();
+    void rewindLog();
+    void checkUsable() const;
+    std::string path(const char* name) const;
+    static void writeAll(int fd, const char* data, std::size_t size);
+    static void syncPath(const std::string& path, int flags);
+    static void syncFd(int fd);
+    static void throwErrno(const std::string& what);
+
+    std::string dir_;
+    Options options_;
+    tree_type tree_;
+    int logFd_;
+    // The end of the last batch known to be written whole
+    std::uint64_t logEnd_;
+    // Set once a sync fails or the log cannot be put back in order
+    bool failed_;
+    // Records not yet written to the log
+    std::ostringstream pending_;
+    SnapshotWriter pendingWriter_;
+    std::size_t pendingRecords_;
+    std::size_t logRecords_;
+};
+
+/*
+  ------------------------------------------------
+  Begin implementations for the DurableAVLTree class.
+  ------------------------------------------------
+*/
+
+namespace durable_detail {
+
+const char LOG_MAGIC[4] = { 'B', 'S', 'T', 'W' };
+const char* const LOG_FILE = "log";
+const char* const CHECKPOINT_FILE = "checkpoint";
+const char* const CHECKPOINT_TEMP = "checkpoint.tmp";
+
+}
+
+template<class Key, class Value, class Compare>
+DurableAVLTree<Key, Value, Compare>::Options::Options() :
+    sync(SYNC_BATCH),
+    batchRecords(256),
+    checkpointRecords(1000000)
+{
+}
+
+/**
+* Opens or creates the map stored in dir, which is created if missing.
+* Throws std::system_error if the files cannot be used, and SnapshotError if
+* they hold a map with other key or value types.
+*/
+template<class Key, class Value, class Compare>
+DurableAVLTree<Key, Value, Compare>::DurableAVLTree(const std::string& dir, const Options& options) :
+    dir_(dir),
+    options_(options),
+    tree_(),
+    logFd_(-1),
+    logEnd_(0),
+    failed_(false),
+    pending_(std::ios::binary),
+    pendingWriter_(pending_),
+    pendingRecords_(0),
+    logRecords_(0)
+{
+    if(::mkdir(dir_.c_str(), 0755) != 0 && errno != EEXIST) {
+        throwErrno("cannot create " + dir_);
+    }
+    try {
+        recover();
+    }
+    catch(...) {
+        if(logFd_ >= 0) {
+            ::close(logFd_);
+        }
+        throw;
+    }
+}
+
+/**
+* Writes out the last batch. Nothing is checkpointed, so the next start
+* replays the log.
+*/
+template<class Key, class Value, class Compare>
+DurableAVLTree<Key, Value, Compare>::~DurableAVLTree()
+{
+    try {
+        commit();
+    }
+    catch(...) {
+        //a destructor cannot report it; the batch is lost as if the process had died
+    }
+    ::close(logFd_);
+}
+
+template<class Key, class Value, class Compare>
+void DurableAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    checkUsable();
+    tree_.insert(keyValuePair);
+    unsigned char type = RECORD_INSERT;
+    pendingWriter_.write(&type, 1);
+    SnapshotCodec<Key>::write(pendingWriter_, keyValuePair.first);
+    SnapshotCodec<Value>::write(pendingWriter_, keyValuePair.second);
+    logged();
+}
+
+template<class Key, class Value, class Compare>
+void DurableAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    checkUsable();
+    tree_.remove(key);
+    unsigned char type = RECORD_REMOVE;
+    pendingWriter_.write(&type, 1);
+    SnapshotCodec<Key>::write(pendingWriter_, key);
+    logged();
+}
+
+/**
+* Writes the pending records to the log as one batch, syncs it unless the
+* policy is SYNC_NEVER, and checkpoints if the log has grown long enough.
+* A batch that fails to write or sync is cut back off the log, so nothing
+* appended later can end up behind a torn batch, which recovery would stop
+* at.
+*/
+template<class Key, class Value, class Compare>
+void DurableAVLTree<Key, Value, Compare>::commit()
+{
+    checkUsable();
+    if(pendingRecords_ == 0) {
+        return;
+    }
+    std::string payload = pending_.str();
+    BatchHeader header;
+    header.size = payload.size();
+    header.records = pendingRecords_;
+    header.hash = batchHash(header, payload);
+    payload.insert(0, reinterpret_cast<const char*>(&header), sizeof(header));
+    try {
+        writeAll(logFd_, payload.data(), payload.size());
+    }
+    catch(...) {
+        rewindLog();
+        throw;
+    }
+    if(options_.sync != SYNC_NEVER) {
+        try {
+            syncFd(logFd_);
+        }
+        catch(...) {
+            failed_ = true;
+            rewindLog();
+            throw;
+        }
+    }
+    logEnd_ += payload.size();
+    pending_.str(std::string());
+    logRecords_ += pendingRecords_;
+    pendingRecords_ = 0;
+    if(options_.checkpointRecords != 0 && logRecords_ >= options_.checkpointRecords) {
+        checkpoint();
+    }
+}
+
+/**
+* Saves the tree beside the old checkpoint, renames it over the old one and
+* empties the log. A crash between the rename and emptying the log is
+* harmless: replaying a log onto the state it produced changes nothing,
+* since every record sets or removes one key outright.
+*/
+template<class Key, class Value, class Compare>
+void DurableAVLTree<Key, Value, Compare>::checkpoint()
+{
+    //commit() only calls back in here once pendingRecords_ is zero
+    std::size_t threshold = options_.checkpointRecords;
+    options_.checkpointRecords = 0;
+    try {
+        commit();
+    }
+    catch(...) {
+        options_.checkpointRecords = threshold;
+        throw;
+    }
+    options_.checkpointRecords = threshold;
+
+    std::string temp = path(durable_detail::CHECKPOINT_TEMP);
+    tree_.save(temp);
+    if(options_.sync != SYNC_NEVER) {
+        syncPath(temp, O_RDONLY);
+    }
+    if(std::rename(temp.c_str(), path(durable_detail::CHECKPOINT_FILE).c_str()) != 0) {
+        throwErrno("cannot replace the checkpoint in " + dir_);
+    }
+    if(options_.sync != SYNC_NEVER) {
+        //makes the rename itself durable
+        syncPath(dir_, O_RDONLY | O_DIRECTORY);
+    }
+    if(::ftruncate(logFd_, 0) != 0) {
+        throwErrno("cannot truncate the log in " + dir_);
+    }
+    try {
+        startLog();
+    }
+    catch(...) {
+        //batches appended to a log without a whole header would be dropped on recovery
+        failed_ = true;
+        throw;
+    }
+    logRecords_ = 0;
+}
+
+template<class Key, class Value, class Compare>
+const typename DurableAVLTree<Key, Value, Compare>::tree_type&
+DurableAVLTree<Key, Value, Compare>::tree() const
+{
+    return tree_;
+}
+
+template<class Key, class Value, class Compare>
+typename DurableAVLTree<Key, Value, Compare>::iterator
+DurableAVLTree<Key, Value, Compare>::find(const Key& key) const
+{
+    return tree_.find(key);
+}
+
+template<class Key, class Value, class Compare>
+typename DurableAVLTree<Key, Value, Compare>::iterator
+DurableAVLTree<Key, Value, Compare>::begin() const
+{
+    return tree_.begin();
+}
+
+template<class Key, class Value, class Compare>
+typename DurableAVLTree<Key, Value, Compare>::iterator
+DurableAVLTree<Key, Value, Compare>::end() const
+{
+    return tree_.end();
+}
+
+template<class Key, class Value, class Compare>
+bool DurableAVLTree<Key, Value, Compare>::empty() const
+{
+    return tree_.empty();
+}
+
+template<class Key, class Value, class Compare>
+std::size_t DurableAVLTree<Key, Value, Compare>::logRecords() const
+{
+    return logRecords_ + pendingRecords_;
+}
+
+/**
+* Loads the checkpoint, if there is one, then replays every intact batch of
+* the log.
+* The log is cut off after the last intact batch, so whatever a crash left
+* half written is dropped before new batches are appended.
+*/
+template<class Key, class Value, class Compare>
+void DurableAVLTree<Key, Value, Compare>::recover()
+{
+    //only a missing checkpoint means there is none yet; starting without one
+    //that could not be read would lose it at the next checkpoint
+    std::string checkpointPath = path(durable_detail::CHECKPOINT_FILE);
+    int checkpointFd = ::open(checkpointPath.c_str(), O_RDONLY);
+    if(checkpointFd < 0 && errno != ENOENT) {
+        throwErrno("cannot open " + checkpointPath);
+    }
+    if(checkpointFd >= 0) {
+        ::close(checkpointFd);
+        std::ifstream checkpointIn(checkpointPath.c_str(), std::ios::binary);
+        if(!checkpointIn) {
+            throwErrno("cannot open " + checkpointPath);
+        }
+        tree_.load(checkpointIn);
+    }
+
+    std::string logPath = path(durable_detail::LOG_FILE);
+    logFd_ = ::open(logPath.c_str(), O_RDWR | O_CREAT, 0644);
+    if(logFd_ < 0) {
+        throwErrno("cannot open " + logPath);
+    }
+    struct stat info;
+    if(::fstat(logFd_, &info) != 0) {
+        throwErrno("cannot stat " + logPath);
+    }
+    std::uint64_t length = static_cast<std::uint64_t>(info.st_size);
+    std::uint64_t intact = 0;
+    std::ifstream in(logPath.c_str(), std::ios::binary);
+    char magic[sizeof(durable_detail::LOG_MAGIC)];
+    std::uint32_t header[4];
+    std::uint64_t headerSize = sizeof(magic) + sizeof(header);
+    if(length >= headerSize) {
+        in.read(magic, sizeof(magic));
+        in.read(reinterpret_cast<char*>(header), sizeof(header));
+        if(std::memcmp(magic, durable_detail::LOG_MAGIC, sizeof(magic)) != 0 ||
+           header[0] != SNAPSHOT_VERSION || header[1] != snapshot_detail::ORDER_MARK ||
+           header[2] != SnapshotCodec<Key>::SIZE || header[3] != SnapshotCodec<Value>::SIZE) {
+            throw SnapshotError(logPath + " is not a log for this map");
+        }
+        intact = headerSize;
+        while(replayBatch(in, length - intact)) {
+            intact = static_cast<std::uint64_t>(in.tellg());
+        }
+    }
+    if(intact < headerSize) {
+        //no log yet, or a crash while it was being started
+        if(::ftruncate(logFd_, 0) != 0) {
+            throwErrno("cannot truncate " + logPath);
+        }
+        startLog();
+        return;
+    }
+    if(intact < length && ::ftruncate(logFd_, static_cast<off_t>(intact)) != 0) {
+        throwErrno("cannot truncate " + logPath);
+    }
+    logEnd_ = intact;
+    if(::lseek(logFd_, 0, SEEK_END) < 0) {
+        throwErrno("cannot seek in " + logPath);
+    }
+}
+
+/**
+* Applies the next batch of the log if all of it is there, its hash matches,
+* and its records fill its payload exactly. available is how many bytes of
+* the file are left. The records are decoded before any is applied, so a
+* batch is replayed whole or not at all.
+*/
+template<class Key, class Value, class Compare>
+bool DurableAVLTree<Key, Value, Compare>::replayBatch(std::istream& in, std::uint64_t available)
+{
+    BatchHeader header;
+    if(available < sizeof(header) ||
+       !in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+       header.size > available - sizeof(header)) {
+        return false;
+    }
+    std::string payload(static_cast<std::size_t>(header.size), '\0');
+    if(!in.read(&payload[0], static_cast<std::streamsize>(payload.size())) ||
+       batchHash(header, payload) != header.hash) {
+        return false;
+    }
+    std::istringstream records(payload);
+    SnapshotReader reader(records);
+    std::vector<std::pair<unsigned char, std::pair<Key, Value> > > decoded;
+    try {
+        //every record takes at least its type byte, which bounds a bad count
+        for(std::uint64_t i = 0; i < header.records && i < header.size; ++i) {
+            decoded.push_back(std::make_pair(0, std::pair<Key, Value>()));
+            unsigned char& type = decoded.back().first;
+            reader.read(&type, 1);
+            SnapshotCodec<Key>::read(reader, decoded.back().second.first);
+            if(type == RECORD_INSERT) {
+                SnapshotCodec<Value>::read(reader, decoded.back().second.second);
+            }
+            else if(type != RECORD_REMOVE) {
+                return false;
+            }
+        }
+    }
+    catch(const SnapshotError&) {
+        return false;
+    }
+    if(decoded.size() != header.records ||
+       records.rdbuf()->sgetc() != std::istringstream::traits_type::eof()) {
+        return false;
+    }
+    for(std::size_t i = 0; i < decoded.size(); ++i) {
+        if(decoded[i].first == RECORD_INSERT) {
+            tree_.insert(std::pair<const Key, Value>(decoded[i].second.first, decoded[i].second.second));
+        }
+        else {
+            tree_.remove(decoded[i].second.first);
+        }
+    }
+    logRecords_ += header.records;
+    return true;
+}
+
+/**
+* Hashes the size and record count along with the payload, so damage to
+* either is caught like damage to the records.
+*/
+template<class Key, class Value, class Compare>
+std::uint64_t DurableAVLTree<Key, Value, Compare>::batchHash(const BatchHeader& header, const std::string& payload)
+{
+    std::uint64_t hash = snapshot_detail::FNV_OFFSET;
+    hash = snapshot_detail::hashBytes(hash, reinterpret_cast<const char*>(&header.size), sizeof(header.size));
+    hash = snapshot_detail::hashBytes(hash, reinterpret_cast<const char*>(&header.records), sizeof(header.records));
+    return snapshot_detail::hashBytes(hash, payload.data(), payload.size());
+}
+
+/**
+* Writes the header of an empty log: the snapshot header fields, so a log
+* written for other types is refused.
+*/
+template<class Key, class Value, class Compare>
+void DurableAVLTree<Key, Value, Compare>::startLog()
+{
+    char header[sizeof(durable_detail::LOG_MAGIC) + 4 * sizeof(std::uint32_t)];
+    std::uint32_t fields[4] = { SNAPSHOT_VERSION, snapshot_detail::ORDER_MARK,
+                                SnapshotCodec<Key>::SIZE, SnapshotCodec<Value>::SIZE };
+    std::memcpy(header, durable_detail::LOG_MAGIC, sizeof(durable_detail::LOG_MAGIC));
+    std::memcpy(header + sizeof(durable_detail::LOG_MAGIC), fields, sizeof(fields));
+    if(::lseek(logFd_, 0, SEEK_SET) < 0) {
+        throwErrno("cannot seek in the log in " + dir_);
+    }
+    writeAll(logFd_, header, sizeof(header));
+    if(options_.sync != SYNC_NEVER) {
+        syncFd(logFd_);
+    }
+    logEnd_ = sizeof(header);
+}
+
+/**
+* Counts a record just added to the batch and commits the batch when the
+* policy says it is due.
+*/
+template<class Key, class Value, class Compare>
+void DurableAVLTree<Key, Value, Compare>::logged()
+{
+    ++pendingRecords_;
+    if(options_.sync == SYNC_EVERY || pendingRecords_ >= options_.batchRecords) {
+        commit();
+    }
+}
+
+/**
+* Cuts the log back to the end of the last whole batch after a failed write.
+* If even that fails, the log is left as it is and marked failed.
+*/
+template<class Key, class Value, class Compare>
+void DurableAVLTree<Key, Value, Compare>::rewindLog()
+{
+    if(::ftruncate(logFd_, static_cast<off_t>(logEnd_)) != 0 ||
+       ::lseek(logFd_, static_cast<off_t>(logEnd_), SEEK_SET) < 0) {
+        failed_ = true;
+    }
+}
+
+template<class Key, class Value, class Compare>
+void DurableAVLTree<Key, Value, Compare>::checkUsable() const
+{
+    if(failed_) {
+        throw std::runtime_error("the log in " + dir_ + " failed; reopen the map to recover it");
+    }
+}
+
+template<class Key, class Value, class Compare>
+std::string DurableAVLTree<Key, Value, Compare>::path(const char* name) const
+{
+    return dir_ + "/" + name;
+}
+
+template<class Key, class Value, class Compare>
+void DurableAVLTree<Key, Value, Compare>::writeAll(int fd, const char* data, std::size_t size)
+{
+    while(size > 0) {
+        ssize_t written = ::write(fd, data, size);
+        if(written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            throwErrno("cannot write the log");
+        }
+        data += written;
+        size -= static_cast<std::size_t>(written);
+    }
+}
+
+template<class Key, class Value, class Compare>
+void DurableAVLTree<Key, Value, Compare>::syncPath(const std::string& path, int flags)
+{
+    int fd = ::open(path.c_str(), flags);
+    if(fd < 0) {
+        throwErrno("cannot open " + path);
+    }
+    try {
+        syncFd(fd);
+    }
+    catch(...) {
+        ::close(fd);
+        throw;
+    }
+    ::close(fd);
+}
+
+/**
+* fdatasync where there is one: the log only grows, and the new length is
+* flushed either way.
+*/
+template<class Key, class Value, class Compare>
+void DurableAVLTree<Key, Value, Compare>::syncFd(int fd)
+{
+#if defined(__linux__)
+    int result = ::fdatasync(fd);
+#else
+    int result = ::fsync(fd);
+#endif
+    if(result != 0) {
+        throwErrno("cannot sync");
+    }
+}
+
+template<class Key, class Value, class Compare>
+void DurableAVLTree<Key, Value, Compare>::throwErrno(const std::string& what)
+{
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+/*
+  ----------------------------------------------
+  End implementations for the DurableAVLTree class.
+  ----------------------------------------------
+*/
+
+#endif
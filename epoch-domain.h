@@ -0,0 +1,213 @@
+#ifndef EPOCH_DOMAIN_H
+#define EPOCH_DOMAIN_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+
+/**
+ * Epoch-based reclamation for structures that readers traverse without locks.
+ * Every operation runs inside a Guard, which announces the global epoch in a
+ * slot for as long as it lives. Memory unlinked by a writer is retired rather
+ * than freed, and only freed once the global epoch has moved on twice, which
+ * cannot happen while any guard that might still see it is alive.
+ *
+ * Guards claim one of a fixed number of slots, so at most SLOT_COUNT of them
+ * can be live at once; further ones wait for a slot to come free. Retired
+ * memory stays with the slot it was retired through until that slot scans
+ * again, or until the domain is destroyed.
+ */
+class EpochDomain
+{
+private:
+    struct Slot;
+
+public:
+    EpochDomain();
+    ~EpochDomain();
+
+    class Guard
+    {
+    public:
+        explicit Guard(EpochDomain& domain);
+        ~Guard();
+
+        template<typename T>
+        void retire(T* object);
+
+    private:
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+
+        EpochDomain& domain_;
+        Slot* slot_;
+    };
+
+private:
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain& operator=(const EpochDomain&) = delete;
+
+    struct Retired
+    {
+        std::uint64_t epoch;
+        void* object;
+        void (*destroy)(void*);
+    };
+
+    // padded so that announcing in one slot does not invalidate its neighbours
+    struct Slot
+    {
+        std::atomic<bool> claimed;
+        std::atomic<std::uint64_t> epoch;
+        std::vector<Retired> limbo;
+        unsigned sinceScan;
+        char padding[64];
+    };
+
+    static const unsigned SLOT_COUNT = 64;
+    static const unsigned SCAN_INTERVAL = 64;
+
+    template<typename T>
+    static void destroyObject(void* object);
+
+    Slot* claim();
+    void retire(Slot* slot, void* object, void (*destroy)(void*));
+    bool tryAdvance();
+    void reclaim(Slot* slot);
+
+    std::atomic<std::uint64_t> epoch_;
+    Slot slots_[SLOT_COUNT];
+};
+
+/*
+  -----------------------------------------------
+  Begin implementations for the EpochDomain class.
+  -----------------------------------------------
+*/
+
+/**
+* Epochs start at 1 so that a slot epoch of 0 can mean "not in a guard".
+*/
+inline EpochDomain::EpochDomain() :
+    epoch_(1)
+{
+    for(unsigned i = 0; i < SLOT_COUNT; ++i) {
+        slots_[i].claimed.store(false);
+        slots_[i].epoch.store(0);
+        slots_[i].sinceScan = 0;
+    }
+}
+
+/**
+* No guard may be live; everything still waiting in a slot is freed.
+*/
+inline EpochDomain::~EpochDomain()
+{
+    for(unsigned i = 0; i < SLOT_COUNT; ++i) {
+        std::vector<Retired>& limbo = slots_[i].limbo;
+        for(std::size_t j = 0; j < limbo.size(); ++j) {
+            limbo[j].destroy(limbo[j].object);
+        }
+    }
+}
+
+/**
+* Probes the slots starting from one picked by thread id, so threads that
+* keep coming back tend to keep getting the same slot.
+*/
+inline EpochDomain::Slot* EpochDomain::claim()
+{
+    std::size_t start = std::hash<std::thread::id>()(std::this_thread::get_id());
+    while(true) {
+        for(unsigned i = 0; i < SLOT_COUNT; ++i) {
+            Slot& slot = slots_[(start + i) % SLOT_COUNT];
+            if(!slot.claimed.load(std::memory_order_relaxed) &&
+               !slot.claimed.exchange(true, std::memory_order_acquire)) {
+                return &slot;
+            }
+        }
+        std::this_thread::yield();
+    }
+}
+
+inline void EpochDomain::retire(Slot* slot, void* object, void (*destroy)(void*))
+{
+    Retired retired = { epoch_.load(), object, destroy };
+    slot->limbo.push_back(retired);
+    if(++slot->sinceScan >= SCAN_INTERVAL) {
+        slot->sinceScan = 0;
+        tryAdvance();
+        reclaim(slot);
+    }
+}
+
+/**
+* Moves the global epoch on if every live guard has announced the current one.
+*/
+inline bool EpochDomain::tryAdvance()
+{
+    std::uint64_t current = epoch_.load();
+    for(unsigned i = 0; i < SLOT_COUNT; ++i) {
+        std::uint64_t announced = slots_[i].epoch.load();
+        if(announced != 0 && announced != current) {
+            return false;
+        }
+    }
+    return epoch_.compare_exchange_strong(current, current + 1);
+}
+
+/**
+* Frees what this slot retired at least two epochs ago. A slot is only used by
+* one guard at a time, so its limbo list needs no locking and is in epoch order.
+*/
+inline void EpochDomain::reclaim(Slot* slot)
+{
+    std::uint64_t current = epoch_.load();
+    std::vector<Retired>& limbo = slot->limbo;
+    std::size_t freed = 0;
+    while(freed < limbo.size() && limbo[freed].epoch + 2 <= current) {
+        limbo[freed].destroy(limbo[freed].object);
+        ++freed;
+    }
+    limbo.erase(limbo.begin(), limbo.begin() + freed);
+}
+
+template<typename T>
+void EpochDomain::destroyObject(void* object)
+{
+    delete static_cast<T*>(object);
+}
+
+inline EpochDomain::Guard::Guard(EpochDomain& domain) :
+    domain_(domain),
+    slot_(domain.claim())
+{
+    slot_->epoch.store(domain_.epoch_.load());
+}
+
+inline EpochDomain::Guard::~Guard()
+{
+    slot_->epoch.store(0);
+    slot_->claimed.store(false, std::memory_order_release);
+}
+
+/**
+* Hands over an object that has already been unlinked; it is deleted once no
+* guard that could still reach it remains.
+*/
+template<typename T>
+void EpochDomain::Guard::retire(T* object)
+{
+    domain_.retire(slot_, object, &EpochDomain::destroyObject<T>);
+}
+
+/*
+  ---------------------------------------------
+  End implementations for the EpochDomain class.
+  ---------------------------------------------
+*/
+
+#endif
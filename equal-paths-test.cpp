@@ -1,5 +1,6 @@
 #include <iostream>
 #include <cstdlib>
+#include <vector>
 #include "equal-paths.h"
 using namespace std;
 
@@ -55,6 +56,30 @@ void test5(const char* msg)
   cout << msg << ": " <<   equalPaths(a) << endl;
 }
 
+// A zig-zag chain of a million nodes has one leaf, so its paths are equal;
+// a second leaf near the root makes them unequal. Asking twice checks that
+// the walk leaves the tree as it found it.
+void test6(const char* msg)
+{
+  const int n = 1000000;
+  vector<Node*> chain;
+  for(int i = 0; i < n; ++i) {
+    chain.push_back(new Node(i));
+    if(i > 0) {
+      if(i % 2) chain[i-1]->left = chain[i];
+      else chain[i-1]->right = chain[i];
+    }
+  }
+  cout << msg << ": " << equalPaths(chain[0]);
+  Node* extra = new Node(-1);
+  chain[0]->right = extra;
+  cout << " " << equalPaths(chain[0]) << " " << equalPaths(chain[0]) << endl;
+  delete extra;
+  for(int i = 0; i < n; ++i) {
+    delete chain[i];
+  }
+}
+
 int main()
 {
   a = new Node(1);
@@ -67,6 +92,7 @@ int main()
   test3("Test3");
   test4("Test4");
   test5("Test5");
+  test6("Test6");
  
   delete a;
   delete b;
@@ -9,10 +9,11 @@ using namespace std;
 
 // You may add any prototypes of helper functions here
 
-//helper to help recursively check if the paths are equal to each other
-//depth will track where we are in the AVL Tree
-//leadDepth will store the depth of each of the leaves we are in
-bool checkIfEqual(Node* node, int depth, int& leafDepth);
+//helper to check if the paths are equal to each other without recursion
+//leafDepth will store the depth of the first leaf we find
+bool checkIfEqual(Node* root, int& leafDepth);
+//compares one leaf's depth against the first leaf's
+bool sameLeafDepth(int depth, int& leafDepth);
 
 
 bool equalPaths(Node * root)
@@ -20,33 +21,67 @@ bool equalPaths(Node * root)
   // Add your code below
   //initialize the depth to be -1, which means we haven't found any leaves yet
   int leafDepth=-1;
-  //call the recursive function
-  return checkIfEqual(root, 0, leafDepth);
+  //walk the whole tree once
+  return checkIfEqual(root, leafDepth);
 
 }
 
-bool checkIfEqual(Node* node, int depth, int& leafDepth){
-  //base case: if the current node is null, then there is no leaf 
-  if(node == nullptr){
-    return true;
-  }
-
-  //if the current node is a leaf then there are no children
-  if(node -> left == nullptr && node-> right ==nullptr){
-    //if this is the first leaf (since initialized to -1)
-    if(leafDepth == -1){
-      leafDepth = depth;
-      return true;
+//Morris in-order walk: before going into a node's left subtree, the right
+//pointer of its predecessor (which is always null) is pointed back at it, so
+//the walk can climb back up without a stack and works on a tree of any depth.
+//Each thread is removed on the way back, leaving the tree as it was.
+//A leaf is only seen with its right pointer threaded, so leaves are checked
+//when their thread is followed back; the last node in order is the only
+//one left without a thread.
+bool checkIfEqual(Node* root, int& leafDepth){
+  bool equal = true;
+  Node* cur = root;
+  int depth = 0;
+  while(cur != nullptr){
+    if(cur->left == nullptr){
+      //nothing on the left; a leaf if there is nothing on the right either
+      if(cur->right == nullptr){
+        equal = sameLeafDepth(depth, leafDepth) && equal;
+      }
+      //follows a real child or a thread; the depth is fixed up after a thread
+      cur = cur->right;
+      ++depth;
+      continue;
+    }
+    //find the predecessor, counting the right steps down to it
+    Node* pred = cur->left;
+    int steps = 0;
+    while(pred->right != nullptr && pred->right != cur){
+      pred = pred->right;
+      ++steps;
+    }
+    if(pred->right == nullptr){
+      //first visit: thread the predecessor back here and go left
+      pred->right = cur;
+      cur = cur->left;
+      ++depth;
+    }
+    else{
+      //back from the left subtree through the thread; we were one below pred
+      int curDepth = depth - 2 - steps;
+      pred->right = nullptr;
+      if(pred->left == nullptr){
+        equal = sameLeafDepth(curDepth + 1 + steps, leafDepth) && equal;
+      }
+      //keep walking after a mismatch so every thread gets removed
+      cur = cur->right;
+      depth = curDepth + 1;
     }
-    //check if the depth of other leaves matches the depth of first leaf
-    return depth == leafDepth;
   }
-
-  //recursively check the left and right 
-  //since you are going down the tree, also take note of the depth by +1
-  bool left = checkIfEqual(node -> left, depth+1, leafDepth);
-  bool right= checkIfEqual(node-> right, depth +1, leafDepth);
-  //both must be true in order to return true and have the tree be valid
-  return left && right;
+  return equal;
 }
 
+bool sameLeafDepth(int depth, int& leafDepth){
+  //if this is the first leaf (since initialized to -1)
+  if(leafDepth == -1){
+    leafDepth = depth;
+    return true;
+  }
+  //check if the depth of other leaves matches the depth of first leaf
+  return depth == leafDepth;
+}
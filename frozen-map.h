@@ -0,0 +1,241 @@
+#ifndef FROZEN_MAP_H
+#define FROZEN_MAP_H
+
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "bst.h"
+
+/**
+ * A read-only sorted map for data that is built once and then only queried.
+ * The items are kept in one sorted array for iteration, and the keys are
+ * copied a second time into an Eytzinger array: the implicit binary search
+ * tree laid out level by level, with the children of slot k at 2k and 2k + 1.
+ *
+ * A search walks down that array without branching on the comparisons (each
+ * step is k = 2k + less), so there is nothing to mispredict, and the top
+ * levels that every search touches share a handful of cache lines. While
+ * each level is compared, the cache line holding the descendants a few
+ * levels further down is prefetched, so the misses near the bottom overlap
+ * instead of being taken one after another.
+ *
+ * Nothing can be inserted or removed; build a new FrozenMap instead.
+ */
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class FrozenMap
+{
+public:
+    typedef std::pair<const Key, Value> value_type;
+    typedef typename std::vector<value_type>::const_iterator const_iterator;
+
+    FrozenMap();
+    template<typename Alloc>
+    explicit FrozenMap(const BinarySearchTree<Key, Value, Compare, Alloc>& tree);
+    template<typename InputIt>
+    FrozenMap(InputIt first, InputIt last, const Compare& comp = Compare());
+
+    std::size_t size() const;
+    bool empty() const;
+    const_iterator begin() const;
+    const_iterator end() const;
+
+    const_iterator find(const Key& key) const;
+    const_iterator lower_bound(const Key& key) const;
+
+private:
+    void buildIndex();
+    void fillIndex(std::size_t slot, std::size_t& rank);
+    std::size_t lowerBoundSlot(const Key& key) const;
+    static std::size_t countTrailingOnes(std::size_t bits);
+
+    // Sorted, for iteration and for the values
+    std::vector<value_type> items_;
+    // keys_[k] and ranks_[k] are the key in Eytzinger slot k (from 1) and its
+    // position in items_; slot 0 is unused
+    std::vector<Key> keys_;
+    std::vector<std::size_t> ranks_;
+    Compare comp_;
+};
+
+/*
+  ---------------------------------------------
+  Begin implementations for the FrozenMap class.
+  ---------------------------------------------
+*/
+
+template<class Key, class Value, class Compare>
+FrozenMap<Key, Value, Compare>::FrozenMap() :
+    comp_()
+{
+
+}
+
+/**
+* Copies the contents of any of the trees, in O(n).
+*/
+template<class Key, class Value, class Compare>
+template<typename Alloc>
+FrozenMap<Key, Value, Compare>::FrozenMap(const BinarySearchTree<Key, Value, Compare, Alloc>& tree) :
+    comp_(tree.key_comp())
+{
+    typedef typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator TreeIterator;
+    for(TreeIterator it = tree.begin(); it != tree.end(); ++it) {
+        items_.push_back(*it);
+    }
+    buildIndex();
+}
+
+/**
+* Copies [first, last), which must be sorted by strictly increasing key, as
+* for BinarySearchTree::assign; std::invalid_argument is thrown otherwise.
+*/
+template<class Key, class Value, class Compare>
+template<typename InputIt>
+FrozenMap<Key, Value, Compare>::FrozenMap(InputIt first, InputIt last, const Compare& comp) :
+    comp_(comp)
+{
+    for(; first != last; ++first) {
+        if(!items_.empty() && !comp_(items_.back().first, first->first)) {
+            throw std::invalid_argument("Range is not sorted by unique key");
+        }
+        items_.push_back(*first);
+    }
+    buildIndex();
+}
+
+template<class Key, class Value, class Compare>
+std::size_t FrozenMap<Key, Value, Compare>::size() const
+{
+    return items_.size();
+}
+
+template<class Key, class Value, class Compare>
+bool FrozenMap<Key, Value, Compare>::empty() const
+{
+    return items_.empty();
+}
+
+template<class Key, class Value, class Compare>
+typename FrozenMap<Key, Value, Compare>::const_iterator
+FrozenMap<Key, Value, Compare>::begin() const
+{
+    return items_.begin();
+}
+
+template<class Key, class Value, class Compare>
+typename FrozenMap<Key, Value, Compare>::const_iterator
+FrozenMap<Key, Value, Compare>::end() const
+{
+    return items_.end();
+}
+
+/**
+* Returns the item with the given key, or end() if there is none.
+*/
+template<class Key, class Value, class Compare>
+typename FrozenMap<Key, Value, Compare>::const_iterator
+FrozenMap<Key, Value, Compare>::find(const Key& key) const
+{
+    std::size_t slot = lowerBoundSlot(key);
+    if(slot == 0 || comp_(key, keys_[slot])) {
+        return end();
+    }
+    return items_.begin() + ranks_[slot];
+}
+
+/**
+* Returns the first item whose key is not less than key.
+*/
+template<class Key, class Value, class Compare>
+typename FrozenMap<Key, Value, Compare>::const_iterator
+FrozenMap<Key, Value, Compare>::lower_bound(const Key& key) const
+{
+    std::size_t slot = lowerBoundSlot(key);
+    if(slot == 0) {
+        return end();
+    }
+    return items_.begin() + ranks_[slot];
+}
+
+/**
+* Sizes the index and fills it by an in-order walk of the implicit tree.
+*/
+template<class Key, class Value, class Compare>
+void FrozenMap<Key, Value, Compare>::buildIndex()
+{
+    if(items_.empty()) {
+        return;
+    }
+    //slot 0 is never searched, but needs some key to hold
+    keys_.assign(items_.size() + 1, items_[0].first);
+    ranks_.assign(items_.size() + 1, 0);
+    std::size_t rank = 0;
+    fillIndex(1, rank);
+}
+
+/**
+* Visiting the slots in order hands out the sorted items in order. The
+* recursion is only as deep as the implicit tree, about log2 n.
+*/
+template<class Key, class Value, class Compare>
+void FrozenMap<Key, Value, Compare>::fillIndex(std::size_t slot, std::size_t& rank)
+{
+    if(slot >= keys_.size()) {
+        return;
+    }
+    fillIndex(2 * slot, rank);
+    keys_[slot] = items_[rank].first;
+    ranks_[slot] = rank;
+    ++rank;
+    fillIndex(2 * slot + 1, rank);
+}
+
+/**
+* Walks down to past a leaf, appending one bit per level: 1 where the search
+* went right (the slot's key was less than key). The lower bound is the last
+* slot where it went left, found by dropping the trailing 1s and that 0.
+* Returns 0 when every key is less than key.
+*/
+template<class Key, class Value, class Compare>
+std::size_t FrozenMap<Key, Value, Compare>::lowerBoundSlot(const Key& key) const
+{
+    //slots k * STRIDE onwards are k's descendants log2(STRIDE) levels down,
+    //and that many keys fill about one cache line
+    const std::size_t STRIDE = sizeof(Key) >= 64 ? 1 : 64 / sizeof(Key);
+    const std::size_t n = items_.size();
+    const Key* keys = keys_.data();
+    std::size_t slot = 1;
+    while(slot <= n) {
+        if(slot * STRIDE <= n) {
+            prefetchRead(keys + slot * STRIDE);
+        }
+        slot = 2 * slot + (comp_(keys[slot], key) ? 1 : 0);
+    }
+    return slot >> (countTrailingOnes(slot) + 1);
+}
+
+template<class Key, class Value, class Compare>
+std::size_t FrozenMap<Key, Value, Compare>::countTrailingOnes(std::size_t bits)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(~static_cast<unsigned long long>(bits));
+#else
+    std::size_t count = 0;
+    while(bits & 1) {
+        bits >>= 1;
+        ++count;
+    }
+    return count;
+#endif
+}
+
+/*
+  -------------------------------------------
+  End implementations for the FrozenMap class.
+  -------------------------------------------
+*/
+
+#endif
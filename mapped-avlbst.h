@@ -0,0 +1,904 @@
+#ifndef MAPPED_AVLBST_H
+#define MAPPED_AVLBST_H
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "tree-snapshot.h"
+
+/**
+ * An AVL tree map whose nodes live in a memory-mapped file instead of on the
+ * heap. Nodes link to each other by their byte offset in the file (0 is
+ * null) rather than by pointer, so the file means the same thing wherever it
+ * is mapped. Opening a tree reads nothing but the header: pages are faulted
+ * in as searches reach them, so a large tree is usable at once, and the
+ * pages a search touches are the only ones it pays for.
+ *
+ * Opened READ_ONLY, the file is mapped read-only and shared, so processes
+ * that open the same file share one copy of it in the page cache. Opened
+ * READ_WRITE, it is created if missing and updated in place: the file grows
+ * by doubling when it runs out of room, and removed nodes go on a free list
+ * that later inserts take from. The file is never shrunk.
+ *
+ * Keys and values are stored as raw bytes, so both must be trivially
+ * copyable, and the file is only readable on machines with the same byte
+ * order and type sizes (the header records them, as a snapshot's does).
+ *
+ * Changes reach the file as the OS writes dirty pages back, or at flush().
+ * Nothing orders those writes, so a crash in the middle of an update can
+ * leave the file inconsistent; DurableAVLTree is the crash-safe map. Readers
+ * should not have the file open while it is being written. Inserting and
+ * removing invalidate iterators.
+ */
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class MappedAVLTree
+{
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "MappedAVLTree stores keys and values as raw bytes");
+
+public:
+    typedef std::pair<const Key, Value> value_type;
+
+    enum Mode { READ_ONLY, READ_WRITE };
+
+    class iterator;
+
+    explicit MappedAVLTree(const std::string& path, Mode mode = READ_WRITE, const Compare& comp = Compare());
+    ~MappedAVLTree();
+
+    void insert(const value_type& keyValuePair);
+    void remove(const Key& key);
+    template<typename ForwardIt>
+    void assign(ForwardIt first, ForwardIt last);
+    void clear();
+    // Writes the changed pages back to the file and waits for them
+    void flush();
+
+    bool empty() const;
+    std::size_t size() const;
+    // Bytes in the file, including the unused room at its end
+    std::size_t fileSize() const;
+    bool isBalanced() const;
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+
+    /**
+    * A bidirectional iterator over the items in key order. It holds an
+    * offset, not a pointer, so it stays valid when the file is remapped to
+    * grow. In a READ_ONLY tree the values must not be written through it.
+    */
+    class iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef value_type& reference;
+        typedef value_type* pointer;
+
+        iterator();
+
+        reference operator*() const;
+        pointer operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
+
+    private:
+        friend class MappedAVLTree<Key, Value, Compare>;
+        iterator(std::uint64_t offset, const MappedAVLTree* tree);
+
+        std::uint64_t offset_;
+        // Only needed so that --end() can find the last item
+        const MappedAVLTree* tree_;
+    };
+
+private:
+    MappedAVLTree(const MappedAVLTree&) = delete;
+    MappedAVLTree& operator=(const MappedAVLTree&) = delete;
+
+    // The start of the file. All fields are in the writing machine's byte order.
+    struct Header
+    {
+        char magic[4];
+        std::uint32_t version;
+        std::uint32_t orderMark;
+        std::uint32_t keySize;
+        std::uint32_t valueSize;
+        std::uint32_t nodeSize;
+        std::uint64_t root;
+        // Removed nodes, linked through their left field
+        std::uint64_t freeList;
+        // Where the never used room starts
+        std::uint64_t end;
+        std::uint64_t count;
+    };
+
+    struct Node
+    {
+        std::uint64_t left;
+        std::uint64_t right;
+        std::uint64_t parent;
+        std::int8_t balance;
+        value_type item;
+    };
+
+    static const std::uint64_t FIRST_NODE = (sizeof(Header) + alignof(Node) - 1) / alignof(Node) * alignof(Node);
+    static const std::size_t INITIAL_SIZE = 64 * 1024;
+
+    Header* header() const;
+    Node* at(std::uint64_t offset) const;
+    void openFile(const std::string& path);
+    void initialize();
+    void validate(const std::string& path) const;
+    void map(std::size_t size);
+    void reserve(std::uint64_t nodes);
+    std::uint64_t allocateNode();
+    void freeNode(std::uint64_t offset);
+    void checkWritable() const;
+    template<typename ForwardIt>
+    std::uint64_t buildSubtree(ForwardIt& first, std::uint64_t count, std::uint64_t parent, int& height);
+    int checkedHeight(std::uint64_t offset) const;
+
+    void rotateLeft(std::uint64_t offset);
+    void rotateRight(std::uint64_t offset);
+    void rebalance(std::uint64_t offset);
+
+    std::uint64_t successor(std::uint64_t offset) const;
+    std::uint64_t predecessor(std::uint64_t offset) const;
+
+    int fd_;
+    Mode mode_;
+    char* base_;
+    std::size_t size_;
+    Compare comp_;
+};
+
+/*
+  ------------------------------------------------
+  Begin implementations for the MappedAVLTree class.
+  ------------------------------------------------
+*/
+
+namespace mapped_detail {
+
+const char MAGIC[4] = { 'B', 'S', 'T', 'M' };
+
+inline void throwErrno(const std::string& what)
+{
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+}
+
+template<class Key, class Value, class Compare>
+MappedAVLTree<Key, Value, Compare>::iterator::iterator() :
+    offset_(0),
+    tree_(nullptr)
+{
+}
+
+template<class Key, class Value, class Compare>
+MappedAVLTree<Key, Value, Compare>::iterator::iterator(std::uint64_t offset, const MappedAVLTree* tree) :
+    offset_(offset),
+    tree_(tree)
+{
+}
+
+template<class Key, class Value, class Compare>
+typename MappedAVLTree<Key, Value, Compare>::iterator::reference
+MappedAVLTree<Key, Value, Compare>::iterator::operator*() const
+{
+    return tree_->at(offset_)->item;
+}
+
+template<class Key, class Value, class Compare>
+typename MappedAVLTree<Key, Value, Compare>::iterator::pointer
+MappedAVLTree<Key, Value, Compare>::iterator::operator->() const
+{
+    return &tree_->at(offset_)->item;
+}
+
+template<class Key, class Value, class Compare>
+bool MappedAVLTree<Key, Value, Compare>::iterator::operator==(const iterator& rhs) const
+{
+    return offset_ == rhs.offset_;
+}
+
+template<class Key, class Value, class Compare>
+bool MappedAVLTree<Key, Value, Compare>::iterator::operator!=(const iterator& rhs) const
+{
+    return offset_ != rhs.offset_;
+}
+
+template<class Key, class Value, class Compare>
+typename MappedAVLTree<Key, Value, Compare>::iterator&
+MappedAVLTree<Key, Value, Compare>::iterator::operator++()
+{
+    offset_ = tree_->successor(offset_);
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+typename MappedAVLTree<Key, Value, Compare>::iterator
+MappedAVLTree<Key, Value, Compare>::iterator::operator++(int)
+{
+    iterator old(*this);
+    ++*this;
+    return old;
+}
+
+/**
+* Decrementing end() gives the last item.
+*/
+template<class Key, class Value, class Compare>
+typename MappedAVLTree<Key, Value, Compare>::iterator&
+MappedAVLTree<Key, Value, Compare>::iterator::operator--()
+{
+    if(offset_ == 0) {
+        std::uint64_t last = tree_->header()->root;
+        while(last != 0 && tree_->at(last)->right != 0) {
+            last = tree_->at(last)->right;
+        }
+        offset_ = last;
+    }
+    else {
+        offset_ = tree_->predecessor(offset_);
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+typename MappedAVLTree<Key, Value, Compare>::iterator
+MappedAVLTree<Key, Value, Compare>::iterator::operator--(int)
+{
+    iterator old(*this);
+    --*this;
+    return old;
+}
+
+/**
+* Maps the tree stored at path. READ_WRITE creates an empty tree there if
+* the file does not exist. Throws std::system_error if the file cannot be
+* opened or mapped, and SnapshotError if it is not a tree with these key
+* and value types.
+*/
+template<class Key, class Value, class Compare>
+MappedAVLTree<Key, Value, Compare>::MappedAVLTree(const std::string& path, Mode mode, const Compare& comp) :
+    fd_(-1),
+    mode_(mode),
+    base_(nullptr),
+    size_(0),
+    comp_(comp)
+{
+    try {
+        openFile(path);
+    }
+    catch(...) {
+        if(base_ != nullptr) {
+            ::munmap(base_, size_);
+        }
+        if(fd_ >= 0) {
+            ::close(fd_);
+        }
+        throw;
+    }
+}
+
+/**
+* Unmaps the file. Changed pages are still written back by the OS; call
+* flush() first to wait for them.
+*/
+template<class Key, class Value, class Compare>
+MappedAVLTree<Key, Value, Compare>::~MappedAVLTree()
+{
+    ::munmap(base_, size_);
+    ::close(fd_);
+}
+
+/**
+* Inserts the item, or overwrites the value if the key is present. The
+* search runs before any room is made, since growing the file remaps it and
+* moves every node in memory.
+*/
+template<class Key, class Value, class Compare>
+void MappedAVLTree<Key, Value, Compare>::insert(const value_type& keyValuePair)
+{
+    checkWritable();
+    std::uint64_t parent = 0;
+    bool asLeft = false;
+    std::uint64_t current = header()->root;
+    while(current != 0) {
+        Node* node = at(current);
+        parent = current;
+        if(comp_(keyValuePair.first, node->item.first)) {
+            asLeft = true;
+            current = node->left;
+        }
+        else if(comp_(node->item.first, keyValuePair.first)) {
+            asLeft = false;
+            current = node->right;
+        }
+        else {
+            node->item.second = keyValuePair.second;
+            return;
+        }
+    }
+
+    std::uint64_t offset = allocateNode();
+    Node* node = at(offset);
+    node->left = 0;
+    node->right = 0;
+    node->parent = parent;
+    node->balance = 0;
+    new (&node->item) value_type(keyValuePair);
+    if(parent == 0) {
+        header()->root = offset;
+    }
+    else if(asLeft) {
+        at(parent)->left = offset;
+    }
+    else {
+        at(parent)->right = offset;
+    }
+    ++header()->count;
+
+    //walk back up as AVLTree::linkNewNode does
+    std::uint64_t child = offset;
+    while(parent != 0) {
+        Node* p = at(parent);
+        p->balance += p->left == child ? -1 : 1;
+        if(p->balance == 0) {
+            break;
+        }
+        if(std::abs(p->balance) == 2) {
+            rebalance(parent);
+            break;
+        }
+        child = parent;
+        parent = p->parent;
+    }
+}
+
+/**
+* A node with two children takes its predecessor's item, and the
+* predecessor, which has at most one child, is unlinked instead. Items are
+* plain bytes here, so copying one is cheaper than swapping the nodes.
+*/
+template<class Key, class Value, class Compare>
+void MappedAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    checkWritable();
+    iterator found = find(key);
+    if(found == end()) {
+        return;
+    }
+    std::uint64_t offset = found.offset_;
+    Node* node = at(offset);
+    if(node->left != 0 && node->right != 0) {
+        std::uint64_t pred = node->left;
+        while(at(pred)->right != 0) {
+            pred = at(pred)->right;
+        }
+        std::memcpy(static_cast<void*>(&node->item), &at(pred)->item, sizeof(value_type));
+        offset = pred;
+        node = at(pred);
+    }
+
+    std::uint64_t child = node->left != 0 ? node->left : node->right;
+    std::uint64_t parent = node->parent;
+    bool fromLeft = parent != 0 && at(parent)->left == offset;
+    if(child != 0) {
+        at(child)->parent = parent;
+    }
+    if(parent == 0) {
+        header()->root = child;
+    }
+    else if(fromLeft) {
+        at(parent)->left = child;
+    }
+    else {
+        at(parent)->right = child;
+    }
+    freeNode(offset);
+    --header()->count;
+
+    //retrace as AVLTree::unlinkNode does
+    while(parent != 0) {
+        at(parent)->balance += fromLeft ? 1 : -1;
+        std::uint64_t top = parent;
+        if(std::abs(at(parent)->balance) == 2) {
+            rebalance(parent);
+            top = at(parent)->parent;
+        }
+        if(at(top)->balance != 0) {
+            break;
+        }
+        parent = at(top)->parent;
+        fromLeft = parent != 0 && at(parent)->left == top;
+    }
+}
+
+/**
+* Replaces the contents with [first, last), which must be sorted by strictly
+* increasing key (std::invalid_argument is thrown otherwise, before
+* anything changes). The file is grown once, and the nodes are laid out in key
+* order, so a full scan reads the file front to back. O(n).
+*/
+template<class Key, class Value, class Compare>
+template<typename ForwardIt>
+void MappedAVLTree<Key, Value, Compare>::assign(ForwardIt first, ForwardIt last)
+{
+    checkWritable();
+    for(ForwardIt it = first, next = first; it != last; it = next) {
+        if(++next != last && !comp_(it->first, next->first)) {
+            throw std::invalid_argument("Range is not sorted by unique key");
+        }
+    }
+    clear();
+    std::uint64_t count = static_cast<std::uint64_t>(std::distance(first, last));
+    reserve(count);
+    int height;
+    header()->root = buildSubtree(first, count, 0, height);
+    header()->count = count;
+}
+
+/**
+* Empties the tree. The file keeps its size, for the items to come.
+*/
+template<class Key, class Value, class Compare>
+void MappedAVLTree<Key, Value, Compare>::clear()
+{
+    checkWritable();
+    header()->root = 0;
+    header()->freeList = 0;
+    header()->end = FIRST_NODE;
+    header()->count = 0;
+}
+
+template<class Key, class Value, class Compare>
+void MappedAVLTree<Key, Value, Compare>::flush()
+{
+    if(mode_ == READ_WRITE && ::msync(base_, size_, MS_SYNC) != 0) {
+        mapped_detail::throwErrno("cannot flush the mapped tree");
+    }
+}
+
+template<class Key, class Value, class Compare>
+bool MappedAVLTree<Key, Value, Compare>::empty() const
+{
+    return header()->root == 0;
+}
+
+template<class Key, class Value, class Compare>
+std::size_t MappedAVLTree<Key, Value, Compare>::size() const
+{
+    return static_cast<std::size_t>(header()->count);
+}
+
+template<class Key, class Value, class Compare>
+std::size_t MappedAVLTree<Key, Value, Compare>::fileSize() const
+{
+    return size_;
+}
+
+/**
+* Checks the AVL property and the stored balances. The recursion is as deep
+* as the tree, which is only about 1.44 log2 n for a tree this class built.
+*/
+template<class Key, class Value, class Compare>
+bool MappedAVLTree<Key, Value, Compare>::isBalanced() const
+{
+    return checkedHeight(header()->root) >= 0;
+}
+
+template<class Key, class Value, class Compare>
+typename MappedAVLTree<Key, Value, Compare>::iterator
+MappedAVLTree<Key, Value, Compare>::begin() const
+{
+    std::uint64_t first = header()->root;
+    while(first != 0 && at(first)->left != 0) {
+        first = at(first)->left;
+    }
+    return iterator(first, this);
+}
+
+template<class Key, class Value, class Compare>
+typename MappedAVLTree<Key, Value, Compare>::iterator
+MappedAVLTree<Key, Value, Compare>::end() const
+{
+    return iterator(0, this);
+}
+
+template<class Key, class Value, class Compare>
+typename MappedAVLTree<Key, Value, Compare>::iterator
+MappedAVLTree<Key, Value, Compare>::find(const Key& key) const
+{
+    std::uint64_t current = header()->root;
+    while(current != 0) {
+        const Node* node = at(current);
+        if(comp_(key, node->item.first)) {
+            current = node->left;
+        }
+        else if(comp_(node->item.first, key)) {
+            current = node->right;
+        }
+        else {
+            break;
+        }
+    }
+    return iterator(current, this);
+}
+
+template<class Key, class Value, class Compare>
+typename MappedAVLTree<Key, Value, Compare>::Header*
+MappedAVLTree<Key, Value, Compare>::header() const
+{
+    return reinterpret_cast<Header*>(base_);
+}
+
+template<class Key, class Value, class Compare>
+typename MappedAVLTree<Key, Value, Compare>::Node*
+MappedAVLTree<Key, Value, Compare>::at(std::uint64_t offset) const
+{
+    return reinterpret_cast<Node*>(base_ + offset);
+}
+
+/**
+* Opens, maps and checks the file, writing a fresh header first if a
+* READ_WRITE open found it empty.
+*/
+template<class Key, class Value, class Compare>
+void MappedAVLTree<Key, Value, Compare>::openFile(const std::string& path)
+{
+    fd_ = mode_ == READ_WRITE ? ::open(path.c_str(), O_RDWR | O_CREAT, 0644) : ::open(path.c_str(), O_RDONLY);
+    if(fd_ < 0) {
+        mapped_detail::throwErrno("cannot open " + path);
+    }
+    struct stat info;
+    if(::fstat(fd_, &info) != 0) {
+        mapped_detail::throwErrno("cannot stat " + path);
+    }
+    std::size_t size = static_cast<std::size_t>(info.st_size);
+    if(size == 0 && mode_ == READ_WRITE) {
+        if(::ftruncate(fd_, static_cast<off_t>(INITIAL_SIZE)) != 0) {
+            mapped_detail::throwErrno("cannot size " + path);
+        }
+        map(INITIAL_SIZE);
+        initialize();
+        return;
+    }
+    if(size < FIRST_NODE) {
+        throw SnapshotError(path + " is too short to hold a tree");
+    }
+    map(size);
+    validate(path);
+}
+
+template<class Key, class Value, class Compare>
+void MappedAVLTree<Key, Value, Compare>::initialize()
+{
+    Header* h = header();
+    std::memcpy(h->magic, mapped_detail::MAGIC, sizeof(h->magic));
+    h->version = SNAPSHOT_VERSION;
+    h->orderMark = snapshot_detail::ORDER_MARK;
+    h->keySize = sizeof(Key);
+    h->valueSize = sizeof(Value);
+    h->nodeSize = sizeof(Node);
+    h->root = 0;
+    h->freeList = 0;
+    h->end = FIRST_NODE;
+    h->count = 0;
+}
+
+/**
+* Only the header is read, so opening costs the same for any size of tree.
+*/
+template<class Key, class Value, class Compare>
+void MappedAVLTree<Key, Value, Compare>::validate(const std::string& path) const
+{
+    const Header* h = header();
+    if(std::memcmp(h->magic, mapped_detail::MAGIC, sizeof(h->magic)) != 0) {
+        throw SnapshotError(path + " is not a mapped tree");
+    }
+    if(h->version != SNAPSHOT_VERSION || h->orderMark != snapshot_detail::ORDER_MARK) {
+        throw SnapshotError(path + " was written by another version or byte order");
+    }
+    if(h->keySize != sizeof(Key) || h->valueSize != sizeof(Value) || h->nodeSize != sizeof(Node)) {
+        throw SnapshotError(path + " holds other key or value types");
+    }
+    if(h->end < FIRST_NODE || h->end > size_ || (h->end - FIRST_NODE) % sizeof(Node) != 0 || h->root >= h->end || h->freeList >= h->end) {
+        throw SnapshotError(path + " is corrupt");
+    }
+}
+
+template<class Key, class Value, class Compare>
+void MappedAVLTree<Key, Value, Compare>::map(std::size_t size)
+{
+    int protection = mode_ == READ_WRITE ? PROT_READ | PROT_WRITE : PROT_READ;
+    void* base = ::mmap(nullptr, size, protection, MAP_SHARED, fd_, 0);
+    if(base == MAP_FAILED) {
+        mapped_detail::throwErrno("cannot map the tree");
+    }
+    base_ = static_cast<char*>(base);
+    size_ = size;
+}
+
+/**
+* Makes room for nodes more nodes past the end, doubling the file as often
+* as needed. Every pointer into the old mapping is invalid afterwards; the
+* offsets are not.
+*/
+template<class Key, class Value, class Compare>
+void MappedAVLTree<Key, Value, Compare>::reserve(std::uint64_t nodes)
+{
+    std::uint64_t needed = header()->end + nodes * sizeof(Node);
+    if(needed <= size_) {
+        return;
+    }
+    std::size_t size = size_;
+    while(size < needed) {
+        size *= 2;
+    }
+    if(::ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+        mapped_detail::throwErrno("cannot grow the mapped tree");
+    }
+    char* old = base_;
+    std::size_t oldSize = size_;
+    map(size);
+    ::munmap(old, oldSize);
+}
+
+template<class Key, class Value, class Compare>
+std::uint64_t MappedAVLTree<Key, Value, Compare>::allocateNode()
+{
+    std::uint64_t offset = header()->freeList;
+    if(offset != 0) {
+        header()->freeList = at(offset)->left;
+        return offset;
+    }
+    reserve(1);
+    offset = header()->end;
+    header()->end += sizeof(Node);
+    return offset;
+}
+
+template<class Key, class Value, class Compare>
+void MappedAVLTree<Key, Value, Compare>::freeNode(std::uint64_t offset)
+{
+    at(offset)->left = header()->freeList;
+    header()->freeList = offset;
+}
+
+template<class Key, class Value, class Compare>
+void MappedAVLTree<Key, Value, Compare>::checkWritable() const
+{
+    if(mode_ != READ_WRITE) {
+        throw std::logic_error("MappedAVLTree was opened read-only");
+    }
+}
+
+/**
+* Builds a balanced subtree of the next count items, taking nodes from the
+* end of the file in key order, and reports its height so each node's
+* balance can be set. The recursion is about log2 count deep.
+*/
+template<class Key, class Value, class Compare>
+template<typename ForwardIt>
+std::uint64_t MappedAVLTree<Key, Value, Compare>::buildSubtree(ForwardIt& first, std::uint64_t count,
+                                                               std::uint64_t parent, int& height)
+{
+    if(count == 0) {
+        height = 0;
+        return 0;
+    }
+    std::uint64_t leftCount = count / 2;
+    //the left subtree's nodes come first, so this node's offset is known now
+    std::uint64_t offset = header()->end + leftCount * sizeof(Node);
+    int leftHeight;
+    int rightHeight;
+    std::uint64_t left = buildSubtree(first, leftCount, offset, leftHeight);
+    header()->end = offset + sizeof(Node);
+    Node* node = at(offset);
+    new (&node->item) value_type(*first);
+    ++first;
+    std::uint64_t right = buildSubtree(first, count - leftCount - 1, offset, rightHeight);
+    node->left = left;
+    node->right = right;
+    node->parent = parent;
+    node->balance = static_cast<std::int8_t>(rightHeight - leftHeight);
+    height = 1 + (leftHeight > rightHeight ? leftHeight : rightHeight);
+    return offset;
+}
+
+/**
+* Returns the subtree's height, or -1 if it or any subtree below is out of
+* balance or has a wrong stored balance.
+*/
+template<class Key, class Value, class Compare>
+int MappedAVLTree<Key, Value, Compare>::checkedHeight(std::uint64_t offset) const
+{
+    if(offset == 0) {
+        return 0;
+    }
+    int left = checkedHeight(at(offset)->left);
+    int right = checkedHeight(at(offset)->right);
+    if(left < 0 || right < 0 || std::abs(right - left) > 1 || at(offset)->balance != right - left) {
+        return -1;
+    }
+    return 1 + (left > right ? left : right);
+}
+
+/**
+* Rotates the node's right child up into its place; only the links change,
+* as in AVLTree::rotateLeft.
+*/
+template<class Key, class Value, class Compare>
+void MappedAVLTree<Key, Value, Compare>::rotateLeft(std::uint64_t offset)
+{
+    Node* node = at(offset);
+    std::uint64_t right = node->right;
+    Node* rightChild = at(right);
+    std::uint64_t grandChild = rightChild->left;
+
+    node->right = grandChild;
+    if(grandChild != 0) {
+        at(grandChild)->parent = offset;
+    }
+    rightChild->parent = node->parent;
+    if(node->parent == 0) {
+        header()->root = right;
+    }
+    else if(at(node->parent)->left == offset) {
+        at(node->parent)->left = right;
+    }
+    else {
+        at(node->parent)->right = right;
+    }
+    rightChild->left = offset;
+    node->parent = right;
+}
+
+/**
+* Mirror image of rotateLeft().
+*/
+template<class Key, class Value, class Compare>
+void MappedAVLTree<Key, Value, Compare>::rotateRight(std::uint64_t offset)
+{
+    Node* node = at(offset);
+    std::uint64_t left = node->left;
+    Node* leftChild = at(left);
+    std::uint64_t grandChild = leftChild->right;
+
+    node->left = grandChild;
+    if(grandChild != 0) {
+        at(grandChild)->parent = offset;
+    }
+    leftChild->parent = node->parent;
+    if(node->parent == 0) {
+        header()->root = left;
+    }
+    else if(at(node->parent)->left == offset) {
+        at(node->parent)->left = left;
+    }
+    else {
+        at(node->parent)->right = left;
+    }
+    leftChild->right = offset;
+    node->parent = left;
+}
+
+/**
+* Restores a node whose balance is +/-2, setting the balances exactly as
+* AVLTree::rebalance does.
+*/
+template<class Key, class Value, class Compare>
+void MappedAVLTree<Key, Value, Compare>::rebalance(std::uint64_t offset)
+{
+    Node* node = at(offset);
+    if(node->balance == -2) {
+        std::uint64_t child = node->left;
+        Node* c = at(child);
+        if(c->balance <= 0) {
+            std::int8_t childBalance = c->balance;
+            rotateRight(offset);
+            node->balance = childBalance == 0 ? -1 : 0;
+            c->balance = childBalance == 0 ? 1 : 0;
+        }
+        else {
+            Node* g = at(c->right);
+            std::int8_t grandBalance = g->balance;
+            rotateLeft(child);
+            rotateRight(offset);
+            node->balance = grandBalance == -1 ? 1 : 0;
+            c->balance = grandBalance == 1 ? -1 : 0;
+            g->balance = 0;
+        }
+    }
+    else if(node->balance == 2) {
+        std::uint64_t child = node->right;
+        Node* c = at(child);
+        if(c->balance >= 0) {
+            std::int8_t childBalance = c->balance;
+            rotateLeft(offset);
+            node->balance = childBalance == 0 ? 1 : 0;
+            c->balance = childBalance == 0 ? -1 : 0;
+        }
+        else {
+            Node* g = at(c->left);
+            std::int8_t grandBalance = g->balance;
+            rotateRight(child);
+            rotateLeft(offset);
+            node->balance = grandBalance == 1 ? -1 : 0;
+            c->balance = grandBalance == -1 ? 1 : 0;
+            g->balance = 0;
+        }
+    }
+}
+
+template<class Key, class Value, class Compare>
+std::uint64_t MappedAVLTree<Key, Value, Compare>::successor(std::uint64_t offset) const
+{
+    const Node* node = at(offset);
+    if(node->right != 0) {
+        offset = node->right;
+        while(at(offset)->left != 0) {
+            offset = at(offset)->left;
+        }
+        return offset;
+    }
+    std::uint64_t parent = node->parent;
+    while(parent != 0 && at(parent)->right == offset) {
+        offset = parent;
+        parent = at(parent)->parent;
+    }
+    return parent;
+}
+
+template<class Key, class Value, class Compare>
+std::uint64_t MappedAVLTree<Key, Value, Compare>::predecessor(std::uint64_t offset) const
+{
+    const Node* node = at(offset);
+    if(node->left != 0) {
+        offset = node->left;
+        while(at(offset)->right != 0) {
+            offset = at(offset)->right;
+        }
+        return offset;
+    }
+    std::uint64_t parent = node->parent;
+    while(parent != 0 && at(parent)->left == offset) {
+        offset = parent;
+        parent = at(parent)->parent;
+    }
+    return parent;
+}
+
+/*
+  ----------------------------------------------
+  End implementations for the MappedAVLTree class.
+  ----------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,604 @@
+#ifndef PERSISTENT_AVLBST_H
+#define PERSISTENT_AVLBST_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "bst.h"
+#include "epoch-domain.h"
+
+/**
+ * An AVL map whose versions never change once published. Every update copies
+ * the O(log n) nodes on its search path (and the few a rotation touches) and
+ * shares the rest of the tree with the previous version, then publishes the
+ * new version in one atomic store.
+ *
+ * snapshot() is O(1): it takes a reference to the current root. A Snapshot can
+ * be searched and iterated from any thread with no synchronization at all,
+ * and keeps its version alive for as long as it exists, however many updates
+ * come after it. Nodes are reference counted and freed by whoever drops the
+ * last reference; the versions themselves are retired through an EpochDomain
+ * so that a concurrent snapshot() never picks up a root that is being freed.
+ *
+ * Updates are serialized by an internal mutex that readers never touch.
+ * Nodes have no parent pointers, so iterators carry their path on a stack.
+ */
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class PersistentAVLTree
+{
+private:
+    struct Node;
+
+public:
+    class const_iterator;
+    class Snapshot;
+
+    explicit PersistentAVLTree(const Compare& comp = Compare());
+    ~PersistentAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    Snapshot snapshot() const;
+
+    /**
+    * A read-only iterator over one version, in key order. It keeps the nodes
+    * still to be visited on a stack, so ++ is O(1) amortized, and it stays
+    * valid for as long as the Snapshot it came from.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const value_type* pointer;
+        typedef const value_type& reference;
+
+        const_iterator();
+        reference operator*() const;
+        pointer operator->() const;
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+        const_iterator& operator++();
+
+    private:
+        friend class Snapshot;
+        void pushLeftSpine(const Node* node);
+
+        std::vector<const Node*> path_;
+    };
+
+    /**
+    * One immutable version of the tree. Copying a Snapshot is O(1).
+    */
+    class Snapshot
+    {
+    public:
+        Snapshot();
+        Snapshot(const Snapshot& other);
+        Snapshot& operator=(const Snapshot& other);
+        ~Snapshot();
+
+        std::size_t size() const;
+        bool empty() const;
+        const_iterator begin() const;
+        const_iterator end() const;
+        const_iterator find(const Key& key) const;
+        const_iterator lower_bound(const Key& key) const;
+
+    private:
+        friend class PersistentAVLTree;
+        Snapshot(const Node* root, std::size_t size, const Compare& comp);
+
+        const Node* root_;
+        std::size_t size_;
+        Compare comp_;
+    };
+
+private:
+    PersistentAVLTree(const PersistentAVLTree&) = delete;
+    PersistentAVLTree& operator=(const PersistentAVLTree&) = delete;
+
+    struct Node
+    {
+        Node(const std::pair<const Key, Value>& item, const Node* left, const Node* right);
+
+        std::pair<const Key, Value> item;
+        const Node* left;
+        const Node* right;
+        int height;
+        mutable std::atomic<unsigned> refs;
+    };
+
+    // Owns one reference to a node
+    struct Release
+    {
+        void operator()(const Node* node) const { release(node); }
+    };
+    typedef std::unique_ptr<const Node, Release> NodeRef;
+
+    // What snapshot() picks up: a root and its key count, published together
+    struct Version
+    {
+        Version(const Node* root, std::size_t size) : root(root), size(size) { }
+        ~Version() { release(root); }
+
+        const Node* root;
+        std::size_t size;
+    };
+
+    static int height(const Node* node) { return node == nullptr ? 0 : node->height; }
+    static NodeRef retain(const Node* node);
+    static void release(const Node* node);
+    static NodeRef makeNode(const std::pair<const Key, Value>& item, NodeRef left, NodeRef right);
+    static NodeRef balance(const std::pair<const Key, Value>& item, NodeRef left, NodeRef right);
+
+    NodeRef insertNode(const Node* node, const std::pair<const Key, Value>& keyValuePair, bool& added) const;
+    NodeRef removeNode(const Node* node, const Key& key) const;
+    static NodeRef removeSmallest(const Node* node);
+    const Node* findNode(const Node* node, const Key& key) const;
+    void publish(const Node* root, std::size_t size);
+
+    std::atomic<Version*> current_;
+    std::mutex writeMutex_;
+    Compare comp_;
+    mutable EpochDomain domain_;
+};
+
+/*
+  ---------------------------------------------------------
+  Begin implementations for the PersistentAVLTree class.
+  ---------------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::Node::Node(const std::pair<const Key, Value>& item,
+                                                   const Node* left, const Node* right) :
+    item(item),
+    left(left),
+    right(right),
+    height(1 + std::max(PersistentAVLTree::height(left), PersistentAVLTree::height(right))),
+    refs(1)
+{
+
+}
+
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::PersistentAVLTree(const Compare& comp) :
+    current_(new Version(nullptr, 0)),
+    comp_(comp)
+{
+
+}
+
+/**
+* Versions retired earlier are freed by the epoch domain; nodes that live
+* snapshots still share are freed when those snapshots go.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::~PersistentAVLTree()
+{
+    delete current_.load();
+}
+
+/**
+* Sets key's value, adding the key if it is absent.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    std::lock_guard<std::mutex> lock(writeMutex_);
+    Version* version = current_.load();
+    bool added = false;
+    NodeRef root = insertNode(version->root, keyValuePair, added);
+    publish(root.release(), version->size + (added ? 1 : 0));
+}
+
+/**
+* Removes key if it is present. An absent key publishes no new version.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    std::lock_guard<std::mutex> lock(writeMutex_);
+    Version* version = current_.load();
+    if(findNode(version->root, key) == nullptr) {
+        return;
+    }
+    NodeRef root = removeNode(version->root, key);
+    publish(root.release(), version->size - 1);
+}
+
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::clear()
+{
+    std::lock_guard<std::mutex> lock(writeMutex_);
+    publish(nullptr, 0);
+}
+
+/**
+* Takes a reference to the current version in O(1). The guard keeps that
+* version from being freed between loading it and taking the reference.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Snapshot
+PersistentAVLTree<Key, Value, Compare>::snapshot() const
+{
+    EpochDomain::Guard guard(domain_);
+    Version* version = current_.load();
+    return Snapshot(retain(version->root).release(), version->size, comp_);
+}
+
+/**
+* Swaps in a version owning root and retires the one it replaces. Called with
+* the write mutex held.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::publish(const Node* root, std::size_t size)
+{
+    Version* version;
+    try {
+        version = new Version(root, size);
+    }
+    catch(...) {
+        release(root);
+        throw;
+    }
+    EpochDomain::Guard guard(domain_);
+    guard.retire(current_.exchange(version));
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::NodeRef
+PersistentAVLTree<Key, Value, Compare>::retain(const Node* node)
+{
+    if(node != nullptr) {
+        node->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    return NodeRef(node);
+}
+
+/**
+* Drops one reference, freeing the node (and dropping its children's
+* references) if it was the last.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::release(const Node* node)
+{
+    if(node != nullptr && node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        release(node->left);
+        release(node->right);
+        delete node;
+    }
+}
+
+/**
+* A new node over left and right, taking over the references passed in.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::NodeRef
+PersistentAVLTree<Key, Value, Compare>::makeNode(const std::pair<const Key, Value>& item,
+                                                 NodeRef left, NodeRef right)
+{
+    NodeRef node(new Node(item, left.get(), right.get()));
+    left.release();
+    right.release();
+    return node;
+}
+
+/**
+* Builds a node for item over left and right, whose heights differ by at most
+* two, rotating with freshly copied nodes if they differ by two. Nothing
+* reachable from a published version is modified.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::NodeRef
+PersistentAVLTree<Key, Value, Compare>::balance(const std::pair<const Key, Value>& item,
+                                                NodeRef left, NodeRef right)
+{
+    int leftHeight = height(left.get());
+    int rightHeight = height(right.get());
+    if(leftHeight > rightHeight + 1) {
+        const Node* l = left.get();
+        if(height(l->left) >= height(l->right)) {
+            NodeRef lowered = makeNode(item, retain(l->right), std::move(right));
+            return makeNode(l->item, retain(l->left), std::move(lowered));
+        }
+        const Node* lr = l->right;
+        NodeRef lowLeft = makeNode(l->item, retain(l->left), retain(lr->left));
+        NodeRef lowRight = makeNode(item, retain(lr->right), std::move(right));
+        return makeNode(lr->item, std::move(lowLeft), std::move(lowRight));
+    }
+    if(rightHeight > leftHeight + 1) {
+        const Node* r = right.get();
+        if(height(r->right) >= height(r->left)) {
+            NodeRef lowered = makeNode(item, std::move(left), retain(r->left));
+            return makeNode(r->item, std::move(lowered), retain(r->right));
+        }
+        const Node* rl = r->left;
+        NodeRef lowLeft = makeNode(item, std::move(left), retain(rl->left));
+        NodeRef lowRight = makeNode(r->item, retain(rl->right), retain(r->right));
+        return makeNode(rl->item, std::move(lowLeft), std::move(lowRight));
+    }
+    return makeNode(item, std::move(left), std::move(right));
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::NodeRef
+PersistentAVLTree<Key, Value, Compare>::insertNode(const Node* node,
+                                                   const std::pair<const Key, Value>& keyValuePair,
+                                                   bool& added) const
+{
+    if(node == nullptr) {
+        added = true;
+        return makeNode(keyValuePair, NodeRef(), NodeRef());
+    }
+    int order = threeWayCompare(comp_, keyValuePair.first, node->item.first);
+    if(order < 0) {
+        NodeRef left = insertNode(node->left, keyValuePair, added);
+        return balance(node->item, std::move(left), retain(node->right));
+    }
+    if(order > 0) {
+        NodeRef right = insertNode(node->right, keyValuePair, added);
+        return balance(node->item, retain(node->left), std::move(right));
+    }
+    return makeNode(keyValuePair, retain(node->left), retain(node->right));
+}
+
+/**
+* Copies the path to key, which must be present, without it. A node with two
+* children is replaced by a copy of its successor.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::NodeRef
+PersistentAVLTree<Key, Value, Compare>::removeNode(const Node* node, const Key& key) const
+{
+    int order = threeWayCompare(comp_, key, node->item.first);
+    if(order < 0) {
+        NodeRef left = removeNode(node->left, key);
+        return balance(node->item, std::move(left), retain(node->right));
+    }
+    if(order > 0) {
+        NodeRef right = removeNode(node->right, key);
+        return balance(node->item, retain(node->left), std::move(right));
+    }
+    if(node->left == nullptr) {
+        return retain(node->right);
+    }
+    if(node->right == nullptr) {
+        return retain(node->left);
+    }
+    const Node* successor = node->right;
+    while(successor->left != nullptr) {
+        successor = successor->left;
+    }
+    NodeRef right = removeSmallest(node->right);
+    return balance(successor->item, retain(node->left), std::move(right));
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::NodeRef
+PersistentAVLTree<Key, Value, Compare>::removeSmallest(const Node* node)
+{
+    if(node->left == nullptr) {
+        return retain(node->right);
+    }
+    NodeRef left = removeSmallest(node->left);
+    return balance(node->item, std::move(left), retain(node->right));
+}
+
+template<class Key, class Value, class Compare>
+const typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::findNode(const Node* node, const Key& key) const
+{
+    while(node != nullptr) {
+        int order = threeWayCompare(comp_, key, node->item.first);
+        if(order == 0) {
+            return node;
+        }
+        node = order < 0 ? node->left : node->right;
+    }
+    return nullptr;
+}
+
+/*
+  -------------------------------------------------------
+  End implementations for the PersistentAVLTree class.
+  -------------------------------------------------------
+*/
+
+/*
+  ------------------------------------------------------------------
+  Begin implementations for the PersistentAVLTree::Snapshot class.
+  ------------------------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::Snapshot::Snapshot() :
+    root_(nullptr),
+    size_(0)
+{
+
+}
+
+/**
+* Takes over one reference to root.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::Snapshot::Snapshot(const Node* root, std::size_t size,
+                                                           const Compare& comp) :
+    root_(root),
+    size_(size),
+    comp_(comp)
+{
+
+}
+
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::Snapshot::Snapshot(const Snapshot& other) :
+    root_(retain(other.root_).release()),
+    size_(other.size_),
+    comp_(other.comp_)
+{
+
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Snapshot&
+PersistentAVLTree<Key, Value, Compare>::Snapshot::operator=(const Snapshot& other)
+{
+    const Node* root = retain(other.root_).release();
+    release(root_);
+    root_ = root;
+    size_ = other.size_;
+    comp_ = other.comp_;
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::Snapshot::~Snapshot()
+{
+    release(root_);
+}
+
+template<class Key, class Value, class Compare>
+std::size_t PersistentAVLTree<Key, Value, Compare>::Snapshot::size() const
+{
+    return size_;
+}
+
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::Snapshot::empty() const
+{
+    return size_ == 0;
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator
+PersistentAVLTree<Key, Value, Compare>::Snapshot::begin() const
+{
+    const_iterator it;
+    it.pushLeftSpine(root_);
+    return it;
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator
+PersistentAVLTree<Key, Value, Compare>::Snapshot::end() const
+{
+    return const_iterator();
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator
+PersistentAVLTree<Key, Value, Compare>::Snapshot::find(const Key& key) const
+{
+    const_iterator it = lower_bound(key);
+    if(it != end() && comp_(key, it->first)) {
+        return end();
+    }
+    return it;
+}
+
+/**
+* Stacks every node on the search path where the search turned left; those
+* are exactly the nodes still to come in order, nearest on top.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator
+PersistentAVLTree<Key, Value, Compare>::Snapshot::lower_bound(const Key& key) const
+{
+    const_iterator it;
+    const Node* node = root_;
+    while(node != nullptr) {
+        if(comp_(node->item.first, key)) {
+            node = node->right;
+        }
+        else {
+            it.path_.push_back(node);
+            node = node->left;
+        }
+    }
+    return it;
+}
+
+/*
+  ----------------------------------------------------------------
+  End implementations for the PersistentAVLTree::Snapshot class.
+  ----------------------------------------------------------------
+*/
+
+/*
+  ------------------------------------------------------------------------
+  Begin implementations for the PersistentAVLTree::const_iterator class.
+  ------------------------------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::const_iterator::const_iterator()
+{
+
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator::reference
+PersistentAVLTree<Key, Value, Compare>::const_iterator::operator*() const
+{
+    return path_.back()->item;
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator::pointer
+PersistentAVLTree<Key, Value, Compare>::const_iterator::operator->() const
+{
+    return &(path_.back()->item);
+}
+
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::const_iterator::operator==(const const_iterator& rhs) const
+{
+    if(path_.empty() || rhs.path_.empty()) {
+        return path_.empty() && rhs.path_.empty();
+    }
+    return path_.back() == rhs.path_.back();
+}
+
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::const_iterator::operator!=(const const_iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator&
+PersistentAVLTree<Key, Value, Compare>::const_iterator::operator++()
+{
+    const Node* node = path_.back();
+    path_.pop_back();
+    pushLeftSpine(node->right);
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::const_iterator::pushLeftSpine(const Node* node)
+{
+    while(node != nullptr) {
+        path_.push_back(node);
+        node = node->left;
+    }
+}
+
+/*
+  ----------------------------------------------------------------------
+  End implementations for the PersistentAVLTree::const_iterator class.
+  ----------------------------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,401 @@
+#ifndef RANKED_AVLBST_H
+#define RANKED_AVLBST_H
+
+#include <cstddef>
+#include <utility>
+#include "avlbst.h"
+
+/**
+* An AVLNode that also records how many nodes its subtree holds (itself included).
+*/
+template <typename Key, typename Value>
+class RankedAVLNode : public AVLNode<Key, Value>
+{
+public:
+    RankedAVLNode(const Key& key, const Value& value, RankedAVLNode<Key, Value>* parent);
+    template<typename KeyArg, typename... ValueArgs>
+    RankedAVLNode(std::piecewise_construct_t, RankedAVLNode<Key, Value>* parent,
+                  KeyArg&& key, ValueArgs&&... valueArgs);
+
+    std::size_t getSize() const;
+    void setSize(std::size_t size);
+
+    // Redeclared so RankedAVLTree code gets RankedAVLNodes back; see AVLNode.
+    RankedAVLNode<Key, Value>* getParent() const;
+    RankedAVLNode<Key, Value>* getLeft() const;
+    RankedAVLNode<Key, Value>* getRight() const;
+
+    // Size of the subtree rooted at node, which may be NULL
+    static std::size_t sizeOf(const RankedAVLNode<Key, Value>* node);
+
+protected:
+    std::size_t size_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the RankedAVLNode class.
+  -------------------------------------------------
+*/
+
+template<class Key, class Value>
+RankedAVLNode<Key, Value>::RankedAVLNode(const Key& key, const Value& value,
+                                         RankedAVLNode<Key, Value>* parent) :
+    AVLNode<Key, Value>(key, value, parent), size_(1)
+{
+
+}
+
+template<class Key, class Value>
+template<typename KeyArg, typename... ValueArgs>
+RankedAVLNode<Key, Value>::RankedAVLNode(std::piecewise_construct_t, RankedAVLNode<Key, Value>* parent,
+                                         KeyArg&& key, ValueArgs&&... valueArgs) :
+    AVLNode<Key, Value>(std::piecewise_construct, parent,
+                        std::forward<KeyArg>(key), std::forward<ValueArgs>(valueArgs)...),
+    size_(1)
+{
+
+}
+
+template<class Key, class Value>
+std::size_t RankedAVLNode<Key, Value>::getSize() const
+{
+    return size_;
+}
+
+template<class Key, class Value>
+void RankedAVLNode<Key, Value>::setSize(std::size_t size)
+{
+    size_ = size;
+}
+
+template<class Key, class Value>
+RankedAVLNode<Key, Value>* RankedAVLNode<Key, Value>::getParent() const
+{
+    return static_cast<RankedAVLNode<Key, Value>*>(Node<Key, Value>::getParent());
+}
+
+template<class Key, class Value>
+RankedAVLNode<Key, Value>* RankedAVLNode<Key, Value>::getLeft() const
+{
+    return static_cast<RankedAVLNode<Key, Value>*>(this->left_);
+}
+
+template<class Key, class Value>
+RankedAVLNode<Key, Value>* RankedAVLNode<Key, Value>::getRight() const
+{
+    return static_cast<RankedAVLNode<Key, Value>*>(this->right_);
+}
+
+template<class Key, class Value>
+std::size_t RankedAVLNode<Key, Value>::sizeOf(const RankedAVLNode<Key, Value>* node)
+{
+    return node == nullptr ? 0 : node->size_;
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the RankedAVLNode class.
+  -----------------------------------------------
+*/
+
+/**
+* An AVL tree with order statistics. Every node knows its subtree size, so the
+* k-th smallest key, the position of a key and the number of keys in a range
+* are all found in one O(log n) descent. Keeping the sizes costs one extra word
+* per node and a walk to the root on every insert and remove; use AVLTree when
+* these queries are not needed.
+*/
+template <class Key, class Value,
+          class Compare = std::less<Key>,
+          class Alloc = std::allocator<std::pair<const Key, Value> > >
+class RankedAVLTree : public AVLTree<Key, Value, Compare, Alloc>
+{
+public:
+    RankedAVLTree();
+    explicit RankedAVLTree(const Compare& comp, const Alloc& alloc = Alloc());
+    explicit RankedAVLTree(const Alloc& alloc);
+    template<typename ForwardIt>
+    RankedAVLTree(ForwardIt first, ForwardIt last,
+                  const Compare& comp = Compare(), const Alloc& alloc = Alloc());
+    RankedAVLTree(const RankedAVLTree& other);
+    RankedAVLTree(RankedAVLTree&& other);
+    RankedAVLTree& operator=(const RankedAVLTree& other);
+    RankedAVLTree& operator=(RankedAVLTree&& other);
+    void swap(RankedAVLTree& other);
+    virtual ~RankedAVLTree();
+
+    typedef typename AVLTree<Key, Value, Compare, Alloc>::iterator iterator;
+
+    // Order statistics
+    std::size_t size() const;
+    iterator select(std::size_t k) const;
+    std::size_t rank(const Key& key) const;
+    std::size_t count(const Key& lo, const Key& hi) const;
+
+protected:
+    RankedAVLNode<Key, Value>* root() const;
+
+    virtual Node<Key, Value>* createBuildNode(const std::pair<const Key, Value>& item,
+                                              int leftHeight, int rightHeight);
+    virtual Node<Key, Value>* createInsertNode(Node<Key, Value>* parent, Key&& key, Value&& value);
+    virtual void destroyNode(Node<Key, Value>* node);
+    virtual void linkNewNode(Node<Key, Value>* node, Node<Key, Value>* parent, bool asLeft);
+    virtual void pullUp(Node<Key, Value>* node);
+    virtual void nodeSwap(Node<Key, Value>* n1, Node<Key, Value>* n2);
+    virtual void unlinkNode(AVLNode<Key, Value>* node);
+
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<RankedAVLNode<Key, Value> > RankedNodeAlloc;
+    typedef std::allocator_traits<RankedNodeAlloc> RankedNodeAllocTraits;
+    RankedNodeAlloc rankedNodeAlloc_;
+};
+
+template<class Key, class Value, class Compare, class Alloc>
+RankedAVLTree<Key, Value, Compare, Alloc>::RankedAVLTree() :
+    AVLTree<Key, Value, Compare, Alloc>(), rankedNodeAlloc_(this->nodeAlloc_)
+{
+
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+RankedAVLTree<Key, Value, Compare, Alloc>::RankedAVLTree(const Compare& comp, const Alloc& alloc) :
+    AVLTree<Key, Value, Compare, Alloc>(comp, alloc), rankedNodeAlloc_(this->nodeAlloc_)
+{
+
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+RankedAVLTree<Key, Value, Compare, Alloc>::RankedAVLTree(const Alloc& alloc) :
+    AVLTree<Key, Value, Compare, Alloc>(alloc), rankedNodeAlloc_(this->nodeAlloc_)
+{
+
+}
+
+/**
+* Builds the tree from a range sorted by key in O(n). The base is constructed
+* empty and filled here, since createBuildNode() only reaches this class once
+* the base constructor has finished.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+template<typename ForwardIt>
+RankedAVLTree<Key, Value, Compare, Alloc>::RankedAVLTree(ForwardIt first, ForwardIt last,
+                                                         const Compare& comp, const Alloc& alloc) :
+    AVLTree<Key, Value, Compare, Alloc>(comp, alloc), rankedNodeAlloc_(this->nodeAlloc_)
+{
+    this->assign(first, last);
+}
+
+/**
+* Copies other in O(n); the sizes are recounted by pullUp() as the copy is
+* built. See AVLTree for why this cannot be left to the base.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+RankedAVLTree<Key, Value, Compare, Alloc>::RankedAVLTree(const RankedAVLTree& other) :
+    AVLTree<Key, Value, Compare, Alloc>(other.key_comp(), other.copyAllocator()),
+    rankedNodeAlloc_(this->nodeAlloc_)
+{
+    this->cloneFrom(other);
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+RankedAVLTree<Key, Value, Compare, Alloc>::RankedAVLTree(RankedAVLTree&& other) :
+    AVLTree<Key, Value, Compare, Alloc>(std::move(other)), rankedNodeAlloc_(this->nodeAlloc_)
+{
+    other.rankedNodeAlloc_ = RankedNodeAlloc(other.nodeAlloc_);
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+RankedAVLTree<Key, Value, Compare, Alloc>&
+RankedAVLTree<Key, Value, Compare, Alloc>::operator=(const RankedAVLTree& other)
+{
+    if(this != &other) {
+        RankedAVLTree copy(other);
+        swap(copy);
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+RankedAVLTree<Key, Value, Compare, Alloc>&
+RankedAVLTree<Key, Value, Compare, Alloc>::operator=(RankedAVLTree&& other)
+{
+    if(this != &other) {
+        RankedAVLTree moved(std::move(other));
+        swap(moved);
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+void RankedAVLTree<Key, Value, Compare, Alloc>::swap(RankedAVLTree& other)
+{
+    AVLTree<Key, Value, Compare, Alloc>::swap(other);
+    std::swap(rankedNodeAlloc_, other.rankedNodeAlloc_);
+}
+
+/**
+* Releases the nodes while destroyNode() still resolves to this class.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+RankedAVLTree<Key, Value, Compare, Alloc>::~RankedAVLTree()
+{
+    this->clear();
+}
+
+/**
+* Returns the number of items in O(1).
+*/
+template<class Key, class Value, class Compare, class Alloc>
+std::size_t RankedAVLTree<Key, Value, Compare, Alloc>::size() const
+{
+    return RankedAVLNode<Key, Value>::sizeOf(root());
+}
+
+/**
+* Returns an iterator to the item with the k-th smallest key (counting from 0),
+* or end() if k >= size().
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename RankedAVLTree<Key, Value, Compare, Alloc>::iterator
+RankedAVLTree<Key, Value, Compare, Alloc>::select(std::size_t k) const
+{
+    RankedAVLNode<Key, Value>* cur = root();
+    while(cur != nullptr) {
+        std::size_t leftSize = RankedAVLNode<Key, Value>::sizeOf(cur->getLeft());
+        if(k < leftSize) {
+            cur = cur->getLeft();
+        }
+        else if(k == leftSize) {
+            break;
+        }
+        else {
+            //skip the left subtree and cur itself
+            k -= leftSize + 1;
+            cur = cur->getRight();
+        }
+    }
+    return this->makeIterator(cur);
+}
+
+/**
+* Returns how many keys are less than key, which is key's position if it is
+* present and its insertion position if not.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+std::size_t RankedAVLTree<Key, Value, Compare, Alloc>::rank(const Key& key) const
+{
+    std::size_t less = 0;
+    RankedAVLNode<Key, Value>* cur = root();
+    while(cur != nullptr) {
+        if(this->comp_(cur->getKey(), key)) {
+            less += RankedAVLNode<Key, Value>::sizeOf(cur->getLeft()) + 1;
+            cur = cur->getRight();
+        }
+        else {
+            cur = cur->getLeft();
+        }
+    }
+    return less;
+}
+
+/**
+* Returns the number of keys in [lo, hi).
+*/
+template<class Key, class Value, class Compare, class Alloc>
+std::size_t RankedAVLTree<Key, Value, Compare, Alloc>::count(const Key& lo, const Key& hi) const
+{
+    if(!this->comp_(lo, hi)) {
+        return 0;
+    }
+    return rank(hi) - rank(lo);
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+RankedAVLNode<Key, Value>* RankedAVLTree<Key, Value, Compare, Alloc>::root() const
+{
+    return static_cast<RankedAVLNode<Key, Value>*>(this->root_);
+}
+
+/**
+* Bulk-built nodes get their balance here and their size from pullUp() once
+* both children are attached.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+Node<Key, Value>*
+RankedAVLTree<Key, Value, Compare, Alloc>::createBuildNode(const std::pair<const Key, Value>& item,
+                                                           int leftHeight, int rightHeight)
+{
+    RankedAVLNode<Key, Value>* node = this->template constructNode<RankedAVLNode<Key, Value> >(
+        rankedNodeAlloc_, item.first, item.second, nullptr);
+    node->setBalance(static_cast<int8_t>(rightHeight - leftHeight));
+    return node;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+Node<Key, Value>*
+RankedAVLTree<Key, Value, Compare, Alloc>::createInsertNode(Node<Key, Value>* parent, Key&& key, Value&& value)
+{
+    return this->template constructNode<RankedAVLNode<Key, Value> >(rankedNodeAlloc_, std::piecewise_construct,
+        static_cast<RankedAVLNode<Key, Value>*>(parent), std::move(key), std::move(value));
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+void RankedAVLTree<Key, Value, Compare, Alloc>::destroyNode(Node<Key, Value>* node)
+{
+    RankedAVLNode<Key, Value>* rankedNode = static_cast<RankedAVLNode<Key, Value>*>(node);
+    RankedNodeAllocTraits::destroy(rankedNodeAlloc_, rankedNode);
+    RankedNodeAllocTraits::deallocate(rankedNodeAlloc_, rankedNode, 1);
+}
+
+/**
+* Counts the new leaf in every ancestor, then lets AVLTree link and rebalance it.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void RankedAVLTree<Key, Value, Compare, Alloc>::linkNewNode(Node<Key, Value>* node, Node<Key, Value>* parent, bool asLeft)
+{
+    for(RankedAVLNode<Key, Value>* p = static_cast<RankedAVLNode<Key, Value>*>(parent);
+        p != nullptr; p = p->getParent()) {
+        p->setSize(p->getSize() + 1);
+    }
+    AVLTree<Key, Value, Compare, Alloc>::linkNewNode(node, parent, asLeft);
+}
+
+/**
+* Takes the node out of every ancestor's count before AVLTree unlinks it, so
+* the rotations done while retracing see correct sizes.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void RankedAVLTree<Key, Value, Compare, Alloc>::unlinkNode(AVLNode<Key, Value>* node)
+{
+    for(RankedAVLNode<Key, Value>* p = static_cast<RankedAVLNode<Key, Value>*>(node)->getParent();
+        p != nullptr; p = p->getParent()) {
+        p->setSize(p->getSize() - 1);
+    }
+    AVLTree<Key, Value, Compare, Alloc>::unlinkNode(node);
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+void RankedAVLTree<Key, Value, Compare, Alloc>::pullUp(Node<Key, Value>* node)
+{
+    RankedAVLNode<Key, Value>* n = static_cast<RankedAVLNode<Key, Value>*>(node);
+    n->setSize(1 + RankedAVLNode<Key, Value>::sizeOf(n->getLeft())
+                 + RankedAVLNode<Key, Value>::sizeOf(n->getRight()));
+}
+
+/**
+* Sizes describe positions in the tree, so they trade places along with the nodes.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void RankedAVLTree<Key, Value, Compare, Alloc>::nodeSwap(Node<Key, Value>* n1, Node<Key, Value>* n2)
+{
+    AVLTree<Key, Value, Compare, Alloc>::nodeSwap(n1, n2);
+    if(n1 != nullptr && n2 != nullptr) {
+        RankedAVLNode<Key, Value>* r1 = static_cast<RankedAVLNode<Key, Value>*>(n1);
+        RankedAVLNode<Key, Value>* r2 = static_cast<RankedAVLNode<Key, Value>*>(n2);
+        std::size_t size = r1->getSize();
+        r1->setSize(r2->getSize());
+        r2->setSize(size);
+    }
+}
+
+#endif
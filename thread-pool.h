@@ -0,0 +1,218 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A fixed set of worker threads for fork-join recursion. invoke(first, second)
+ * offers second to the workers, runs first on the calling thread, then either
+ * takes second back (if no worker started it) or helps with other queued work
+ * until it finishes. A waiting thread only ever waits on a task that is
+ * already running, so nested invoke() calls cannot deadlock the pool.
+ *
+ * A pool of size n uses the caller plus n - 1 workers; size 1 runs everything
+ * inline.
+ */
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned threads = std::thread::hardware_concurrency());
+    ~ThreadPool();
+
+    unsigned size() const;
+
+    template<typename First, typename Second>
+    void invoke(First& first, Second& second);
+
+private:
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    enum TaskState { PENDING, RUNNING, DONE };
+
+    struct Task
+    {
+        std::function<void()> run;
+        TaskState state;
+        std::exception_ptr error;
+    };
+
+    void workerLoop();
+    void runTask(Task* task, std::unique_lock<std::mutex>& lock);
+    void await(Task* task);
+
+    std::vector<std::thread> workers_;
+    std::deque<Task*> queue_;
+    std::mutex mutex_;
+    std::condition_variable work_;
+    std::condition_variable finished_;
+    bool stopping_;
+};
+
+/*
+  ----------------------------------------------
+  Begin implementations for the ThreadPool class.
+  ----------------------------------------------
+*/
+
+inline ThreadPool::ThreadPool(unsigned threads) :
+    stopping_(false)
+{
+    for(unsigned i = 1; i < threads; ++i) {
+        workers_.push_back(std::thread(&ThreadPool::workerLoop, this));
+    }
+}
+
+inline ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    work_.notify_all();
+    for(std::size_t i = 0; i < workers_.size(); ++i) {
+        workers_[i].join();
+    }
+}
+
+inline unsigned ThreadPool::size() const
+{
+    return static_cast<unsigned>(workers_.size()) + 1;
+}
+
+/**
+* Runs first and second, possibly in parallel, and returns once both are done.
+* If either throws, the exception is rethrown here after both have finished.
+*/
+template<typename First, typename Second>
+void ThreadPool::invoke(First& first, Second& second)
+{
+    if(workers_.empty()) {
+        first();
+        second();
+        return;
+    }
+    Task task;
+    task.run = std::ref(second);
+    task.state = PENDING;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(&task);
+    }
+    work_.notify_one();
+
+    std::exception_ptr error;
+    try {
+        first();
+    }
+    catch(...) {
+        error = std::current_exception();
+    }
+    await(&task);
+    if(error) {
+        std::rethrow_exception(error);
+    }
+    if(task.error) {
+        std::rethrow_exception(task.error);
+    }
+}
+
+inline void ThreadPool::workerLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while(true) {
+        work_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+        if(queue_.empty()) {
+            return;
+        }
+        Task* task = queue_.front();
+        queue_.pop_front();
+        runTask(task, lock);
+    }
+}
+
+/**
+* Runs a task taken off the queue with the lock released, then marks it done.
+*/
+inline void ThreadPool::runTask(Task* task, std::unique_lock<std::mutex>& lock)
+{
+    task->state = RUNNING;
+    lock.unlock();
+    try {
+        task->run();
+    }
+    catch(...) {
+        task->error = std::current_exception();
+    }
+    lock.lock();
+    task->state = DONE;
+    finished_.notify_all();
+}
+
+/**
+* Takes task back if it was never started, otherwise runs queued work until
+* whoever picked it up has finished it.
+*/
+inline void ThreadPool::await(Task* task)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if(task->state == PENDING) {
+        //it was pushed last and nested forks have all been awaited, so it is
+        //normally at the back, but a worker may have taken later ones
+        for(std::deque<Task*>::iterator it = queue_.end(); it != queue_.begin(); ) {
+            --it;
+            if(*it == task) {
+                queue_.erase(it);
+                break;
+            }
+        }
+        runTask(task, lock);
+        return;
+    }
+    while(task->state != DONE) {
+        if(!queue_.empty()) {
+            Task* other = queue_.front();
+            queue_.pop_front();
+            runTask(other, lock);
+        }
+        else {
+            finished_.wait(lock);
+        }
+    }
+}
+
+/*
+  --------------------------------------------
+  End implementations for the ThreadPool class.
+  --------------------------------------------
+*/
+
+/**
+* Stable merge sort of [first, last) that sorts the two halves as a fork-join
+* pair on pool (which may be NULL) and merges them in place. Ranges below a few
+* thousand elements are left to std::stable_sort.
+*/
+template<typename RandomIt, typename Compare>
+void parallelStableSort(RandomIt first, RandomIt last, Compare comp, ThreadPool* pool)
+{
+    const std::ptrdiff_t MIN_FORK_SIZE = 1 << 14;
+    if(pool == nullptr || pool->size() < 2 || last - first < MIN_FORK_SIZE) {
+        std::stable_sort(first, last, comp);
+        return;
+    }
+    RandomIt middle = first + (last - first) / 2;
+    auto sortLeft = [&]() { parallelStableSort(first, middle, comp, pool); };
+    auto sortRight = [&]() { parallelStableSort(middle, last, comp, pool); };
+    pool->invoke(sortLeft, sortRight);
+    std::inplace_merge(first, middle, last, comp);
+}
+
+#endif
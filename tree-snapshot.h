@@ -0,0 +1,271 @@
+#ifndef TREE_SNAPSHOT_H
+#define TREE_SNAPSHOT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+/**
+ * The binary snapshot format written by BinarySearchTree::save() and read by
+ * load(). All fields are in the writing machine's byte order:
+ *
+ *   char[4]   magic "BSTS"
+ *   uint32    format version (SNAPSHOT_VERSION)
+ *   uint32    0x01020304, so a reader with the other byte order notices
+ *   uint32    key size, value size: sizeof for raw types, 0 for encoded ones
+ *   uint64    item count
+ *   ...       the items in key order, each key then value (see SnapshotCodec)
+ *   uint64    FNV-1a hash of every byte above
+ */
+const std::uint32_t SNAPSHOT_VERSION = 1;
+
+/**
+ * Thrown for streams that fail and for snapshots that are truncated,
+ * corrupt, or were written for other key or value types.
+ */
+class SnapshotError : public std::runtime_error
+{
+public:
+    explicit SnapshotError(const std::string& what);
+};
+
+/**
+ * Hashes bytes on their way to a stream. They go straight to the stream's
+ * buffer, skipping the per-call checks of ostream::write, since an item is
+ * often only a few bytes.
+ */
+class SnapshotWriter
+{
+public:
+    explicit SnapshotWriter(std::ostream& out);
+
+    void write(const void* data, std::size_t size);
+    // Appends the hash of everything written so far and flushes
+    void finish();
+
+private:
+    std::ostream& out_;
+    std::streambuf* buf_;
+    std::uint64_t hash_;
+};
+
+/**
+ * Reads from a stream's buffer and hashes what it hands out, so the hash can
+ * be checked against the one stored after the items. Nothing past the
+ * snapshot is consumed, so more data may follow it in the stream.
+ */
+class SnapshotReader
+{
+public:
+    explicit SnapshotReader(std::istream& in);
+
+    void read(void* data, std::size_t size);
+    // Reads the stored hash and throws unless it matches what was read
+    void finish();
+
+private:
+    std::istream& in_;
+    std::streambuf* buf_;
+    std::uint64_t hash_;
+};
+
+/**
+ * How one key or value is written. Trivially copyable types are copied byte
+ * for byte and record their size in the header; specialize this for other
+ * types, as is done for std::string below, and set SIZE to 0.
+ */
+template <typename T, typename Enable = void>
+struct SnapshotCodec
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Specialize SnapshotCodec to save a type that is not trivially copyable");
+    static const std::uint32_t SIZE = sizeof(T);
+
+    static void write(SnapshotWriter& out, const T& item)
+    {
+        out.write(&item, sizeof(T));
+    }
+    static void read(SnapshotReader& in, T& item)
+    {
+        in.read(&item, sizeof(T));
+    }
+};
+
+/**
+ * Strings are written as a 64-bit length followed by their characters.
+ */
+template <>
+struct SnapshotCodec<std::string>
+{
+    static const std::uint32_t SIZE = 0;
+
+    static void write(SnapshotWriter& out, const std::string& item)
+    {
+        std::uint64_t length = item.size();
+        out.write(&length, sizeof(length));
+        out.write(item.data(), item.size());
+    }
+    static void read(SnapshotReader& in, std::string& item)
+    {
+        std::uint64_t length;
+        in.read(&length, sizeof(length));
+        item.clear();
+        //grow as the characters arrive, so a corrupt length cannot force a huge allocation
+        char chunk[256];
+        while(length > 0) {
+            std::size_t part = length < sizeof(chunk) ? static_cast<std::size_t>(length) : sizeof(chunk);
+            in.read(chunk, part);
+            item.append(chunk, part);
+            length -= part;
+        }
+    }
+};
+
+/**
+ * Hands the items of a snapshot to BinarySearchTree::buildSubtree() one at a
+ * time, as it asks for them, so the whole file is never held in memory. Each
+ * item is read when it is dereferenced, which buildSubtree() does once per
+ * item. Key and Value must be default constructible.
+ */
+template <typename Key, typename Value>
+class SnapshotItems
+{
+public:
+    explicit SnapshotItems(SnapshotReader& in);
+
+    std::pair<const Key, Value> operator*();
+    SnapshotItems& operator++();
+
+private:
+    SnapshotReader& in_;
+    std::pair<Key, Value> item_;
+    bool loaded_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the snapshot I/O classes.
+  -------------------------------------------------
+*/
+
+namespace snapshot_detail {
+
+const char MAGIC[4] = { 'B', 'S', 'T', 'S' };
+const std::uint32_t ORDER_MARK = 0x01020304u;
+const std::uint64_t FNV_OFFSET = 14695981039346656037ull;
+const std::uint64_t FNV_PRIME = 1099511628211ull;
+
+inline std::uint64_t hashBytes(std::uint64_t hash, const char* data, std::size_t size)
+{
+    for(std::size_t i = 0; i < size; ++i) {
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * FNV_PRIME;
+    }
+    return hash;
+}
+
+}
+
+inline SnapshotError::SnapshotError(const std::string& what) :
+    std::runtime_error("snapshot: " + what)
+{
+}
+
+inline SnapshotWriter::SnapshotWriter(std::ostream& out) :
+    out_(out),
+    buf_(out.rdbuf()),
+    hash_(snapshot_detail::FNV_OFFSET)
+{
+    if(buf_ == nullptr || !out_) {
+        throw SnapshotError("stream is not writable");
+    }
+}
+
+inline void SnapshotWriter::write(const void* data, std::size_t size)
+{
+    const char* bytes = static_cast<const char*>(data);
+    hash_ = snapshot_detail::hashBytes(hash_, bytes, size);
+    if(buf_->sputn(bytes, static_cast<std::streamsize>(size)) != static_cast<std::streamsize>(size)) {
+        out_.setstate(std::ios_base::badbit);
+        throw SnapshotError("write failed");
+    }
+}
+
+inline void SnapshotWriter::finish()
+{
+    std::uint64_t hash = hash_;
+    write(&hash, sizeof(hash));
+    out_.flush();
+    if(!out_) {
+        throw SnapshotError("write failed");
+    }
+}
+
+inline SnapshotReader::SnapshotReader(std::istream& in) :
+    in_(in),
+    buf_(in.rdbuf()),
+    hash_(snapshot_detail::FNV_OFFSET)
+{
+    if(buf_ == nullptr || !in_) {
+        throw SnapshotError("stream is not readable");
+    }
+}
+
+inline void SnapshotReader::read(void* data, std::size_t size)
+{
+    char* bytes = static_cast<char*>(data);
+    if(buf_->sgetn(bytes, static_cast<std::streamsize>(size)) != static_cast<std::streamsize>(size)) {
+        in_.setstate(std::ios_base::eofbit | std::ios_base::failbit);
+        throw SnapshotError("unexpected end of stream");
+    }
+    hash_ = snapshot_detail::hashBytes(hash_, bytes, size);
+}
+
+inline void SnapshotReader::finish()
+{
+    std::uint64_t expected = hash_;
+    std::uint64_t stored;
+    read(&stored, sizeof(stored));
+    if(stored != expected) {
+        throw SnapshotError("checksum mismatch");
+    }
+}
+
+template<typename Key, typename Value>
+SnapshotItems<Key, Value>::SnapshotItems(SnapshotReader& in) :
+    in_(in),
+    item_(),
+    loaded_(false)
+{
+}
+
+template<typename Key, typename Value>
+std::pair<const Key, Value> SnapshotItems<Key, Value>::operator*()
+{
+    if(!loaded_) {
+        SnapshotCodec<Key>::read(in_, item_.first);
+        SnapshotCodec<Value>::read(in_, item_.second);
+        loaded_ = true;
+    }
+    return std::pair<const Key, Value>(std::move(item_.first), std::move(item_.second));
+}
+
+template<typename Key, typename Value>
+SnapshotItems<Key, Value>& SnapshotItems<Key, Value>::operator++()
+{
+    loaded_ = false;
+    return *this;
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the snapshot I/O classes.
+  -----------------------------------------------
+*/
+
+#endif